@@ -0,0 +1,194 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Round trips through a real Service on the bus dbus-test-runner
+ * provides, the service runs in a forked child that is killed once
+ * the benchmarks are done.
+ */
+
+#include "cross_process_sync.h"
+#include "fork_and_run.h"
+
+#include <com/ubuntu/content/hub.h>
+#include <com/ubuntu/content/item.h>
+#include <com/ubuntu/content/peer.h>
+#include <com/ubuntu/content/transfer.h>
+#include <com/ubuntu/content/type.h>
+
+#include "com/ubuntu/content/detail/peer_registry.h"
+#include "com/ubuntu/content/detail/service.h"
+#include "serviceadaptor.h"
+
+#include <benchmark/benchmark.h>
+
+#include <QCoreApplication>
+#include <QMimeData>
+#include <QTimer>
+#include <QtDBus/QDBusConnection>
+
+#include <unistd.h>
+
+namespace cua = com::ubuntu::ApplicationManager;
+namespace cuc = com::ubuntu::content;
+namespace cucd = com::ubuntu::content::detail;
+
+namespace
+{
+const QString service_name{"com.ubuntu.content.dbus.Service"};
+const QString surface_id{"benchmark-surface"};
+const int known_peers = 32;
+
+/* Fixed set of peers, enough to make enumeration non trivial */
+struct StaticPeerRegistry : public cucd::PeerRegistry
+{
+    cuc::Peer default_source_for_type(cuc::Type) { return cuc::Peer{"com.example.source_app_1.0"}; }
+    void enumerate_known_peers(const std::function<void(const cuc::Peer&)>& for_each) { enumerate(for_each); }
+    void enumerate_known_sources_for_type(cuc::Type, const std::function<void(const cuc::Peer&)>& for_each) { enumerate(for_each); }
+    void enumerate_known_destinations_for_type(cuc::Type, const std::function<void(const cuc::Peer&)>& for_each) { enumerate(for_each); }
+    void enumerate_known_shares_for_type(cuc::Type, const std::function<void(const cuc::Peer&)>& for_each) { enumerate(for_each); }
+    bool install_default_source_for_type(cuc::Type, cuc::Peer) { return false; }
+    bool install_source_for_type(cuc::Type, cuc::Peer) { return false; }
+    bool install_destination_for_type(cuc::Type, cuc::Peer) { return false; }
+    bool install_share_for_type(cuc::Type, cuc::Peer) { return false; }
+    bool remove_peer(cuc::Peer) { return false; }
+    bool peer_is_legacy(QString) { return false; }
+
+    void enumerate(const std::function<void(const cuc::Peer&)>& for_each)
+    {
+        for (int i = 0; i < known_peers; i++)
+            for_each(cuc::Peer{QString("com.example.peer%1_app_1.0").arg(i)});
+    }
+};
+
+/* Launching apps is not what is being measured, set
+ * CONTENT_HUB_BENCH_LAUNCH_LATENCY to a number of milliseconds
+ * to have launches block like a cold start would.
+ */
+struct NullAppManager : public cua::ApplicationManager
+{
+    NullAppManager() : latency(qgetenv("CONTENT_HUB_BENCH_LAUNCH_LATENCY").toInt()) {}
+
+    bool invoke_application(const std::string&, gchar**)
+    {
+        if (latency > 0)
+            usleep(latency * 1000);
+        return true;
+    }
+    bool stop_application(const std::string&) { return true; }
+    bool is_application_started(const std::string&) { return true; }
+
+    int latency;
+};
+}
+
+static void BM_KnownSourcesForType(benchmark::State& state)
+{
+    auto hub = cuc::Hub::Client::instance();
+    for (auto _ : state)
+        benchmark::DoNotOptimize(hub->known_sources_for_type(cuc::Type::Known::pictures()));
+    state.SetItemsProcessed(state.iterations() * known_peers);
+}
+BENCHMARK(BM_KnownSourcesForType)->UseRealTime();
+
+static void BM_PasteRoundTrip(benchmark::State& state)
+{
+    auto hub = cuc::Hub::Client::instance();
+    QMimeData data;
+    data.setData("application/x-content-hub-benchmark", QByteArray(state.range(0), 'p'));
+
+    for (auto _ : state)
+    {
+        if (not hub->createPasteSync(surface_id, data))
+        {
+            state.SkipWithError("createPasteSync failed");
+            break;
+        }
+        delete hub->latestPaste(surface_id);
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0) * 2);
+}
+/* The client refuses pastes over 4 MiB, see maxBufferSize in utils.cpp */
+BENCHMARK(BM_PasteRoundTrip)->RangeMultiplier(16)->Range(64, (4 << 20) - (4 << 10))->UseRealTime();
+
+static void BM_TransferRoundTrip(benchmark::State& state)
+{
+    auto hub = cuc::Hub::Client::instance();
+    auto peer = hub->default_source_for_type(cuc::Type::Known::pictures());
+
+    QVector<cuc::Item> items;
+    for (int i = 0; i < state.range(0); i++)
+    {
+        cuc::Item item;
+        item.setName(QString("item%1").arg(i));
+        item.setText(QString("data%1").arg(i));
+        items << item;
+    }
+
+    for (auto _ : state)
+    {
+        auto transfer = hub->create_import_from_peer(peer);
+        transfer->start();
+        transfer->charge(items);
+        benchmark::DoNotOptimize(transfer->collect());
+        transfer->finalize();
+        delete transfer;
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_TransferRoundTrip)->RangeMultiplier(8)->Range(1, 512)->UseRealTime();
+
+int main(int argc, char** argv)
+{
+    qputenv("CONTENT_HUB_TESTING", "1");
+    qputenv("APP_ID", "com.example.benchmark_app_1.0");
+
+    test::CrossProcessSync sync;
+
+    auto service = [&sync]()
+    {
+        int argc = 0;
+        QCoreApplication app{argc, nullptr};
+
+        QDBusConnection connection = QDBusConnection::sessionBus();
+        QSharedPointer<cucd::PeerRegistry> registry{new StaticPeerRegistry()};
+        auto app_manager = QSharedPointer<cua::ApplicationManager>(new NullAppManager());
+        cucd::Service implementation(connection, registry, app_manager, &app);
+        new ServiceAdaptor(std::addressof(implementation));
+
+        connection.registerService(service_name);
+        connection.registerObject("/", std::addressof(implementation));
+
+        sync.signal_ready();
+        app.exec();
+    };
+
+    auto client = [&sync, &argc, argv]()
+    {
+        QCoreApplication app(argc, argv);
+        app.setApplicationName("com.example.benchmark_app_1.0");
+        sync.wait_for_signal_ready();
+
+        benchmark::Initialize(&argc, argv);
+        QTimer::singleShot(0, [&app]()
+        {
+            benchmark::RunSpecifiedBenchmarks();
+            app.quit();
+        });
+        app.exec();
+    };
+
+    return test::fork_and_run(service, client);
+}
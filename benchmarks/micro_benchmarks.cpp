@@ -0,0 +1,163 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "com/ubuntu/content/utils.cpp"
+#include "com/ubuntu/content/service/registry.h"
+
+#include <com/ubuntu/content/item.h>
+#include <com/ubuntu/content/peer.h>
+
+#include <benchmark/benchmark.h>
+
+#include <QCoreApplication>
+#include <QDBusArgument>
+#include <QDBusMetaType>
+#include <QTemporaryDir>
+
+namespace cuc = com::ubuntu::content;
+
+namespace
+{
+QMimeData* mime_data_of_size(int size)
+{
+    auto data = new QMimeData();
+    data->setText(QString(size / 2, 'x'));
+    data->setData("application/x-content-hub-benchmark", QByteArray(size / 2, 'y'));
+    return data;
+}
+
+/* Bigger pastes aren't serialized at all, leave room for the header */
+const int largestPaste = maxBufferSize - (4 << 10);
+}
+
+static void BM_SerializeMimeData(benchmark::State& state)
+{
+    QScopedPointer<QMimeData> data(mime_data_of_size(state.range(0)));
+    for (auto _ : state)
+        benchmark::DoNotOptimize(serializeMimeData(*data));
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_SerializeMimeData)->RangeMultiplier(16)->Range(64, largestPaste);
+
+/* Only measures turning an oversized paste away */
+static void BM_SerializeOversizedMimeData(benchmark::State& state)
+{
+    QScopedPointer<QMimeData> data(mime_data_of_size(state.range(0)));
+    for (auto _ : state)
+        benchmark::DoNotOptimize(serializeMimeData(*data));
+}
+BENCHMARK(BM_SerializeOversizedMimeData)->Arg(16 << 20);
+
+static void BM_DeserializeMimeData(benchmark::State& state)
+{
+    QScopedPointer<QMimeData> data(mime_data_of_size(state.range(0)));
+    QByteArray serialized = serializeMimeData(*data);
+    /* Formats are copied out as they are read, read them all */
+    for (auto _ : state)
+    {
+        QScopedPointer<QMimeData> deserialized(deserializeMimeData(serialized));
+        Q_FOREACH (const QString& format, deserialized->formats())
+            benchmark::DoNotOptimize(deserialized->data(format));
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_DeserializeMimeData)->RangeMultiplier(16)->Range(64, largestPaste);
+
+static void BM_CopyToStore(benchmark::State& state)
+{
+    QTemporaryDir src_dir;
+    QTemporaryDir store_dir;
+    QString src = src_dir.path() + "/benchmark.jpg";
+    QFile f(src);
+    f.open(QIODevice::WriteOnly);
+    f.write(QByteArray(state.range(0), 'z'));
+    f.close();
+    QString url = QUrl::fromLocalFile(src).toString();
+
+    for (auto _ : state)
+    {
+        QString dest = copy_to_store(url, store_dir.path());
+        state.PauseTiming();
+        QFile::remove(QUrl(dest).toLocalFile());
+        state.ResumeTiming();
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_CopyToStore)->RangeMultiplier(16)->Range(4 << 10, 64 << 20);
+
+static void BM_RegistryEnumerateSources(benchmark::State& state)
+{
+    Registry registry;
+    for (int i = 0; i < state.range(0); i++)
+        registry.install_source_for_type(cuc::Type::Known::pictures(),
+                                         cuc::Peer{QString("com.example.peer%1_app_1.0").arg(i)});
+
+    for (auto _ : state)
+    {
+        int count = 0;
+        registry.enumerate_known_sources_for_type(cuc::Type::Known::pictures(),
+                                                  [&count](const cuc::Peer&) { count++; });
+        benchmark::DoNotOptimize(count);
+    }
+}
+BENCHMARK(BM_RegistryEnumerateSources)->RangeMultiplier(4)->Range(1, 256);
+
+static void BM_MarshalPeer(benchmark::State& state)
+{
+    QByteArray icon(state.range(0), 'i');
+    cuc::Peer peer{"com.example.peer_app_1.0", "Example", icon, "example", false};
+    for (auto _ : state)
+    {
+        QDBusArgument argument;
+        argument << peer;
+        benchmark::DoNotOptimize(argument);
+    }
+}
+BENCHMARK(BM_MarshalPeer)->Arg(0)->Arg(4 << 10)->Arg(64 << 10);
+
+static void BM_MarshalItems(benchmark::State& state)
+{
+    QVariantList items;
+    for (int i = 0; i < state.range(0); i++)
+    {
+        cuc::Item item(QUrl::fromLocalFile(QString("/tmp/item%1.jpg").arg(i)));
+        item.setName(QString("item%1").arg(i));
+        items << QVariant::fromValue(item);
+    }
+
+    for (auto _ : state)
+    {
+        QDBusArgument argument;
+        argument.beginArray(qMetaTypeId<cuc::Item>());
+        Q_FOREACH (QVariant v, items)
+            argument << v.value<cuc::Item>();
+        argument.endArray();
+        benchmark::DoNotOptimize(argument);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_MarshalItems)->RangeMultiplier(8)->Range(1, 4096);
+
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv);
+    qDBusRegisterMetaType<cuc::Peer>();
+    qDBusRegisterMetaType<cuc::Item>();
+
+    benchmark::Initialize(&argc, argv);
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
@@ -105,6 +105,17 @@ void ContentItem::setText(const QString &text)
     Q_EMIT textChanged();
 }
 
+/*!
+ * \qmlproperty string ContentItem::mimeType
+ * MIME type of the content, detected by the content hub when the
+ * transfer was charged
+ */
+QString ContentItem::mimeType() const
+{
+    TRACE() << Q_FUNC_INFO;
+    return m_item.mimeType();
+}
+
 /*!
  * \brief ContentItem::item
  * \internal
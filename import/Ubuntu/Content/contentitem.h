@@ -29,6 +29,7 @@ class ContentItem : public QObject
     Q_PROPERTY(QString name READ name WRITE setName NOTIFY nameChanged)
     Q_PROPERTY(QUrl url READ url WRITE setUrl NOTIFY urlChanged)
     Q_PROPERTY(QString text READ text WRITE setText NOTIFY textChanged)
+    Q_PROPERTY(QString mimeType READ mimeType NOTIFY urlChanged)
 
 public:
     ContentItem(QObject *parent = nullptr);
@@ -42,6 +43,8 @@ public:
     QString text();
     void setText(const QString &text);
 
+    QString mimeType() const;
+
     const com::ubuntu::content::Item &item() const;
     void setItem(const com::ubuntu::content::Item &item);
 
@@ -16,6 +16,7 @@
 
 #include "contenttype.h"
 #include "../../../src/com/ubuntu/content/debug.h"
+#include "../../../src/com/ubuntu/content/detail/type_table.h"
 
 /*!
    \qmltype ContentType
@@ -64,6 +65,7 @@
  */
 
 namespace cuc = com::ubuntu::content;
+namespace cucd = com::ubuntu::content::detail;
 
 
 ContentType::ContentType(QObject *parent)
@@ -113,24 +115,16 @@ const com::ubuntu::content::Type &ContentType::contentType2HubType(Type type)
  */
 ContentType::Type ContentType::hubType2contentType(const QString& type)
 {
-    if (type == cuc::Type::Known::documents().id())
-        return Documents;
-    else if (type ==  cuc::Type::Known::pictures().id())
-        return Pictures;
-    else if (type ==  cuc::Type::Known::music().id())
-        return Music;
-    else if (type ==  cuc::Type::Known::contacts().id())
-        return Contacts;
-    else if (type ==  cuc::Type::Known::videos().id())
-        return Videos;
-    else if (type ==  cuc::Type::Known::links().id())
-        return Links;
-    else if (type ==  cuc::Type::Known::ebooks().id())
-        return EBooks;
-    else if (type ==  cuc::Type::Known::text().id())
-        return Text;
-    else if (type ==  cuc::Type::Known::events().id())
-        return Events;
-    else
-      return Unknown;
+    switch(cucd::find_type(type)) {
+    case cucd::DocumentsTypeIndex: return Documents;
+    case cucd::PicturesTypeIndex: return Pictures;
+    case cucd::MusicTypeIndex: return Music;
+    case cucd::ContactsTypeIndex: return Contacts;
+    case cucd::VideosTypeIndex: return Videos;
+    case cucd::LinksTypeIndex: return Links;
+    case cucd::EbooksTypeIndex: return EBooks;
+    case cucd::TextTypeIndex: return Text;
+    case cucd::EventsTypeIndex: return Events;
+    default: return Unknown;
+    }
 }
@@ -20,6 +20,7 @@
 
 #include <com/ubuntu/content/peer.h>
 #include <com/ubuntu/content/scope.h>
+#include <com/ubuntu/content/transfer.h>
 #include <com/ubuntu/content/type.h>
 
 #include <QObject>
@@ -36,7 +37,6 @@ namespace content
 {
 class ImportExportHandler;
 class Store;
-class Transfer;
 
 class Hub : public QObject
 {
@@ -70,6 +70,8 @@ class Hub : public QObject
     Q_INVOKABLE virtual Transfer* create_share_to_peer_for_type(Peer peer, Type type);
     Q_INVOKABLE virtual bool has_pending(QString peer_id);
     Q_INVOKABLE virtual Peer peer_for_app_id(QString app_id);
+    /* mode is what transfers delivered to handler should use */
+    Q_INVOKABLE virtual void register_import_export_handler(ImportExportHandler* handler, Transfer::ItemMode mode);
 
     ///
     // Copy & Paste
@@ -95,9 +97,15 @@ class Hub : public QObject
     void onPasteFormatsChanged(const QStringList &);
   protected:
     Hub(QObject* = nullptr);
+    /* The pasteboard is only followed while these signals have receivers */
+    void connectNotify(const QMetaMethod& signal);
+    void disconnectNotify(const QMetaMethod& signal);
 
   private:
     void requestPasteFormats();
+    void subscribePasteboard();
+    void unsubscribePasteboard();
+    void onPasteboardUpdated(qulonglong generation, const QStringList& added, const QStringList& removed);
     struct Private;
     QScopedPointer<Private> d;
     bool eventFilter(QObject *obj, QEvent *event);
@@ -38,6 +38,7 @@ class Item : public QObject
     Q_PROPERTY(QString text READ text WRITE setText)
     Q_PROPERTY(QByteArray stream READ stream WRITE setStream)
     Q_PROPERTY(QString streamType READ streamType WRITE setStreamType)
+    Q_PROPERTY(QString mimeType READ mimeType WRITE setMimeType)
 
   public:
     Item(const QUrl& = QUrl(), QObject* = nullptr);
@@ -57,6 +58,8 @@ class Item : public QObject
     Q_INVOKABLE void setStream(const QByteArray &stream) const;
     Q_INVOKABLE const QString& streamType() const;
     Q_INVOKABLE void setStreamType(const QString &type) const;
+    Q_INVOKABLE const QString& mimeType() const;
+    Q_INVOKABLE void setMimeType(const QString &type) const;
 
   private:
     struct Private;
@@ -54,6 +54,7 @@ class Transfer : public QObject
     Q_ENUMS(State)
     Q_ENUMS(SelectionType)
     Q_ENUMS(Direction)
+    Q_ENUMS(ItemMode)
     Q_PROPERTY(int id READ id)
     Q_PROPERTY(State state READ state NOTIFY stateChanged)
     Q_PROPERTY(QVector<Item> items READ collect WRITE charge)
@@ -64,6 +65,7 @@ class Transfer : public QObject
     Q_PROPERTY(QString contentType READ contentType)
     Q_PROPERTY(QString source READ source)
     Q_PROPERTY(QString destination READ destination)
+    Q_PROPERTY(ItemMode itemMode READ itemMode WRITE setItemMode NOTIFY itemModeChanged)
 
   public:
     enum State
@@ -92,6 +94,16 @@ class Transfer : public QObject
         Share
     };
 
+    /* How charged files reach the destination: copied into its store,
+     * or left where they are and handed off as open file descriptors,
+     * see openItem()
+     */
+    enum ItemMode
+    {
+        copy,
+        handoff
+    };
+
     Transfer(const Transfer&) = delete;
     virtual ~Transfer();
 
@@ -115,11 +127,27 @@ class Transfer : public QObject
     Q_INVOKABLE virtual QString contentType() const;
     Q_INVOKABLE virtual QString source() const;
     Q_INVOKABLE virtual QString destination() const;
+    Q_INVOKABLE virtual ItemMode itemMode() const;
+    Q_INVOKABLE virtual bool setItemMode(const ItemMode&);
+    /* Read only descriptor for a handed off item, invalid otherwise */
+    Q_INVOKABLE virtual QDBusUnixFileDescriptor openItem(int index);
+    Q_INVOKABLE virtual bool persist();
+    /* Charging in batches, appendItems() doesn't wait for the service,
+     * errors are reported by commitCharge().  charge() does this by
+     * itself for large transfers.
+     */
+    Q_INVOKABLE virtual bool beginCharge();
+    Q_INVOKABLE virtual void appendItems(const QVector<Item>& items);
+    Q_INVOKABLE virtual bool commitCharge();
+    /* Items appended so far from first on, see itemsAppended() */
+    Q_INVOKABLE virtual QVector<Item> collectFrom(int first);
 
     Q_SIGNAL void stateChanged();
     Q_SIGNAL void storeChanged();
     Q_SIGNAL void selectionTypeChanged();
     Q_SIGNAL void downloadIdChanged();
+    Q_SIGNAL void itemModeChanged();
+    Q_SIGNAL void itemsAppended(int count);
 
   private:
     struct Private;
@@ -64,6 +64,12 @@ class Type : public QObject
 
     Q_INVOKABLE virtual const QString& id() const;
 
+    /* Dense integer identifying id(), equal ids share the same index
+     * within a process.  Not stable across processes, never persist it.
+     * -1 for ids nothing in the process registered.
+     */
+    int index() const;
+
   protected:
     friend struct Known;
     friend class detail::Service;
@@ -23,7 +23,12 @@
 
 const QLatin1String HUB_SERVICE_NAME = QLatin1String("com.ubuntu.content.dbus.Service");
 const QLatin1String HUB_SERVICE_PATH = QLatin1String("/");
+const QLatin1String HUB_METRICS_PATH = QLatin1String("/metrics");
 const QLatin1String HANDLER_NAME_TEMPLATE = QLatin1String("com.ubuntu.content.handler.%1");
 const QLatin1String HANDLER_BASE_PATH = QLatin1String("/com/ubuntu/content/handler");
+/* Handler accepts the Handle*WithSnapshot calls */
+const QLatin1String HANDLER_CAPABILITY_SNAPSHOT = QLatin1String("handler-snapshot");
+/* Handler wants the items of its transfers as file descriptors */
+const QLatin1String HANDLER_CAPABILITY_ITEM_FD = QLatin1String("handler-item-fd");
 
 #endif // COMMON_H
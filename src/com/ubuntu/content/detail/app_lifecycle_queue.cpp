@@ -0,0 +1,299 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "app_lifecycle_queue.h"
+#include "debug.h"
+#include "trace.h"
+
+#include <QCoreApplication>
+#include <QHash>
+#include <QList>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QTimer>
+
+#include <glib.h>
+
+namespace cucd = com::ubuntu::content::detail;
+namespace cua = com::ubuntu::ApplicationManager;
+
+namespace
+{
+enum Operation
+{
+    Launch,
+    Stop,
+    Query
+};
+
+const char* operation_name(int operation)
+{
+    switch (operation)
+    {
+    case Launch: return "launch";
+    case Stop: return "stop";
+    case Query: return "query";
+    }
+    return "unknown";
+}
+
+/* ubuntu-app-launch can take several seconds for a cold start */
+const int defaultTimeout = 30 * 1000;
+const int defaultWorkers = 4;
+}
+
+struct cucd::AppLifecycleQueue::Job
+{
+    quint64 id;
+    int operation;
+    QString app_id;
+    QStringList uris;
+    QList<Callback> callbacks;
+    bool started;
+    /* Callbacks already ran because the job timed out */
+    bool reported;
+    QTimer* timer;
+};
+
+/* Does the blocking part on a pool thread and posts the result back */
+struct cucd::AppLifecycleQueue::Runner : public QRunnable
+{
+    Runner(cucd::AppLifecycleQueue* queue,
+           const QSharedPointer<cua::ApplicationManager>& app_manager,
+           quint64 id, int operation, const QString& app_id, const QStringList& uris)
+        : queue(queue), app_manager(app_manager), id(id), operation(operation), app_id(app_id), uris(uris)
+    {
+    }
+
+    void run()
+    {
+        const std::string app = app_id.toStdString();
+        bool ok = true;
+        bool was_running = app_manager->is_application_started(app);
+
+        if (operation == Launch)
+        {
+            gchar** strv = nullptr;
+            if (not uris.isEmpty())
+            {
+                strv = g_new0(gchar*, uris.size() + 1);
+                for (int i = 0; i < uris.size(); i++)
+                    strv[i] = g_strdup(uris.at(i).toUtf8().constData());
+            }
+            ok = app_manager->invoke_application(app, strv);
+            g_strfreev(strv);
+        }
+        else if (operation == Stop)
+        {
+            ok = app_manager->stop_application(app);
+        }
+
+        QMetaObject::invokeMethod(queue, "job_finished", Qt::QueuedConnection,
+                                  Q_ARG(quint64, id), Q_ARG(bool, ok), Q_ARG(bool, was_running));
+    }
+
+    cucd::AppLifecycleQueue* queue;
+    QSharedPointer<cua::ApplicationManager> app_manager;
+    quint64 id;
+    int operation;
+    QString app_id;
+    QStringList uris;
+};
+
+struct cucd::AppLifecycleQueue::Private
+{
+    Private(const QSharedPointer<cua::ApplicationManager>& app_manager)
+        : app_manager(app_manager),
+          next_id(1),
+          timeout(defaultTimeout)
+    {
+        bool ok = false;
+        int workers = qgetenv("CONTENT_HUB_APP_WORKERS").toInt(&ok);
+        pool.setMaxThreadCount(ok && workers > 0 ? workers : defaultWorkers);
+    }
+
+    QSharedPointer<cua::ApplicationManager> app_manager;
+    QThreadPool pool;
+    /* Per app id, the first job is the one running */
+    QHash<QString, QList<QSharedPointer<Job>>> queues;
+    QHash<quint64, QSharedPointer<Job>> running;
+    quint64 next_id;
+    int timeout;
+};
+
+cucd::AppLifecycleQueue::AppLifecycleQueue(const QSharedPointer<cua::ApplicationManager>& app_manager,
+                                           QObject* parent)
+    : QObject(parent),
+      d(new Private(app_manager))
+{
+}
+
+cucd::AppLifecycleQueue::~AppLifecycleQueue()
+{
+    /* Results posted from here on are dropped with the queue */
+    d->pool.waitForDone();
+}
+
+void cucd::AppLifecycleQueue::launch(const QString& app_id, const QStringList& uris, const Callback& done)
+{
+    enqueue(Launch, app_id, uris, done);
+}
+
+void cucd::AppLifecycleQueue::stop(const QString& app_id, const Callback& done)
+{
+    enqueue(Stop, app_id, QStringList(), done);
+}
+
+void cucd::AppLifecycleQueue::query(const QString& app_id, const Callback& done)
+{
+    enqueue(Query, app_id, QStringList(), done);
+}
+
+int cucd::AppLifecycleQueue::cancel(const QString& app_id)
+{
+    if (not d->queues.contains(app_id))
+        return 0;
+
+    QList<QSharedPointer<Job>> dropped;
+    QList<QSharedPointer<Job>>& jobs = d->queues[app_id];
+    for (auto it = jobs.begin(); it != jobs.end();)
+    {
+        if (not (*it)->started && (*it)->operation == Launch)
+        {
+            dropped << *it;
+            it = jobs.erase(it);
+        }
+        else
+            ++it;
+    }
+
+    TRACE_EVENT(TraceService, TraceInfo, "cancel app=%s dropped=%d", qPrintable(app_id), dropped.size());
+
+    /* Callbacks may queue more work, don't hold on to jobs */
+    Q_FOREACH (const QSharedPointer<Job>& job, dropped)
+    {
+        Q_FOREACH (const Callback& done, job->callbacks)
+            done(false, false);
+    }
+    return dropped.size();
+}
+
+void cucd::AppLifecycleQueue::set_timeout(int msec)
+{
+    d->timeout = msec;
+}
+
+int cucd::AppLifecycleQueue::pending() const
+{
+    int count = 0;
+    Q_FOREACH (const QList<QSharedPointer<Job>>& jobs, d->queues)
+        count += jobs.size();
+    return count;
+}
+
+void cucd::AppLifecycleQueue::wait_for_idle()
+{
+    while (pending() > 0)
+    {
+        d->pool.waitForDone(10);
+        QCoreApplication::sendPostedEvents(this, QEvent::MetaCall);
+    }
+}
+
+void cucd::AppLifecycleQueue::enqueue(int operation, const QString& app_id, const QStringList& uris, const Callback& done)
+{
+    TRACE_EVENT(TraceService, TraceInfo, "%s app=%s", operation_name(operation), qPrintable(app_id));
+
+    QList<QSharedPointer<Job>>& jobs = d->queues[app_id];
+    if (not jobs.isEmpty() && not jobs.last()->started && jobs.last()->operation == operation)
+    {
+        QSharedPointer<Job> job = jobs.last();
+        Q_FOREACH (const QString& uri, uris)
+        {
+            if (not job->uris.contains(uri))
+                job->uris << uri;
+        }
+        if (done)
+            job->callbacks << done;
+        TRACE_EVENT(TraceService, TraceDebug, "coalesced into job=%llu", job->id);
+        return;
+    }
+
+    QSharedPointer<Job> job{new Job{d->next_id++, operation, app_id, uris, QList<Callback>(), false, false, nullptr}};
+    if (done)
+        job->callbacks << done;
+    jobs << job;
+
+    if (jobs.size() == 1)
+        start(job);
+}
+
+void cucd::AppLifecycleQueue::start(const QSharedPointer<Job>& job)
+{
+    job->started = true;
+    d->running.insert(job->id, job);
+
+    if (d->timeout > 0)
+    {
+        const quint64 id = job->id;
+        job->timer = new QTimer(this);
+        job->timer->setSingleShot(true);
+        connect(job->timer, &QTimer::timeout, this, [this, id]() { job_timed_out(id); });
+        job->timer->start(d->timeout);
+    }
+
+    d->pool.start(new Runner(this, d->app_manager, job->id, job->operation, job->app_id, job->uris));
+}
+
+void cucd::AppLifecycleQueue::job_timed_out(quint64 id)
+{
+    QSharedPointer<Job> job = d->running.value(id);
+    if (job.isNull() || job->reported)
+        return;
+
+    qWarning() << "Application" << operation_name(job->operation) << "timed out for" << job->app_id;
+    job->reported = true;
+    Q_FOREACH (const Callback& done, job->callbacks)
+        done(false, false);
+}
+
+void cucd::AppLifecycleQueue::job_finished(quint64 id, bool ok, bool was_running)
+{
+    QSharedPointer<Job> job = d->running.take(id);
+    if (job.isNull())
+        return;
+
+    TRACE_EVENT(TraceService, TraceInfo, "%s app=%s ok=%d", operation_name(job->operation),
+                qPrintable(job->app_id), ok);
+
+    if (job->timer)
+        job->timer->deleteLater();
+
+    if (not job->reported)
+    {
+        job->reported = true;
+        Q_FOREACH (const Callback& done, job->callbacks)
+            done(ok, was_running);
+    }
+
+    /* A callback may have queued more work for this app */
+    QList<QSharedPointer<Job>>& jobs = d->queues[job->app_id];
+    jobs.removeOne(job);
+    if (jobs.isEmpty())
+        d->queues.remove(job->app_id);
+    else if (not jobs.first()->started)
+        start(jobs.first());
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef APP_LIFECYCLE_QUEUE_H_
+#define APP_LIFECYCLE_QUEUE_H_
+
+#include <com/ubuntu/applicationmanager/application_manager.h>
+
+#include <QObject>
+#include <QScopedPointer>
+#include <QSharedPointer>
+#include <QStringList>
+
+#include <functional>
+
+namespace com
+{
+namespace ubuntu
+{
+namespace content
+{
+namespace detail
+{
+/* Runs application launches, stops and state queries off the main
+ * loop.
+ *
+ * Jobs for one app id run one after the other in the order they were
+ * queued, jobs for different apps run in parallel.  A request that
+ * matches the last job still waiting for the same app is merged into
+ * it, so a burst of launches for one app starts it once.  Callbacks are
+ * invoked on the thread owning the queue, with ok false if the job
+ * failed or didn't finish in time.
+ */
+class AppLifecycleQueue : public QObject
+{
+    Q_OBJECT
+  public:
+    /* was_running tells whether the app was running before the job */
+    typedef std::function<void(bool ok, bool was_running)> Callback;
+
+    AppLifecycleQueue(const QSharedPointer<com::ubuntu::ApplicationManager::ApplicationManager>& app_manager,
+                      QObject* parent = nullptr);
+    AppLifecycleQueue(const AppLifecycleQueue&) = delete;
+    ~AppLifecycleQueue();
+
+    AppLifecycleQueue& operator=(const AppLifecycleQueue&) = delete;
+
+    void launch(const QString& app_id, const QStringList& uris = QStringList(), const Callback& done = Callback());
+    void stop(const QString& app_id, const Callback& done = Callback());
+    void query(const QString& app_id, const Callback& done);
+
+    /* Drops launches for app_id that haven't started yet, their
+     * callbacks run with ok false.  Returns how many were dropped.
+     */
+    int cancel(const QString& app_id);
+
+    /* Milliseconds before callbacks are given up on, 0 waits forever */
+    void set_timeout(int msec);
+
+    /* Jobs queued or running */
+    int pending() const;
+
+    /* Blocks until every job has run and its callbacks were invoked */
+    void wait_for_idle();
+
+  private Q_SLOTS:
+    void job_finished(quint64 id, bool ok, bool was_running);
+
+  private:
+    struct Job;
+    struct Runner;
+    struct Private;
+    void enqueue(int operation, const QString& app_id, const QStringList& uris, const Callback& done);
+    void start(const QSharedPointer<Job>& job);
+    void job_timed_out(quint64 id);
+
+    QScopedPointer<Private> d;
+};
+}
+}
+}
+}
+
+#endif // APP_LIFECYCLE_QUEUE_H_
@@ -0,0 +1,117 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bulk_reader.h"
+#include "common.h"
+#include "debug.h"
+#include "service.h"
+
+#include <com/ubuntu/content/peer.h>
+
+namespace cucd = com::ubuntu::content::detail;
+
+cucd::BulkReader::BulkReader(cucd::Service* service, const QDBusConnection& connection)
+        : QObject(service),
+          service(service),
+          connection_name(connection.name())
+{
+    QDBusConnection peer(connection);
+    peer.registerObject(HUB_SERVICE_PATH, this, QDBusConnection::ExportAllSlots);
+    peer.connect(QString(), "/org/freedesktop/DBus/Local", "org.freedesktop.DBus.Local", "Disconnected",
+                 this, SLOT(disconnected()));
+}
+
+QDBusVariant cucd::BulkReader::DefaultSourceForType(const QString& type_id)
+{
+    query(QStringLiteral("DefaultSourceForType"), type_id);
+    return QDBusVariant();
+}
+
+QVariantList cucd::BulkReader::KnownSourcesForType(const QString& type_id)
+{
+    query(QStringLiteral("KnownSourcesForType"), type_id);
+    return QVariantList();
+}
+
+QVariantList cucd::BulkReader::KnownDestinationsForType(const QString& type_id)
+{
+    query(QStringLiteral("KnownDestinationsForType"), type_id);
+    return QVariantList();
+}
+
+QVariantList cucd::BulkReader::KnownSharesForType(const QString& type_id)
+{
+    query(QStringLiteral("KnownSharesForType"), type_id);
+    return QVariantList();
+}
+
+QDBusVariant cucd::BulkReader::PeerForId(const QString& app_id)
+{
+    query(QStringLiteral("PeerForId"), app_id);
+    return QDBusVariant();
+}
+
+QByteArray cucd::BulkReader::GetLatestPasteData(const QString& surfaceId)
+{
+    return GetLatestPasteDataWithCapabilities(surfaceId, QStringList());
+}
+
+QByteArray cucd::BulkReader::GetPasteData(const QString& surfaceId, const QString& pasteId)
+{
+    return GetPasteDataWithCapabilities(surfaceId, pasteId, QStringList());
+}
+
+QByteArray cucd::BulkReader::GetLatestPasteDataWithCapabilities(const QString& surfaceId,
+                                                                const QStringList& capabilities)
+{
+    TRACE() << Q_FUNC_INFO << capabilities;
+    paste(surfaceId, service->latest_paste_id(), capabilities);
+    return QByteArray();
+}
+
+QByteArray cucd::BulkReader::GetPasteDataWithCapabilities(const QString& surfaceId, const QString& pasteId,
+                                                          const QStringList& capabilities)
+{
+    TRACE() << Q_FUNC_INFO << pasteId << capabilities;
+    paste(surfaceId, pasteId.toInt(), capabilities);
+    return QByteArray();
+}
+
+QStringList cucd::BulkReader::PasteFormats()
+{
+    TRACE() << Q_FUNC_INFO;
+    return service->PasteFormats();
+}
+
+void cucd::BulkReader::disconnected()
+{
+    TRACE() << Q_FUNC_INFO << connection_name;
+    QDBusConnection::disconnectFromPeer(connection_name);
+    deleteLater();
+}
+
+/* Answered from the service's query pool */
+void cucd::BulkReader::query(const QString& member, const QString& arg)
+{
+    setDelayedReply(true);
+    service->queue_reply(connection(), message(), service->peer_query(member, arg));
+}
+
+void cucd::BulkReader::paste(const QString& surfaceId, int pasteId, const QStringList& capabilities)
+{
+    setDelayedReply(true);
+    service->send_paste_data(connection(), message(), surfaceId, pasteId, capabilities);
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BULK_READER_H_
+#define BULK_READER_H_
+
+#include <QObject>
+#include <QStringList>
+#include <QtDBus/QDBusConnection>
+#include <QtDBus/QDBusContext>
+#include <QtDBus/QDBusVariant>
+
+namespace com
+{
+namespace ubuntu
+{
+namespace content
+{
+namespace detail
+{
+class Service;
+
+/* What a peer on the bulk channel gets to see of the service: paste
+ * reads and peer queries, nothing that acts on behalf of the caller.
+ * One per connection, it goes away with the connection.
+ */
+class BulkReader : public QObject, protected QDBusContext
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "com.ubuntu.content.dbus.Service")
+
+  public:
+    BulkReader(Service* service, const QDBusConnection& connection);
+    BulkReader(const BulkReader&) = delete;
+
+    BulkReader& operator=(const BulkReader&) = delete;
+
+  public Q_SLOTS:
+    QDBusVariant DefaultSourceForType(const QString& type_id);
+    QVariantList KnownSourcesForType(const QString& type_id);
+    QVariantList KnownDestinationsForType(const QString& type_id);
+    QVariantList KnownSharesForType(const QString& type_id);
+    QDBusVariant PeerForId(const QString& app_id);
+    QByteArray GetLatestPasteData(const QString& surfaceId);
+    QByteArray GetPasteData(const QString& surfaceId, const QString& pasteId);
+    QByteArray GetLatestPasteDataWithCapabilities(const QString& surfaceId, const QStringList& capabilities);
+    QByteArray GetPasteDataWithCapabilities(const QString& surfaceId, const QString& pasteId, const QStringList& capabilities);
+    QStringList PasteFormats();
+
+  private Q_SLOTS:
+    void disconnected();
+
+  private:
+    void query(const QString& member, const QString& arg);
+    void paste(const QString& surfaceId, int pasteId, const QStringList& capabilities);
+
+    Service* service;
+    QString connection_name;
+};
+}
+}
+}
+}
+
+#endif // BULK_READER_H_
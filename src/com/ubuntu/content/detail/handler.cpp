@@ -55,34 +55,55 @@ cucd::Handler::~Handler() {
 
 void cucd::Handler::HandleImport(const QDBusObjectPath& transfer)
 {
-    TRACE() << Q_FUNC_INFO << transfer.path();
-    cuc::Transfer* t = cuc::Transfer::Private::make_transfer(transfer, this);
+    HandleImportWithSnapshot(transfer, QVariantMap());
+}
+
+void cucd::Handler::HandleExport(const QDBusObjectPath& transfer)
+{
+    HandleExportWithSnapshot(transfer, QVariantMap());
+}
 
-    TRACE() << Q_FUNC_INFO << "State:" << t->state();
-    if (t->state() == cuc::Transfer::charged)
+void cucd::Handler::HandleShare(const QDBusObjectPath& transfer)
+{
+    HandleShareWithSnapshot(transfer, QVariantMap());
+}
+
+/* With a snapshot the state checks below and the app's first
+ * queries are answered locally, see Transfer::Private
+ */
+void cucd::Handler::HandleImportWithSnapshot(const QDBusObjectPath& transfer, const QVariantMap& snapshot)
+{
+    TRACE() << Q_FUNC_INFO << transfer.path() << not snapshot.isEmpty();
+    cuc::Transfer* t = cuc::Transfer::Private::make_transfer(transfer, this, snapshot);
+
+    const cuc::Transfer::State state = t->state();
+    TRACE() << Q_FUNC_INFO << "State:" << state;
+    if (state == cuc::Transfer::charged)
         m_handler->handle_import(t);
 }
 
-void cucd::Handler::HandleExport(const QDBusObjectPath& transfer)
+void cucd::Handler::HandleExportWithSnapshot(const QDBusObjectPath& transfer, const QVariantMap& snapshot)
 {
-    TRACE() << Q_FUNC_INFO << transfer.path();
-    cuc::Transfer* t = cuc::Transfer::Private::make_transfer(transfer, this);
+    TRACE() << Q_FUNC_INFO << transfer.path() << not snapshot.isEmpty();
+    cuc::Transfer* t = cuc::Transfer::Private::make_transfer(transfer, this, snapshot);
 
-    TRACE() << Q_FUNC_INFO << "State:" << t->state();
-    if (t->state() == cuc::Transfer::initiated)
+    const cuc::Transfer::State state = t->state();
+    TRACE() << Q_FUNC_INFO << "State:" << state;
+    if (state == cuc::Transfer::initiated)
     {
         t->d->handled();
         m_handler->handle_export(t);
     }
 }
 
-void cucd::Handler::HandleShare(const QDBusObjectPath& transfer)
+void cucd::Handler::HandleShareWithSnapshot(const QDBusObjectPath& transfer, const QVariantMap& snapshot)
 {
-    TRACE() << Q_FUNC_INFO;
-    cuc::Transfer* t = cuc::Transfer::Private::make_transfer(transfer, this);
+    TRACE() << Q_FUNC_INFO << not snapshot.isEmpty();
+    cuc::Transfer* t = cuc::Transfer::Private::make_transfer(transfer, this, snapshot);
 
-    TRACE() << Q_FUNC_INFO << "State:" << t->state();
-    if (t->state() == cuc::Transfer::charged)
+    const cuc::Transfer::State state = t->state();
+    TRACE() << Q_FUNC_INFO << "State:" << state;
+    if (state == cuc::Transfer::charged)
     {
         m_handler->handle_share(t);
     }
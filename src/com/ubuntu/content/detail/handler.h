@@ -49,6 +49,9 @@ class Handler : public QObject
     void HandleImport(const QDBusObjectPath &transfer);
     void HandleExport(const QDBusObjectPath &transfer);
     void HandleShare(const QDBusObjectPath &transfer);
+    void HandleImportWithSnapshot(const QDBusObjectPath &transfer, const QVariantMap &snapshot);
+    void HandleExportWithSnapshot(const QDBusObjectPath &transfer, const QVariantMap &snapshot);
+    void HandleShareWithSnapshot(const QDBusObjectPath &transfer, const QVariantMap &snapshot);
 
   private:
     struct Private;
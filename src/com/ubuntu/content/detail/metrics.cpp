@@ -0,0 +1,306 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "debug.h"
+#include "metrics.h"
+#include "utils.cpp"
+
+#include <com/ubuntu/content/transfer.h>
+
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+
+#include <cstring>
+
+namespace cucd = com::ubuntu::content::detail;
+namespace cuc = com::ubuntu::content;
+
+namespace
+{
+const char* state_name(int state)
+{
+    switch (state)
+    {
+    case cuc::Transfer::created: return "created";
+    case cuc::Transfer::initiated: return "initiated";
+    case cuc::Transfer::in_progress: return "in_progress";
+    case cuc::Transfer::charged: return "charged";
+    case cuc::Transfer::collected: return "collected";
+    case cuc::Transfer::aborted: return "aborted";
+    case cuc::Transfer::finalized: return "finalized";
+    case cuc::Transfer::downloading: return "downloading";
+    case cuc::Transfer::downloaded: return "downloaded";
+    }
+    return "unknown";
+}
+
+struct PeerCounts
+{
+    qint64 sourced = 0;
+    qint64 received = 0;
+    qint64 aborted = 0;
+    qint64 launches = 0;
+    qint64 launch_failures = 0;
+    qint64 pastes = 0;
+};
+
+struct TrackedTransfer
+{
+    QString source;
+    QString destination;
+    int state;
+    qint64 entered;
+};
+}
+
+cucd::Histogram::Histogram() : m_count(0), m_sum(0), m_max(0)
+{
+    memset(m_buckets, 0, sizeof(m_buckets));
+}
+
+void cucd::Histogram::record(qint64 value)
+{
+    if (value < 0)
+        value = 0;
+
+    int bucket = 0;
+    while (bucket < bucketCount - 1 && value >= (qint64(1) << bucket))
+        bucket++;
+
+    m_buckets[bucket]++;
+    m_count++;
+    m_sum += value;
+    m_max = qMax(m_max, value);
+}
+
+qint64 cucd::Histogram::count() const
+{
+    return m_count;
+}
+
+qint64 cucd::Histogram::sum() const
+{
+    return m_sum;
+}
+
+qint64 cucd::Histogram::max() const
+{
+    return m_max;
+}
+
+/* Upper bound of the bucket holding the p-th percentile */
+qint64 cucd::Histogram::percentile(double p) const
+{
+    if (m_count == 0)
+        return 0;
+
+    qint64 wanted = qMax(qint64(1), qint64(p * m_count + 0.5));
+    qint64 seen = 0;
+    for (int i = 0; i < bucketCount; i++)
+    {
+        seen += m_buckets[i];
+        if (seen >= wanted)
+            return qMin(m_max, qint64(1) << i);
+    }
+    return m_max;
+}
+
+QJsonObject cucd::Histogram::to_json() const
+{
+    QJsonArray buckets;
+    int last = bucketCount - 1;
+    while (last > 0 && m_buckets[last] == 0)
+        last--;
+    for (int i = 0; i <= last; i++)
+        buckets.append(double(m_buckets[i]));
+
+    QJsonObject result;
+    result["count"] = double(m_count);
+    result["sum"] = double(m_sum);
+    result["max"] = double(m_max);
+    result["p50"] = double(percentile(0.50));
+    result["p95"] = double(percentile(0.95));
+    result["p99"] = double(percentile(0.99));
+    result["buckets"] = buckets;
+    return result;
+}
+
+struct cucd::Metrics::Private
+{
+    Private()
+    {
+        clock.start();
+    }
+
+    qint64 now()
+    {
+        return clock.nsecsElapsed() / 1000;
+    }
+
+    QElapsedTimer clock;
+    QHash<int, TrackedTransfer> transfers;
+    /* Time spent in each state, keyed by the state being left */
+    QHash<int, cucd::Histogram> state_latency;
+    cucd::Histogram launch_latency;
+    cucd::Histogram paste_size;
+    qint64 paste_bytes_in = 0;
+    qint64 paste_bytes_out = 0;
+    QHash<QString, PeerCounts> peers;
+    QHash<QString, qint64> errors;
+};
+
+cucd::Metrics::Metrics(QObject* parent) : QObject(parent), d(new Private)
+{
+    TRACE() << Q_FUNC_INFO;
+}
+
+cucd::Metrics::~Metrics()
+{
+    TRACE() << Q_FUNC_INFO;
+}
+
+void cucd::Metrics::transfer_created(int id, const QString& source, const QString& destination)
+{
+    d->transfers.insert(id, TrackedTransfer{source, destination, cuc::Transfer::created, d->now()});
+    d->peers[source].sourced++;
+    d->peers[destination].received++;
+}
+
+void cucd::Metrics::transfer_state_changed(int id, int state)
+{
+    auto it = d->transfers.find(id);
+    if (it == d->transfers.end() || it->state == state)
+        return;
+
+    qint64 now = d->now();
+    d->state_latency[it->state].record(now - it->entered);
+    it->state = state;
+    it->entered = now;
+
+    if (state == cuc::Transfer::aborted)
+    {
+        d->peers[it->source].aborted++;
+        d->peers[it->destination].aborted++;
+    }
+
+    if (state == cuc::Transfer::aborted || state == cuc::Transfer::finalized)
+        d->transfers.erase(it);
+}
+
+void cucd::Metrics::application_launched(const QString& app_id, qint64 usecs, bool ok)
+{
+    d->launch_latency.record(usecs);
+    auto& counts = d->peers[app_id];
+    counts.launches++;
+    if (not ok)
+    {
+        counts.launch_failures++;
+        error("launch-failed");
+    }
+}
+
+void cucd::Metrics::paste_created(const QString& source, qint64 bytes)
+{
+    d->paste_size.record(bytes);
+    d->paste_bytes_in += bytes;
+    d->peers[source].pastes++;
+}
+
+void cucd::Metrics::paste_served(qint64 bytes)
+{
+    d->paste_bytes_out += bytes;
+}
+
+void cucd::Metrics::error(const QString& kind)
+{
+    d->errors[kind]++;
+}
+
+QJsonObject cucd::Metrics::to_json() const
+{
+    QJsonObject states;
+    for (auto it = d->state_latency.constBegin(); it != d->state_latency.constEnd(); ++it)
+        states[state_name(it.key())] = it.value().to_json();
+
+    QJsonObject peers;
+    for (auto it = d->peers.constBegin(); it != d->peers.constEnd(); ++it)
+    {
+        QJsonObject p;
+        p["sourced"] = double(it->sourced);
+        p["received"] = double(it->received);
+        p["aborted"] = double(it->aborted);
+        p["launches"] = double(it->launches);
+        p["launch_failures"] = double(it->launch_failures);
+        p["pastes"] = double(it->pastes);
+        peers[it.key()] = p;
+    }
+
+    QJsonObject errors;
+    for (auto it = d->errors.constBegin(); it != d->errors.constEnd(); ++it)
+        errors[it.key()] = double(it.value());
+
+    QJsonObject bytes;
+    bytes["paste_in"] = double(d->paste_bytes_in);
+    bytes["paste_out"] = double(d->paste_bytes_out);
+
+    QJsonObject result;
+    result["uptime_us"] = double(d->now());
+    result["active_transfers"] = d->transfers.count();
+    result["state_latency_us"] = states;
+    result["launch_latency_us"] = d->launch_latency.to_json();
+    result["paste_size_bytes"] = d->paste_size.to_json();
+    result["bytes"] = bytes;
+    result["peers"] = peers;
+    result["errors"] = errors;
+    return result;
+}
+
+/* The counters tell who shares what with whom, only field tooling
+ * running unconfined may read or clear them over the bus
+ */
+bool cucd::Metrics::called_by_unconfined()
+{
+    if (not calledFromDBus() || aa_profile(message().service()) == QLatin1String("unconfined"))
+        return true;
+
+    sendErrorReply(QDBusError::AccessDenied, "Only unconfined callers may access metrics");
+    return false;
+}
+
+QString cucd::Metrics::Dump()
+{
+    TRACE() << Q_FUNC_INFO;
+    if (not called_by_unconfined())
+        return QString();
+    return QString::fromUtf8(QJsonDocument(to_json()).toJson(QJsonDocument::Compact));
+}
+
+void cucd::Metrics::Reset()
+{
+    TRACE() << Q_FUNC_INFO;
+    if (not called_by_unconfined())
+        return;
+
+    /* Transfers in flight keep being tracked */
+    d->state_latency.clear();
+    d->launch_latency = cucd::Histogram();
+    d->paste_size = cucd::Histogram();
+    d->paste_bytes_in = 0;
+    d->paste_bytes_out = 0;
+    d->peers.clear();
+    d->errors.clear();
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <QHash>
+#include <QJsonObject>
+#include <QObject>
+#include <QString>
+#include <QtDBus/QDBusContext>
+
+namespace com
+{
+namespace ubuntu
+{
+namespace content
+{
+namespace detail
+{
+/* Latencies in microseconds, bucket n counts values below 2^n */
+class Histogram
+{
+  public:
+    static const int bucketCount = 32;
+
+    Histogram();
+
+    void record(qint64 value);
+    qint64 count() const;
+    qint64 sum() const;
+    qint64 max() const;
+    qint64 percentile(double p) const;
+    QJsonObject to_json() const;
+
+  private:
+    qint64 m_buckets[bucketCount];
+    qint64 m_count;
+    qint64 m_sum;
+    qint64 m_max;
+};
+
+class Metrics : public QObject, protected QDBusContext
+{
+    Q_OBJECT
+  public:
+    explicit Metrics(QObject* parent = nullptr);
+    Metrics(const Metrics&) = delete;
+    ~Metrics();
+
+    Metrics& operator=(const Metrics&) = delete;
+
+    void transfer_created(int id, const QString& source, const QString& destination);
+    void transfer_state_changed(int id, int state);
+    void application_launched(const QString& app_id, qint64 usecs, bool ok);
+    void paste_created(const QString& source, qint64 bytes);
+    void paste_served(qint64 bytes);
+    void error(const QString& kind);
+
+    QJsonObject to_json() const;
+
+  public Q_SLOTS:
+    QString Dump();
+    void Reset();
+
+  private:
+    bool called_by_unconfined();
+
+    struct Private;
+    QScopedPointer<Private> d;
+};
+}
+}
+}
+}
+
+#endif // METRICS_H_
@@ -0,0 +1,225 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "debug.h"
+#include "mime_classifier.h"
+#include "type_table.h"
+
+#include <QFile>
+#include <QSet>
+#include <QStandardPaths>
+
+namespace cucd = com::ubuntu::content::detail;
+
+namespace
+{
+struct Rule
+{
+    const char* mimeType;
+    int type;
+};
+
+/* Types that decide the classification on their own, everything
+ * else inherits from whichever of these it is a subclass or alias of.
+ */
+const Rule exactRules[] =
+{
+    { "text/plain", cucd::TextTypeIndex },
+    { "text/vcard", cucd::ContactsTypeIndex },
+    { "text/x-vcard", cucd::ContactsTypeIndex },
+    { "text/directory", cucd::ContactsTypeIndex },
+    { "text/calendar", cucd::EventsTypeIndex },
+    { "text/x-vcalendar", cucd::EventsTypeIndex },
+    { "text/uri-list", cucd::LinksTypeIndex },
+    { "x-scheme-handler/http", cucd::LinksTypeIndex },
+    { "x-scheme-handler/https", cucd::LinksTypeIndex },
+    { "application/epub+zip", cucd::EbooksTypeIndex },
+    { "application/x-mobipocket-ebook", cucd::EbooksTypeIndex },
+    { "application/vnd.amazon.mobi8-ebook", cucd::EbooksTypeIndex },
+    { "application/x-fictionbook+xml", cucd::EbooksTypeIndex },
+    { "application/pdf", cucd::DocumentsTypeIndex },
+    { "application/rtf", cucd::DocumentsTypeIndex },
+    { "application/msword", cucd::DocumentsTypeIndex },
+    { "application/vnd.ms-excel", cucd::DocumentsTypeIndex },
+    { "application/vnd.ms-powerpoint", cucd::DocumentsTypeIndex },
+    { "application/postscript", cucd::DocumentsTypeIndex },
+};
+
+/* Checked when the type itself didn't match, before its parents */
+const Rule prefixRules[] =
+{
+    { "image/", cucd::PicturesTypeIndex },
+    { "audio/", cucd::MusicTypeIndex },
+    { "video/", cucd::VideosTypeIndex },
+    { "application/vnd.oasis.opendocument.", cucd::DocumentsTypeIndex },
+    { "application/vnd.openxmlformats-officedocument.", cucd::DocumentsTypeIndex },
+};
+
+/* Subclass chains are short, this only guards against cycles */
+const int maxDepth = 16;
+
+int exact_rule(const QByteArray& mimeType)
+{
+    for (const Rule& rule : exactRules)
+    {
+        if (mimeType == rule.mimeType)
+            return rule.type;
+    }
+    return -1;
+}
+
+int prefix_rule(const QByteArray& mimeType)
+{
+    for (const Rule& rule : prefixRules)
+    {
+        if (mimeType.startsWith(rule.mimeType))
+            return rule.type;
+    }
+    return cucd::UnknownTypeIndex;
+}
+
+/* Lower case and without parameters, "Text/Plain; charset=utf-8"
+ * becomes "text/plain"
+ */
+QByteArray normalize(const QByteArray& mimeType)
+{
+    int end = mimeType.indexOf(';');
+    return (end < 0 ? mimeType : mimeType.left(end)).trimmed().toLower();
+}
+
+/* Both files are "<type> <other type>" per line */
+void read_pairs(const QString& path, QMultiHash<QByteArray, QByteArray>& pairs)
+{
+    QFile file(path);
+    if (not file.open(QIODevice::ReadOnly))
+        return;
+
+    while (not file.atEnd())
+    {
+        const QByteArray line = file.readLine().trimmed();
+        const int space = line.indexOf(' ');
+        if (line.isEmpty() || line.startsWith('#') || space < 0)
+            continue;
+        pairs.insert(normalize(line.left(space)), normalize(line.mid(space + 1)));
+    }
+}
+
+class GraphWalker
+{
+  public:
+    GraphWalker(const QMultiHash<QByteArray, QByteArray>& parents,
+                const QMultiHash<QByteArray, QByteArray>& aliases)
+        : parents(parents), aliases(aliases)
+    {
+    }
+
+    int resolve(const QByteArray& mimeType, int depth = 0)
+    {
+        auto known = resolved.constFind(mimeType);
+        if (known != resolved.constEnd())
+            return known.value();
+        if (depth > maxDepth)
+            return cucd::UnknownTypeIndex;
+
+        int type = exact_rule(mimeType);
+        if (type < 0 && aliases.contains(mimeType))
+            type = resolve(aliases.value(mimeType), depth + 1);
+        /* image/svg+xml is a picture before it is text */
+        if (type < 0 || type == cucd::UnknownTypeIndex)
+            type = prefix_rule(mimeType);
+        if (type == cucd::UnknownTypeIndex)
+        {
+            Q_FOREACH (const QByteArray& parent, parents.values(mimeType))
+            {
+                type = resolve(parent, depth + 1);
+                if (type != cucd::UnknownTypeIndex)
+                    break;
+            }
+        }
+
+        resolved.insert(mimeType, type);
+        return type;
+    }
+
+    const QMultiHash<QByteArray, QByteArray>& parents;
+    const QMultiHash<QByteArray, QByteArray>& aliases;
+    QHash<QByteArray, int> resolved;
+};
+}
+
+const cucd::MimeClassifier& cucd::MimeClassifier::instance()
+{
+    static const MimeClassifier classifier(
+        QStandardPaths::locateAll(QStandardPaths::GenericDataLocation,
+                                  QStringLiteral("mime"),
+                                  QStandardPaths::LocateDirectory));
+    return classifier;
+}
+
+cucd::MimeClassifier::MimeClassifier(const QStringList& mimeDirs)
+{
+    TRACE() << Q_FUNC_INFO << mimeDirs;
+
+    QMultiHash<QByteArray, QByteArray> parents;
+    QMultiHash<QByteArray, QByteArray> aliases;
+    Q_FOREACH (const QString& dir, mimeDirs)
+    {
+        read_pairs(dir + QStringLiteral("/subclasses"), parents);
+        read_pairs(dir + QStringLiteral("/aliases"), aliases);
+    }
+
+    QSet<QByteArray> names;
+    for (const Rule& rule : exactRules)
+        names.insert(rule.mimeType);
+    for (auto it = parents.constBegin(); it != parents.constEnd(); ++it)
+        names << it.key() << it.value();
+    for (auto it = aliases.constBegin(); it != aliases.constEnd(); ++it)
+        names << it.key() << it.value();
+
+    /* Only matches are stored, a miss falls back to the prefix rules */
+    GraphWalker walker(parents, aliases);
+    Q_FOREACH (const QByteArray& name, names)
+    {
+        const int type = walker.resolve(name);
+        if (type != UnknownTypeIndex && type != prefix_rule(name))
+            m_types.insert(name, quint8(type));
+    }
+    m_types.squeeze();
+}
+
+int cucd::MimeClassifier::classify(const QByteArray& mimeType) const
+{
+    auto it = m_types.constFind(mimeType);
+    if (it != m_types.constEnd())
+        return it.value();
+
+    const QByteArray normalized = normalize(mimeType);
+    it = m_types.constFind(normalized);
+    if (it != m_types.constEnd())
+        return it.value();
+
+    return prefix_rule(normalized);
+}
+
+int cucd::MimeClassifier::classify(const QString& mimeType) const
+{
+    return classify(mimeType.toLatin1());
+}
+
+int cucd::MimeClassifier::size() const
+{
+    return m_types.size();
+}
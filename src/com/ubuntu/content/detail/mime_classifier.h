@@ -0,0 +1,64 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MIME_CLASSIFIER_H_
+#define MIME_CLASSIFIER_H_
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <QStringList>
+
+namespace com
+{
+namespace ubuntu
+{
+namespace content
+{
+namespace detail
+{
+/* Maps MIME types to well-known content types, see type_table.h.
+ *
+ * The shared-mime-info alias and subclass graph is walked once when
+ * the classifier is built, so e.g. text/x-csrc resolves to text through
+ * text/plain and image/x-canon-cr2 to pictures through image/x-dcraw.
+ * Every type found in the database is then a single hash lookup.
+ */
+class MimeClassifier
+{
+  public:
+    /* Built from the mime directories of the XDG data dirs on first use */
+    static const MimeClassifier& instance();
+
+    /* Reads the aliases and subclasses files of each directory */
+    explicit MimeClassifier(const QStringList& mimeDirs);
+
+    /* Returns a KnownTypeIndex, UnknownTypeIndex if nothing matches */
+    int classify(const QByteArray& mimeType) const;
+    int classify(const QString& mimeType) const;
+
+    /* Number of MIME types with a precomputed result */
+    int size() const;
+
+  private:
+    QHash<QByteArray, quint8> m_types;
+};
+}
+}
+}
+}
+
+#endif // MIME_CLASSIFIER_H_
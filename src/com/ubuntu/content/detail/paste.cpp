@@ -60,6 +60,29 @@ cucd::Paste::~Paste()
     TRACE() << __PRETTY_FUNCTION__;
 }
 
+void cucd::Paste::save_state(QDataStream& out)
+{
+    TRACE() << __PRETTY_FUNCTION__ << d->id;
+    out << qint32(d->id) << d->source << d->destination << qint32(d->state) << d->mimeData;
+}
+
+cucd::Paste* cucd::Paste::restore_state(QDataStream& in, QObject* parent)
+{
+    qint32 id, state;
+    QString source, destination;
+    QByteArray mimeData;
+
+    in >> id >> source >> destination >> state >> mimeData;
+    if (in.status() != QDataStream::Ok)
+        return nullptr;
+
+    auto paste = new cucd::Paste(id, source, parent);
+    paste->d->destination = destination;
+    paste->d->state = static_cast<cuc::Paste::State>(state);
+    paste->d->mimeData = mimeData;
+    return paste;
+}
+
 /* unique id of the paste */
 int cucd::Paste::Id()
 {
@@ -19,6 +19,7 @@
 #define PASTE_H_
 
 #include <QByteArray>
+#include <QDataStream>
 #include <QDir>
 #include <QObject>
 #include <QtDBus/QDBusMessage>
@@ -46,6 +47,9 @@ class Paste : public QObject, protected QDBusContext
 
     Paste& operator=(const Paste&) = delete;
 
+    void save_state(QDataStream& out);
+    static Paste* restore_state(QDataStream& in, QObject* parent = nullptr);
+
 Q_SIGNALS:
     void StateChanged(int State);
 
@@ -31,6 +31,11 @@ namespace content
 {
 namespace detail
 {
+/* The service calls registries from its query pool, so every method
+ * but peer_is_legacy() may run on several threads at once and has to
+ * guard itself.  peer_is_legacy() is called from the main loop and
+ * must not wait for those queries.
+ */
 class PeerRegistry
 {
   public:
@@ -52,6 +57,13 @@ class PeerRegistry
     virtual bool remove_peer(Peer peer) = 0;
     virtual bool peer_is_legacy(QString type) = 0;
 
+    /* Mutations made between begin_transaction() and commit_transaction()
+     * may be collected and written out together on commit.  Transactions
+     * nest, only the outermost commit writes.
+     */
+    virtual void begin_transaction() {}
+    virtual bool commit_transaction() { return true; }
+
 };
 }
 }
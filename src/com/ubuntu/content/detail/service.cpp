@@ -21,8 +21,12 @@
 
 #include "debug.h"
 #include "service.h"
+#include "app_lifecycle_queue.h"
+#include "bulk_reader.h"
 #include "peer_registry.h"
 #include "i18n.h"
+#include "metrics.h"
+#include "metricsadaptor.h"
 #include "paste.h"
 #include "pasteadaptor.h"
 #include "transfer.h"
@@ -40,12 +44,25 @@
 #include <com/ubuntu/content/type.h>
 #include <com/ubuntu/content/transfer.h>
 
+#include <QDBusConnectionInterface>
 #include <QDBusInterface>
 #include <QDBusMetaType>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
+#include <QDBusServer>
 #include <QCache>
 #include <QCoreApplication>
+#include <QDataStream>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QPointer>
+#include <QRunnable>
+#include <QSaveFile>
 #include <QSharedPointer>
+#include <QStandardPaths>
+#include <QThreadPool>
+#include <QTimer>
 #include <QUuid>
 
 #include <cassert>
@@ -54,17 +71,72 @@ namespace cua = com::ubuntu::ApplicationManager;
 namespace cucd = com::ubuntu::content::detail;
 namespace cuc = com::ubuntu::content;
 
+namespace
+{
+const quint32 snapshotMagic = 0x43485353; // "CHSS"
+const quint32 snapshotVersion = 1;
+
+/* Transfers waiting on an app to do something, as opposed to
+ * those sitting in a state that survives a service restart
+ */
+bool transfer_in_flight(int state)
+{
+    return (state == cuc::Transfer::created
+            || state == cuc::Transfer::initiated
+            || state == cuc::Transfer::in_progress
+            || state == cuc::Transfer::downloading);
+}
+
+bool transfer_worth_saving(int state)
+{
+    return (state == cuc::Transfer::charged
+            || state == cuc::Transfer::collected
+            || state == cuc::Transfer::downloaded);
+}
+}
+
+namespace
+{
+/* Answers a delayed D-Bus call from a pool thread */
+struct DelayedReply : public QRunnable
+{
+    DelayedReply(const QDBusConnection& connection, const QDBusMessage& request,
+                 const std::function<QVariant()>& work)
+        : connection(connection), request(request), work(work)
+    {
+    }
+
+    void run()
+    {
+        connection.send(request.createReply(work()));
+    }
+
+    QDBusConnection connection;
+    QDBusMessage request;
+    std::function<QVariant()> work;
+};
+
+/* Registry lookups construct peers, which reads desktop files and
+ * icons, two of those in parallel are plenty.
+ */
+const int defaultQueryWorkers = 2;
+}
+
 struct cucd::Service::RegHandler
 {
     RegHandler(QString id, QString service, cuc::dbus::Handler* handler) : id(id),
         service(service),
-        handler(handler)
+        handler(handler),
+        wants_snapshot(false)
     {
     }
 
     QString id;
     QString service;
     cuc::dbus::Handler* handler;
+    QStringList capabilities;
+    /* Handler takes the *WithSnapshot calls */
+    bool wants_snapshot;
 };
 
 struct cucd::Service::Private : public QObject
@@ -76,24 +148,110 @@ struct cucd::Service::Private : public QObject
             : QObject(parent),
               connection(connection),
               registry(registry),
-              app_manager(application_manager)
+              app_manager(application_manager),
+              app_queue(new cucd::AppLifecycleQueue(application_manager, this)),
+              unityFocus(nullptr),
+              transfer_counter(0),
+              paste_counter(0),
+              pasteboard_generation(0),
+              prelaunch(qgetenv("CONTENT_HUB_PRELAUNCH") == "1"),
+              metrics(new cucd::Metrics(this)),
+              bulk_server(nullptr)
     {
-        unityFocus = new QDBusInterface("com.canonical.Unity.FocusInfo" /* service */,
-                                        "/com/canonical/Unity/FocusInfo" /* object path */,
-                                        "com.canonical.Unity.FocusInfo" /* interface */,
-                                        QDBusConnection::sessionBus(),
-                                        this);
+        /* Exit after this many seconds without activity, 0 disables */
+        bool ok = false;
+        int timeout = qgetenv("CONTENT_HUB_IDLE_TIMEOUT").toInt(&ok);
+        if (ok && timeout > 0)
+        {
+            idle_timer.setSingleShot(true);
+            idle_timer.setInterval(timeout * 1000);
+        }
+
+        int workers = qgetenv("CONTENT_HUB_QUERY_WORKERS").toInt(&ok);
+        query_pool.setMaxThreadCount(ok && workers > 0 ? workers : defaultQueryWorkers);
+
+        /* Private endpoint for bulk reads, see BulkAddress().  The
+         * socket lives in a directory only this user can enter, an
+         * abstract socket would be open to anyone who knows the name.
+         */
+        QString dir = QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation);
+        if (qgetenv("CONTENT_HUB_BULK_CHANNEL") != "0" && not dir.isEmpty())
+        {
+            static int servers = 0;
+            dir += "/content-hub";
+            QDir().mkpath(dir);
+            QFile::setPermissions(dir, QFileDevice::ReadOwner | QFileDevice::WriteOwner | QFileDevice::ExeOwner);
+            bulk_path = QString("%1/bulk-%2-%3").arg(dir).arg(getpid()).arg(servers++);
+            QFile::remove(bulk_path);
+
+            bulk_server = new QDBusServer("unix:path=" + bulk_path, this);
+            if (not bulk_server->isConnected())
+            {
+                qWarning() << "Can't open bulk channel:" << bulk_server->lastError().message();
+                delete bulk_server;
+                bulk_server = nullptr;
+            }
+            else
+            {
+                QFile::setPermissions(bulk_path, QFileDevice::ReadOwner | QFileDevice::WriteOwner);
+            }
+        }
+    }
+
+    ~Private()
+    {
+        if (bulk_server)
+            QFile::remove(bulk_path);
+    }
+
+    /* Creating the interface introspects Unity synchronously,
+     * only pay for that once a paste actually needs it.
+     */
+    QDBusInterface* focus_info()
+    {
+        if (unityFocus == nullptr)
+            unityFocus = new QDBusInterface("com.canonical.Unity.FocusInfo" /* service */,
+                                            "/com/canonical/Unity/FocusInfo" /* object path */,
+                                            "com.canonical.Unity.FocusInfo" /* interface */,
+                                            QDBusConnection::sessionBus(),
+                                            this);
+        return unityFocus;
     }
 
     QDBusConnection connection;
     QSharedPointer<cucd::PeerRegistry> registry;
     QSet<cucd::Transfer*> active_transfers;
     QList<cucd::Paste*> active_pastes;
+    /* Formats offered by the live pastes in the order they appeared,
+     * counted once for every paste offering them
+     */
     QStringList pasteFormats;
+    QHash<QString, int> pasteFormatRefs;
+    QHash<int, QStringList> pasteTypes;
     QSet<RegHandler*> handlers;
     QSharedPointer<cua::ApplicationManager> app_manager;
+    cucd::AppLifecycleQueue* app_queue;
     QDBusInterface *unityFocus;
     const int maxActivePastes = 5;
+    int transfer_counter;
+    int paste_counter;
+    /* Bumped for every pasteboard change, see PasteboardUpdated */
+    quint64 pasteboard_generation;
+    QTimer idle_timer;
+    /* Start destinations while the source is still picking */
+    bool prelaunch;
+    /* Ids of transfers whose destination was started early */
+    QSet<int> prelaunched;
+    /* Ids of transfers still waiting to hear whether the hub started
+     * their app, and the stops held back until then
+     */
+    QSet<int> launching;
+    QHash<int, QList<std::function<void()>>> deferred_stops;
+    cucd::Metrics* metrics;
+    QDBusServer* bulk_server;
+    QString bulk_path;
+    /* Declared last so it is drained before anything it uses goes */
+    QThreadPool query_pool;
 };
 
 cucd::Service::Service(QDBusConnection connection, const QSharedPointer<cucd::PeerRegistry>& peer_registry,
@@ -112,6 +270,16 @@ cucd::Service::Service(QDBusConnection connection, const QSharedPointer<cucd::Pe
     QObject::connect(m_watcher, SIGNAL(serviceUnregistered(const QString&)),
             this,
             SLOT(handler_unregistered(const QString&)));
+
+    new MetricsAdaptor(d->metrics);
+    if (not d->connection.registerObject(HUB_METRICS_PATH, d->metrics))
+        TRACE() << "Problem registering object for path: " << HUB_METRICS_PATH;
+
+    QObject::connect(&d->idle_timer, SIGNAL(timeout()), this, SLOT(idle_timeout()));
+    reset_idle_timer();
+
+    if (d->bulk_server)
+        QObject::connect(d->bulk_server, &QDBusServer::newConnection, this, &cucd::Service::bulk_peer_connected);
 }
 
 cucd::Service::~Service()
@@ -131,58 +299,85 @@ void cucd::Service::Quit()
 
 QVariantList cucd::Service::KnownSourcesForType(const QString& type_id)
 {
-    QVariantList result;
-
-    d->registry->enumerate_known_sources_for_type(
-        Type(type_id),
-        [&result](const Peer& peer)
-        {
-            result.append(QVariant::fromValue(peer));
-        });
-
-    return result;
+    auto work = peer_query(QStringLiteral("KnownSourcesForType"), type_id);
+    if (reply_from_pool(work))
+        return QVariantList();
+    return work().toList();
 }
 
 QVariantList cucd::Service::KnownDestinationsForType(const QString& type_id)
 {
-    QVariantList result;
-
-    d->registry->enumerate_known_destinations_for_type(
-        Type(type_id),
-        [&result](const Peer& peer)
-        {
-            result.append(QVariant::fromValue(peer));
-        });
-
-    return result;
+    auto work = peer_query(QStringLiteral("KnownDestinationsForType"), type_id);
+    if (reply_from_pool(work))
+        return QVariantList();
+    return work().toList();
 }
 
 QVariantList cucd::Service::KnownSharesForType(const QString& type_id)
 {
-    QVariantList result;
-
-    d->registry->enumerate_known_shares_for_type(
-        Type(type_id),
-        [&result](const Peer& peer)
-        {
-            result.append(QVariant::fromValue(peer));
-        });
-
-    return result;
+    auto work = peer_query(QStringLiteral("KnownSharesForType"), type_id);
+    if (reply_from_pool(work))
+        return QVariantList();
+    return work().toList();
 }
 
 QDBusVariant cucd::Service::DefaultSourceForType(const QString& type_id)
 {
-    cuc::Peer peer = d->registry->default_source_for_type(Type(type_id));
-
-    return QDBusVariant(QVariant::fromValue(peer));
+    auto work = peer_query(QStringLiteral("DefaultSourceForType"), type_id);
+    if (reply_from_pool(work))
+        return QDBusVariant();
+    return work().value<QDBusVariant>();
 }
 
 QDBusVariant cucd::Service::PeerForId(const QString& app_id)
 {
-    cuc::Peer peer = cuc::Peer{app_id};
+    auto work = peer_query(QStringLiteral("PeerForId"), app_id);
+    if (reply_from_pool(work))
+        return QDBusVariant();
+    return work().value<QDBusVariant>();
+}
+
+/* The answer to the peer query member names, run on the query pool */
+std::function<QVariant()> cucd::Service::peer_query(const QString& member, const QString& arg)
+{
+    reset_idle_timer();
+
+    if (member == QLatin1String("PeerForId"))
+    {
+        return [arg]()
+        {
+            return QVariant::fromValue(QDBusVariant(QVariant::fromValue(cuc::Peer{arg})));
+        };
+    }
 
-    return QDBusVariant(QVariant::fromValue(peer));
+    /* Registries guard themselves, see PeerRegistry */
+    auto registry = d->registry;
+    if (member == QLatin1String("DefaultSourceForType"))
+    {
+        return [registry, arg]()
+        {
+            cuc::Peer peer = registry->default_source_for_type(Type(arg));
+            return QVariant::fromValue(QDBusVariant(QVariant::fromValue(peer)));
+        };
+    }
+
+    return [registry, member, arg]()
+    {
+        QVariantList result;
+        auto append = [&result](const Peer& peer)
+        {
+            result.append(QVariant::fromValue(peer));
+        };
+
+        if (member == QLatin1String("KnownSourcesForType"))
+            registry->enumerate_known_sources_for_type(Type(arg), append);
+        else if (member == QLatin1String("KnownDestinationsForType"))
+            registry->enumerate_known_destinations_for_type(Type(arg), append);
+        else if (member == QLatin1String("KnownSharesForType"))
+            registry->enumerate_known_shares_for_type(Type(arg), append);
+
+        return QVariant(result);
+    };
 }
 
 QDBusObjectPath cucd::Service::CreateImportFromPeer(const QString& peer_id, const QString& app_id, const QString& type_id)
@@ -275,6 +470,7 @@ void cucd::Service::download_notify (cucd::Transfer* t)
 
 void cucd::Service::DownloadManagerError(QString errorMessage)
 {
+    d->metrics->error("download");
     notify_init("Download Manager");
     NotifyNotification* notification;
 
@@ -319,81 +515,225 @@ bool cucd::Service::CreatePaste(const QString& app_id, const QString& surfaceId,
 {
     TRACE() << Q_FUNC_INFO << app_id << types;
 
+    if (calledFromDBus() && focus_needs_checking())
+    {
+        QDBusMessage request = message();
+        QDBusConnection peer = connection();
+        setDelayedReply(true);
+        check_focus(surfaceId, [this, request, peer, app_id, mimeData, types](bool focused)
+        {
+            bool ok = focused && create_paste(app_id, request.service(), mimeData, types);
+            peer.send(request.createReply(ok));
+        });
+        return false;
+    }
+
     if (!verifiedSurfaceIsFocused(surfaceId)) {
         return false;
     }
 
-    static size_t import_counter{0}; import_counter++;
+    return create_paste(app_id, this->message().service(), mimeData, types);
+}
+
+bool cucd::Service::create_paste(const QString& app_id, const QString& sender, const QByteArray& mimeData,
+                                 const QStringList& types)
+{
+    reset_idle_timer();
+    int paste_id = ++d->paste_counter;
 
-    pid_t pid = d->connection.interface()->servicePid(this->message().service());
+    pid_t pid = d->connection.interface()->servicePid(sender);
     qWarning() << Q_FUNC_INFO << "PID: " << pid;
     QString effective_app_id;
     if (app_id_matches(app_id, pid)) {
         effective_app_id = app_id;
     } else {
         qWarning() << "APP_ID" << app_id << "doesn't match requesting APP";
+        d->metrics->error("paste-app-id-mismatch");
         effective_app_id = "?";
     }
 
-    auto paste = new cucd::Paste(import_counter, effective_app_id, this);
+    auto paste = new cucd::Paste(paste_id, effective_app_id, this);
     new PasteAdaptor(paste);
     d->active_pastes.append(paste);
 
     paste->Charge(mimeData);
+    d->metrics->paste_created(effective_app_id, mimeData.size());
+
+    QStringList added, removed;
+    hold_paste_formats(paste_id, types, added);
 
     if (d->active_pastes.count() > d->maxActivePastes) {
         // get rid of the oldest one
-        delete d->active_pastes.takeFirst();
+        cucd::Paste* oldest = d->active_pastes.takeFirst();
+        release_paste_formats(oldest->Id(), removed);
+        delete oldest;
     }
 
-    Q_EMIT(PasteboardChanged());
+    announce_pasteboard_change(added, removed);
+
+    return true;
+}
 
-    bool pendingPasteFormatsChangedSignal = false;
-    Q_FOREACH (QString t, types) {
+void cucd::Service::hold_paste_formats(int pasteId, const QStringList& types, QStringList& added)
+{
+    QStringList held;
+    Q_FOREACH (const QString& t, types) {
         TRACE() << Q_FUNC_INFO << "Type: " << t;
-        if (!d->pasteFormats.contains(t)) {
+        if (held.contains(t))
+            continue;
+        held << t;
+        if (d->pasteFormatRefs[t]++ == 0) {
             d->pasteFormats.append(t);
-            pendingPasteFormatsChangedSignal = true;
+            added << t;
         }
     }
-    if (pendingPasteFormatsChangedSignal) {
-        Q_EMIT(PasteFormatsChanged(d->pasteFormats));
+    d->pasteTypes.insert(pasteId, held);
+}
+
+void cucd::Service::release_paste_formats(int pasteId, QStringList& removed)
+{
+    Q_FOREACH (const QString& t, d->pasteTypes.take(pasteId)) {
+        if (--d->pasteFormatRefs[t] > 0)
+            continue;
+        d->pasteFormatRefs.remove(t);
+        d->pasteFormats.removeOne(t);
+        removed << t;
     }
+}
 
-    return true;
+/* Clients that show paste UI follow PasteboardUpdated, a gap in the
+ * generation tells them to fetch PasteboardState() again.  The full
+ * signals are kept for older clients.
+ */
+void cucd::Service::announce_pasteboard_change(const QStringList& added, const QStringList& removed)
+{
+    d->pasteboard_generation++;
+    TRACE() << Q_FUNC_INFO << d->pasteboard_generation << added << removed;
+
+    Q_EMIT(PasteboardUpdated(d->pasteboard_generation, added, removed));
+    Q_EMIT(PasteboardChanged());
+    if (not added.isEmpty() || not removed.isEmpty())
+        Q_EMIT(PasteFormatsChanged(d->pasteFormats));
 }
 
 QByteArray cucd::Service::GetLatestPasteData(const QString& surfaceId)
 {
     TRACE() << Q_FUNC_INFO;
+    return GetLatestPasteDataWithCapabilities(surfaceId, QStringList());
+}
+
+QByteArray cucd::Service::GetPasteData(const QString& surfaceId, const QString& pasteId)
+{
+    TRACE() << Q_FUNC_INFO << pasteId;
+    return GetPasteDataWithCapabilities(surfaceId, pasteId, QStringList());
+}
+
+QByteArray cucd::Service::GetLatestPasteDataWithCapabilities(const QString& surfaceId, const QStringList& capabilities)
+{
+    TRACE() << Q_FUNC_INFO << capabilities;
 
     if (d->active_pastes.isEmpty())
         return QByteArray();
 
-    return getPasteData(surfaceId, d->active_pastes.last()->Id());
+    return getPasteData(surfaceId, d->active_pastes.last()->Id(), capabilities);
 }
 
-QByteArray cucd::Service::GetPasteData(const QString& surfaceId, const QString& pasteId)
+QByteArray cucd::Service::GetPasteDataWithCapabilities(const QString& surfaceId, const QString& pasteId, const QStringList& capabilities)
 {
-    TRACE() << Q_FUNC_INFO << pasteId;
+    TRACE() << Q_FUNC_INFO << pasteId << capabilities;
 
     if (d->active_pastes.isEmpty())
         return QByteArray();
 
-    return getPasteData(surfaceId, pasteId.toInt());
+    return getPasteData(surfaceId, pasteId.toInt(), capabilities);
 }
 
-QByteArray cucd::Service::getPasteData(const QString &surfaceId, int pasteId)
+/* Paste data features this service understands, clients only
+ * use a feature when it is listed here
+ */
+QStringList cucd::Service::PasteCapabilities()
 {
-    if (!verifiedSurfaceIsFocused(surfaceId)) {
-        qWarning().nospace() << "Surface isn't focused. Denying paste.";
+    TRACE() << Q_FUNC_INFO;
+    return QStringList() << pasteCapabilityV2 << pasteCapabilityZlib;
+}
+
+/* Clients may connect here to read pastes and query peers without the
+ * bus daemon copying the data, empty if there is no such endpoint
+ */
+QString cucd::Service::BulkAddress()
+{
+    TRACE() << Q_FUNC_INFO;
+    if (d->bulk_server == nullptr || not d->bulk_server->isConnected())
+        return QString();
+    return d->bulk_server->address();
+}
+
+void cucd::Service::bulk_peer_connected(const QDBusConnection& connection)
+{
+    TRACE() << Q_FUNC_INFO << connection.name();
+    new cucd::BulkReader(this, connection);
+}
+
+QByteArray cucd::Service::getPasteData(const QString &surfaceId, int pasteId, const QStringList& capabilities)
+{
+    reset_idle_timer();
+    if (calledFromDBus() && focus_needs_checking())
+    {
+        setDelayedReply(true);
+        send_paste_data(connection(), message(), surfaceId, pasteId, capabilities);
         return QByteArray();
     }
 
+    if (!verifiedSurfaceIsFocused(surfaceId))
+        return paste_denied();
+
+    return paste_data(pasteId, capabilities);
+}
+
+/* Answers request once the surface was found focused */
+void cucd::Service::send_paste_data(const QDBusConnection& peer, const QDBusMessage& request,
+                                    const QString& surfaceId, int pasteId, const QStringList& capabilities)
+{
+    reset_idle_timer();
+    if (not focus_needs_checking())
+    {
+        peer.send(request.createReply(paste_data(pasteId, capabilities)));
+        return;
+    }
+
+    check_focus(surfaceId, [this, request, peer, pasteId, capabilities](bool focused)
+    {
+        QByteArray data = focused ? paste_data(pasteId, capabilities) : paste_denied();
+        peer.send(request.createReply(data));
+    });
+}
+
+int cucd::Service::latest_paste_id()
+{
+    if (d->active_pastes.isEmpty())
+        return -1;
+    return d->active_pastes.last()->Id();
+}
+
+QByteArray cucd::Service::paste_denied()
+{
+    qWarning().nospace() << "Surface isn't focused. Denying paste.";
+    d->metrics->error("paste-focus-denied");
+    return QByteArray();
+}
+
+QByteArray cucd::Service::paste_data(int pasteId, const QStringList& capabilities)
+{
     Q_FOREACH (cucd::Paste *p, d->active_pastes)
     {
         if (p->Id() == pasteId)
-            return p->MimeData();
+        {
+            QByteArray data = p->MimeData();
+            /* Pastes are stored as the writer sent them */
+            data = convertMimeDataForReader(data, capabilities);
+            d->metrics->paste_served(data.size());
+            return data;
+        }
     }
     return QByteArray();
 }
@@ -402,7 +742,8 @@ QDBusObjectPath cucd::Service::CreateTransfer(const QString& dest_id, const QStr
 {
     TRACE() << Q_FUNC_INFO << "DEST:" << dest_id << "SRC:" << src_id << "DIRECTION:" << dir;
 
-    static size_t import_counter{0}; import_counter++;
+    reset_idle_timer();
+    int transfer_id = ++d->transfer_counter;
 
     Q_FOREACH (cucd::Transfer *t, d->active_transfers)
     {
@@ -417,7 +758,41 @@ QDBusObjectPath cucd::Service::CreateTransfer(const QString& dest_id, const QStr
         }
     }
 
-    auto transfer = new cucd::Transfer(import_counter, src_id, dest_id, dir, type_id, this);
+    auto transfer = new cucd::Transfer(transfer_id, src_id, dest_id, dir, type_id, this);
+    d->metrics->transfer_created(transfer_id, src_id, dest_id);
+    register_transfer(transfer);
+
+    // Content flow is different for import
+    if (dir == cuc::Transfer::Import)
+        return QDBusObjectPath{transfer->import_path()};
+    apply_item_mode(transfer);
+    return QDBusObjectPath{transfer->export_path()};
+}
+
+/* Exports and shares hand their items off as descriptors when the
+ * destination's handler asked for that, imports choose for themselves
+ */
+void cucd::Service::apply_item_mode(cucd::Transfer* transfer)
+{
+    if (transfer->Direction() == cuc::Transfer::Import)
+        return;
+
+    bool handoff = false;
+    Q_FOREACH (RegHandler *r, d->handlers)
+    {
+        if (r->id == transfer->destination())
+            handoff = r->capabilities.contains(HANDLER_CAPABILITY_ITEM_FD);
+    }
+
+    /* Legacy apps are handed paths, not descriptors */
+    if (handoff && peer_is_legacy(transfer->destination()))
+        handoff = false;
+
+    transfer->SetItemMode(handoff ? cuc::Transfer::handoff : cuc::Transfer::copy);
+}
+
+void cucd::Service::register_transfer(cucd::Transfer* transfer)
+{
     new TransferAdaptor(transfer);
     d->active_transfers.insert(transfer);
 
@@ -432,71 +807,56 @@ QDBusObjectPath cucd::Service::CreateTransfer(const QString& dest_id, const QStr
     connect(transfer, SIGNAL(DownloadManagerError(QString)), this, SLOT(DownloadManagerError(QString)));
 
     // Content flow is different for import
-    if (dir == cuc::Transfer::Import)
-    {
+    if (transfer->Direction() == cuc::Transfer::Import)
         connect(transfer, SIGNAL(StateChanged(int)), this, SLOT(handle_imports(int)));
-        return QDBusObjectPath{destination};
-    }
-
-    connect(transfer, SIGNAL(StateChanged(int)), this, SLOT(handle_exports(int)));
-    return QDBusObjectPath{source};
+    else
+        connect(transfer, SIGNAL(StateChanged(int)), this, SLOT(handle_exports(int)));
 }
 
 void cucd::Service::handle_imports(int state)
 {
     TRACE() << Q_FUNC_INFO << state;
+    reset_idle_timer();
     cucd::Transfer *transfer = static_cast<cucd::Transfer*>(sender());
     TRACE() << Q_FUNC_INFO << "State: " << transfer->State() << "Id:" << transfer->Id();
+    d->metrics->transfer_state_changed(transfer->Id(), state);
 
     if (state == cuc::Transfer::initiated)
     {
         TRACE() << Q_FUNC_INFO << "initiated";
-        if (d->app_manager->is_application_started(transfer->source().toStdString()))
-            transfer->SetSourceStartedByContentHub(false);
-        else
-            transfer->SetSourceStartedByContentHub(true);
-
         Q_FOREACH (RegHandler *r, d->handlers)
         {
             TRACE() << Q_FUNC_INFO << "ID:" << r->id << "Handler: " << r->service << "Transfer: " << transfer->source();
             if (r->id == transfer->source())
             {
                 TRACE() << Q_FUNC_INFO << "Found handler for initiated transfer" << r->id;
-                if (r->handler->isValid())
-                    r->handler->HandleExport(QDBusObjectPath{transfer->export_path()});
-                else
-                    TRACE() << Q_FUNC_INFO << "Handler invalid";
+                notify_handler(r, transfer, handle_export);
             }
         }
 
-        gchar ** uris = NULL;
-        d->app_manager->invoke_application(transfer->source().toStdString(), uris);
+        launch_application(transfer->source(), QStringList(), track_launch(transfer, false));
+        prelaunch_destination(transfer);
     }
 
     if (state == cuc::Transfer::charged)
     {
         TRACE() << Q_FUNC_INFO << "Charged";
-        if (transfer->WasSourceStartedByContentHub())
-            d->app_manager->stop_application(transfer->source().toStdString());
+        d->prelaunched.remove(transfer->Id());
+        QPointer<cucd::Transfer> guard(transfer);
+        after_launch(transfer, [this, guard]()
+        {
+            if (guard && guard->WasSourceStartedByContentHub())
+                d->app_queue->stop(guard->source());
+        });
 
-        gchar ** uris = NULL;
-        if (d->registry->peer_is_legacy(transfer->destination())) {
+        QStringList uris;
+        if (peer_is_legacy(transfer->destination())) {
             TRACE() << Q_FUNC_INFO << "Destination is a legacy app, collecting";
-            transfer->SetStore(shared_dir_for_peer(transfer->destination()));
-            auto items = transfer->Collect();
-            gchar* urls[2] = {0};
-            gint i = 0;
-            Q_FOREACH (QVariant item, items) {
-                QString s = copy_to_store(item.value<cuc::Item>().url().toString(), transfer->Store()).split("/shared")[1];
-                QUrl u = QUrl::fromLocalFile(QStandardPaths::writableLocation(QStandardPaths::HomeLocation) + "/shared" + s);
-                urls[i] = g_str_to_ascii(u.toString().toStdString().c_str(), NULL);
-                i++;
-            }
-            uris = (gchar **)urls;
+            uris = deliver_to_legacy(transfer);
         }
 
         if (transfer->ShouldBeStartedByContentHub())
-            d->app_manager->invoke_application(transfer->destination().toStdString(), uris);
+            launch_application(transfer->destination(), uris);
 
         Q_FOREACH (RegHandler *r, d->handlers)
         {
@@ -504,54 +864,39 @@ void cucd::Service::handle_imports(int state)
             if (r->id == transfer->destination())
             {
                 TRACE() << Q_FUNC_INFO << "Found handler for charged transfer" << r->id;
-                if (r->handler->isValid())
-                    r->handler->HandleImport(QDBusObjectPath{transfer->import_path()});
+                notify_handler(r, transfer, handle_import);
             }
         }
     }
 
     if (state == cuc::Transfer::aborted)
     {
-        if (transfer->WasSourceStartedByContentHub())
+        cancel_prelaunch(transfer);
+        QPointer<cucd::Transfer> guard(transfer);
+        after_launch(transfer, [this, guard]()
         {
-            bool shouldStop = true;
-            Q_FOREACH (cucd::Transfer *t, d->active_transfers)
-            {
-                if (t->Id() != transfer->Id())
-                {
-                    if ((t->source() == transfer->source()) && (t->State() == cuc::Transfer::in_progress))
-                    {
-                        TRACE() << Q_FUNC_INFO << "Source has pending transfers:" << t->Id();
-                        shouldStop = false;
-                    }
-                    if (t->destination() == transfer->destination())
-                    {
-                        TRACE() << Q_FUNC_INFO << "Destination has pending transfers:" << t->Id();
-                        if (should_cancel(t->State()))
-                            shouldStop = false;
-                    }
-                }
-            }
-            if (shouldStop)
-                d->app_manager->stop_application(transfer->source().toStdString());
-        }
-        gchar ** uris = NULL;
-        d->app_manager->invoke_application(transfer->destination().toStdString(), uris);
+            if (guard && guard->WasSourceStartedByContentHub() && started_app_unused(guard))
+                d->app_queue->stop(guard->source());
+        });
+        launch_application(transfer->destination());
     }
 }
 
 void cucd::Service::handle_exports(int state)
 {
     TRACE() << Q_FUNC_INFO;
+    reset_idle_timer();
     cucd::Transfer *transfer = static_cast<cucd::Transfer*>(sender());
 
     TRACE() << Q_FUNC_INFO << "STATE:" << transfer->State();
+    d->metrics->transfer_state_changed(transfer->Id(), state);
 
 
     if (state == cuc::Transfer::initiated)
     {
         TRACE() << Q_FUNC_INFO << "Initiated";
         transfer->Handled();
+        prelaunch_destination(transfer);
     }
 
     if (state == cuc::Transfer::downloaded)
@@ -563,30 +908,22 @@ void cucd::Service::handle_exports(int state)
     if (state == cuc::Transfer::charged)
     {
         TRACE() << Q_FUNC_INFO << "Charged";
-        if (d->app_manager->is_application_started(transfer->destination().toStdString()))
-            transfer->SetSourceStartedByContentHub(false);
-        else
-            transfer->SetSourceStartedByContentHub(true);
-
-        gchar ** uris = NULL;
-        if (d->registry->peer_is_legacy(transfer->destination())) {
+        QStringList uris;
+        if (peer_is_legacy(transfer->destination())) {
             TRACE() << Q_FUNC_INFO << "Destination is a legacy app, collecting";
-            transfer->SetStore(shared_dir_for_peer(transfer->destination()));
-
-            auto items = transfer->Collect();
-            gchar* urls[2] = {0};
-            gint i = 0;
-            Q_FOREACH (QVariant item, items) {
-                QString s = copy_to_store(item.value<cuc::Item>().url().toString(), transfer->Store()).split("/shared")[1];
-                QUrl u = QUrl::fromLocalFile(QStandardPaths::writableLocation(QStandardPaths::HomeLocation) + "/shared" + s);
-                urls[i] = g_str_to_ascii(u.toString().toStdString().c_str(), NULL);
-                i++;
-            }
-            uris = (gchar **)urls;
+            uris = deliver_to_legacy(transfer);
         }
 
+        /* Whether the destination was already running decides
+         * if it gets stopped again on abort.
+         */
+        const bool prelaunched = d->prelaunched.contains(transfer->Id());
+        d->prelaunched.remove(transfer->Id());
+        auto started = track_launch(transfer, prelaunched);
         if (transfer->ShouldBeStartedByContentHub())
-            d->app_manager->invoke_application(transfer->destination().toStdString(), uris);
+            launch_application(transfer->destination(), uris, started);
+        else
+            d->app_queue->query(transfer->destination(), started);
 
         Q_FOREACH (RegHandler *r, d->handlers)
         {
@@ -594,10 +931,10 @@ void cucd::Service::handle_exports(int state)
             if (r->id == transfer->destination())
             {
                 TRACE() << "Found handler for charged transfer" << r->id;
-                if (transfer->Direction() == cuc::Transfer::Share && r->handler->isValid())
-                    r->handler->HandleShare(QDBusObjectPath{transfer->import_path()});
-                else if (r->handler->isValid())
-                    r->handler->HandleImport(QDBusObjectPath{transfer->import_path()});
+                if (transfer->Direction() == cuc::Transfer::Share)
+                    notify_handler(r, transfer, handle_share);
+                else
+                    notify_handler(r, transfer, handle_import);
             }
         }
     }
@@ -605,31 +942,14 @@ void cucd::Service::handle_exports(int state)
     if (state == cuc::Transfer::aborted)
     {
         TRACE() << Q_FUNC_INFO << "Aborted";
-        if (transfer->WasSourceStartedByContentHub())
+        cancel_prelaunch(transfer);
+        QPointer<cucd::Transfer> guard(transfer);
+        after_launch(transfer, [this, guard]()
         {
-            bool shouldStop = true;
-            Q_FOREACH (cucd::Transfer *t, d->active_transfers)
-            {
-                if (t->Id() != transfer->Id())
-                {
-                    if ((t->source() == transfer->source()) && (t->State() == cuc::Transfer::in_progress))
-                    {
-                        TRACE() << Q_FUNC_INFO << "Source has pending transfers:" << t->Id();
-                        shouldStop = false;
-                    }
-                    if (t->destination() == transfer->destination())
-                    {
-                        TRACE() << Q_FUNC_INFO << "Destination has pending transfers:" << t->Id();
-                        if (should_cancel(t->State()))
-                            shouldStop = false;
-                    }
-                }
-            }
-            if (shouldStop)
-                d->app_manager->stop_application(transfer->destination().toStdString());
-        }
-        gchar ** uris = NULL;
-        d->app_manager->invoke_application(transfer->source().toStdString(), uris);
+            if (guard && guard->WasSourceStartedByContentHub() && started_app_unused(guard))
+                d->app_queue->stop(guard->destination());
+        });
+        launch_application(transfer->source());
     }
 }
 
@@ -656,6 +976,15 @@ void cucd::Service::handler_unregistered(const QString& s)
 void cucd::Service::RegisterImportExportHandler(const QString& peer_id, const QDBusObjectPath& handler)
 {
     TRACE() << Q_FUNC_INFO << peer_id;
+    RegisterImportExportHandlerWithCapabilities(peer_id, handler, QStringList());
+}
+
+void cucd::Service::RegisterImportExportHandlerWithCapabilities(const QString& peer_id,
+                                                                const QDBusObjectPath& handler,
+                                                                const QStringList& capabilities)
+{
+    TRACE() << Q_FUNC_INFO << peer_id << capabilities;
+    reset_idle_timer();
     bool exists = false;
     RegHandler* r;
     Q_FOREACH (RegHandler *rh, d->handlers)
@@ -681,19 +1010,22 @@ void cucd::Service::RegisterImportExportHandler(const QString& peer_id, const QD
         d->handlers.insert(r);
         m_watcher->addWatchedService(r->service);
     }
+    r->capabilities = capabilities;
+    r->wants_snapshot = capabilities.contains(HANDLER_CAPABILITY_SNAPSHOT);
 
     TRACE() << Q_FUNC_INFO << r->id;
 
     Q_FOREACH (cucd::Transfer *t, d->active_transfers)
     {
+        if (t->destination() == peer_id)
+            apply_item_mode(t);
         TRACE() << Q_FUNC_INFO << "SOURCE: " << t->source() << "DEST:" << t->destination() << "STATE:" << t->State();
         if ((t->source() == peer_id) && (t->State() == cuc::Transfer::initiated))
         {
             TRACE() << Q_FUNC_INFO << "Found source:" << peer_id << "Direction:" << t->Direction();
             if (t->Direction() == cuc::Transfer::Import)
             {
-                if (r->handler->isValid())
-                    r->handler->HandleExport(QDBusObjectPath{t->export_path()});
+                notify_handler(r, t, handle_export);
             }
         }
         else if ((t->destination() == peer_id) && (t->State() == cuc::Transfer::charged))
@@ -702,13 +1034,11 @@ void cucd::Service::RegisterImportExportHandler(const QString& peer_id, const QD
             if (t->Direction() == cuc::Transfer::Export)
             {
                 TRACE() << Q_FUNC_INFO << "Found import, calling HandleImport";
-                if (r->handler->isValid())
-                    r->handler->HandleImport(QDBusObjectPath{t->import_path()});
+                notify_handler(r, t, handle_import);
             } else if (t->Direction() == cuc::Transfer::Share)
             {
                 TRACE() << Q_FUNC_INFO << "Found share, calling HandleShare";
-                if (r->handler->isValid())
-                    r->handler->HandleShare(QDBusObjectPath{t->import_path()});
+                notify_handler(r, t, handle_share);
             }
         }
         else if ((t->destination() == peer_id) && (t->State() == cuc::Transfer::downloaded))
@@ -724,9 +1054,45 @@ void cucd::Service::RegisterImportExportHandler(const QString& peer_id, const QD
     }
 }
 
+/* Handlers that understand snapshots get the transfer's state along
+ * with the call and don't need to query it back
+ */
+void cucd::Service::notify_handler(RegHandler* r, cucd::Transfer* transfer, HandlerCall call)
+{
+    TRACE() << Q_FUNC_INFO << r->id << transfer->Id() << call;
+    if (not r->handler->isValid())
+    {
+        TRACE() << Q_FUNC_INFO << "Handler invalid";
+        return;
+    }
+
+    switch (call)
+    {
+    case handle_import:
+        if (r->wants_snapshot)
+            r->handler->HandleImportWithSnapshot(QDBusObjectPath{transfer->import_path()}, transfer->snapshot());
+        else
+            r->handler->HandleImport(QDBusObjectPath{transfer->import_path()});
+        break;
+    case handle_export:
+        if (r->wants_snapshot)
+            r->handler->HandleExportWithSnapshot(QDBusObjectPath{transfer->export_path()}, transfer->snapshot());
+        else
+            r->handler->HandleExport(QDBusObjectPath{transfer->export_path()});
+        break;
+    case handle_share:
+        if (r->wants_snapshot)
+            r->handler->HandleShareWithSnapshot(QDBusObjectPath{transfer->import_path()}, transfer->snapshot());
+        else
+            r->handler->HandleShare(QDBusObjectPath{transfer->import_path()});
+        break;
+    }
+}
+
 void cucd::Service::HandlerActive(const QString& peer_id)
 {
     TRACE() << Q_FUNC_INFO << peer_id;
+    reset_idle_timer();
     Q_FOREACH (cucd::Transfer *t, d->active_transfers)
     {
         if ((t->destination() == peer_id) && (t->State() == cuc::Transfer::downloaded))
@@ -762,11 +1128,427 @@ QStringList cucd::Service::PasteFormats()
     return d->pasteFormats;
 }
 
-bool cucd::Service::verifiedSurfaceIsFocused(const QString &surfaceId)
+/* The formats along with the generation they belong to */
+QVariantMap cucd::Service::PasteboardState()
+{
+    TRACE() << Q_FUNC_INFO;
+    QVariantMap state;
+    state.insert(QStringLiteral("generation"), qulonglong(d->pasteboard_generation));
+    state.insert(QStringLiteral("formats"), d->pasteFormats);
+    return state;
+}
+
+bool cucd::Service::focus_needs_checking()
 {
     /* Only verify focus when not running under testing */
-    if (!qgetenv("CONTENT_HUB_TESTING").isNull())
+    return qgetenv("CONTENT_HUB_TESTING").isNull();
+}
+
+bool cucd::Service::verifiedSurfaceIsFocused(const QString &surfaceId)
+{
+    if (not focus_needs_checking())
         return true;
 
-    return d->unityFocus->call("isSurfaceFocused", surfaceId).arguments().at(0).toBool();
+    return d->focus_info()->call("isSurfaceFocused", surfaceId).arguments().at(0).toBool();
+}
+
+/* Asks Unity without blocking, replies arrive in the order the
+ * checks were made so pastes keep their order.
+ */
+void cucd::Service::check_focus(const QString& surfaceId, const std::function<void(bool)>& then)
+{
+    auto watcher = new QDBusPendingCallWatcher(d->focus_info()->asyncCall("isSurfaceFocused", surfaceId), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this, [then](QDBusPendingCallWatcher* call)
+    {
+        QDBusPendingReply<bool> reply = *call;
+        if (reply.isError())
+            qWarning() << "Focus check failed:" << reply.error().message();
+        then(reply.isValid() && reply.value());
+        call->deleteLater();
+    });
+}
+
+/* Runs work on the query pool and answers the current D-Bus call with
+ * its result.  Returns false when not called over D-Bus, the caller
+ * then has to do the work itself.
+ */
+bool cucd::Service::reply_from_pool(const std::function<QVariant()>& work)
+{
+    if (not calledFromDBus())
+        return false;
+
+    setDelayedReply(true);
+    queue_reply(connection(), message(), work);
+    return true;
+}
+
+void cucd::Service::queue_reply(const QDBusConnection& peer, const QDBusMessage& request,
+                                const std::function<QVariant()>& work)
+{
+    d->query_pool.start(new DelayedReply(peer, request, work));
+}
+
+bool cucd::Service::peer_is_legacy(const QString& peer_id)
+{
+    return d->registry->peer_is_legacy(peer_id);
+}
+
+void cucd::Service::launch_application(const QString& app_id, const QStringList& uris,
+                                       const std::function<void(bool, bool)>& done)
+{
+    QElapsedTimer timer;
+    timer.start();
+    cucd::Metrics* metrics = d->metrics;
+    d->app_queue->launch(app_id, uris, [metrics, app_id, timer, done](bool ok, bool was_running)
+    {
+        metrics->application_launched(app_id, timer.nsecsElapsed() / 1000, ok);
+        if (done)
+            done(ok, was_running);
+    });
+}
+
+QStringList cucd::Service::deliver_to_legacy(cucd::Transfer* transfer)
+{
+    QStringList uris;
+    const QString shared = shared_dir_for_peer(transfer->destination());
+    if (shared.isEmpty())
+    {
+        qWarning() << "No shared dir for legacy peer" << transfer->destination();
+        return uris;
+    }
+
+    /* Items were placed in the charged store already, linking them
+     * from there spares a second copy.
+     */
+    transfer->SetStore(shared);
+    QList<QUrl> urls;
+    Q_FOREACH (const QVariant& item, transfer->Collect())
+        urls << item.value<cuc::Item>().url();
+
+    /* The container sees the shared dir below its own home */
+    const QString container_shared = QStandardPaths::writableLocation(QStandardPaths::HomeLocation) + "/shared";
+    const QStringList paths = deliver_to_store(urls, shared);
+    uris.reserve(paths.size());
+    Q_FOREACH (const QString& path, paths)
+    {
+        QUrl u = QUrl::fromLocalFile(container_shared + path.mid(shared.size()));
+        gchar* ascii = g_str_to_ascii(u.toString().toStdString().c_str(), NULL);
+        uris << QString::fromUtf8(ascii);
+        g_free(ascii);
+    }
+    return uris;
+}
+
+/* The done callback for starting the app a transfer may stop again
+ * later.  It records whether the hub started the app, a launch that
+ * failed or timed out says nothing about that.  Until it ran, stops
+ * go through after_launch() and wait.
+ */
+std::function<void(bool, bool)> cucd::Service::track_launch(cucd::Transfer* transfer, bool prelaunched)
+{
+    const int id = transfer->Id();
+    QPointer<cucd::Transfer> guard(transfer);
+    d->launching.insert(id);
+    return [this, guard, id, prelaunched](bool ok, bool was_running)
+    {
+        d->launching.remove(id);
+        if (guard && (ok || prelaunched))
+            guard->SetSourceStartedByContentHub(prelaunched or not was_running);
+
+        Q_FOREACH (const std::function<void()>& stop, d->deferred_stops.take(id))
+            stop();
+    };
+}
+
+/* Runs stop now, or once the launch tracked for transfer is done */
+void cucd::Service::after_launch(cucd::Transfer* transfer, const std::function<void()>& stop)
+{
+    if (d->launching.contains(transfer->Id()))
+        d->deferred_stops[transfer->Id()] << stop;
+    else
+        stop();
+}
+
+/* No other transfer between the same peers needs the app the hub
+ * started for transfer anymore
+ */
+bool cucd::Service::started_app_unused(cucd::Transfer* transfer)
+{
+    Q_FOREACH (cucd::Transfer *t, d->active_transfers)
+    {
+        if (t->Id() == transfer->Id())
+            continue;
+
+        if ((t->source() == transfer->source()) && (t->State() == cuc::Transfer::in_progress))
+        {
+            TRACE() << Q_FUNC_INFO << "Source has pending transfers:" << t->Id();
+            return false;
+        }
+        if (t->destination() == transfer->destination() && should_cancel(t->State()))
+        {
+            TRACE() << Q_FUNC_INFO << "Destination has pending transfers:" << t->Id();
+            return false;
+        }
+    }
+    return true;
+}
+
+void cucd::Service::prelaunch_destination(cucd::Transfer* transfer)
+{
+    /* Legacy peers only take their uris on the command line */
+    if (not d->prelaunch
+        || not transfer->ShouldBeStartedByContentHub()
+        || peer_is_legacy(transfer->destination()))
+        return;
+
+    /* Launching a running app raises it, which would cover the source */
+    QPointer<cucd::Transfer> guard(transfer);
+    const int id = transfer->Id();
+    const QString destination = transfer->destination();
+    d->app_queue->query(destination, [this, guard, id, destination](bool ok, bool was_running)
+    {
+        if (not ok || was_running || guard.isNull())
+            return;
+        if (guard->State() != cuc::Transfer::initiated && guard->State() != cuc::Transfer::in_progress)
+            return;
+
+        TRACE() << Q_FUNC_INFO << "Prelaunching" << destination << "for transfer" << id;
+        d->prelaunched.insert(id);
+        d->app_queue->launch(destination, QStringList(), [this, id](bool ok, bool)
+        {
+            if (not ok)
+                d->prelaunched.remove(id);
+        });
+    });
+}
+
+void cucd::Service::cancel_prelaunch(cucd::Transfer* transfer)
+{
+    if (not d->prelaunched.remove(transfer->Id()))
+        return;
+
+    Q_FOREACH (cucd::Transfer *t, d->active_transfers)
+    {
+        if (t->Id() != transfer->Id() && t->destination() == transfer->destination() && should_cancel(t->State()))
+        {
+            TRACE() << Q_FUNC_INFO << "Destination has pending transfers:" << t->Id();
+            return;
+        }
+    }
+
+    /* Still waiting in the queue, nothing to undo */
+    if (d->app_queue->cancel(transfer->destination()) > 0)
+        return;
+
+    TRACE() << Q_FUNC_INFO << "Stopping prelaunched" << transfer->destination();
+    d->app_queue->stop(transfer->destination());
+}
+
+void cucd::Service::reset_idle_timer()
+{
+    if (d->idle_timer.interval() > 0)
+        d->idle_timer.start();
+}
+
+bool cucd::Service::is_idle()
+{
+    Q_FOREACH (cucd::Transfer *t, d->active_transfers)
+    {
+        if (transfer_in_flight(t->State()))
+        {
+            TRACE() << Q_FUNC_INFO << "Transfer in flight:" << t->Id();
+            return false;
+        }
+    }
+    return true;
+}
+
+void cucd::Service::idle_timeout()
+{
+    TRACE() << Q_FUNC_INFO;
+
+    if (not is_idle())
+    {
+        reset_idle_timer();
+        return;
+    }
+
+    /* Nothing is dispatched while this runs, the snapshot is complete
+     * and committed before the bus may start a new instance
+     */
+    if (not save_snapshot(snapshot_path()))
+    {
+        reset_idle_timer();
+        return;
+    }
+
+    /* New calls start a new instance, calls still queued for this one
+     * fail rather than change state the snapshot doesn't have
+     */
+    d->connection.unregisterService(HUB_SERVICE_NAME);
+    d->connection.unregisterObject(HUB_SERVICE_PATH, QDBusConnection::UnregisterTree);
+
+    /* The snapshot owns the stores of saved transfers now */
+    Q_FOREACH (cucd::Transfer *t, d->active_transfers)
+    {
+        if (transfer_worth_saving(t->State()))
+            t->SetPurgeStoreOnDestroy(false);
+    }
+
+    TRACE() << Q_FUNC_INFO << "Idle, exiting";
+    QCoreApplication::instance()->quit();
+}
+
+QString cucd::Service::snapshot_path()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)
+        + "/content-hub/service.snapshot";
+}
+
+bool cucd::Service::save_snapshot(const QString& path)
+{
+    TRACE() << Q_FUNC_INFO << path;
+
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QSaveFile file(path);
+    if (not file.open(QIODevice::WriteOnly))
+    {
+        qWarning() << "Failed to write snapshot" << path << file.errorString();
+        return false;
+    }
+    /* Paste contents end up in here */
+    file.setPermissions(QFileDevice::ReadOwner | QFileDevice::WriteOwner);
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << snapshotMagic << snapshotVersion;
+    out << qint32(d->transfer_counter) << qint32(d->paste_counter) << d->pasteFormats
+        << quint64(d->pasteboard_generation);
+
+    out << quint32(d->active_pastes.count());
+    Q_FOREACH (cucd::Paste *p, d->active_pastes)
+    {
+        p->save_state(out);
+        out << d->pasteTypes.value(p->Id());
+    }
+
+    out << quint32(d->handlers.count());
+    Q_FOREACH (RegHandler *r, d->handlers)
+        out << r->id << r->service << r->handler->path() << r->capabilities;
+
+    QList<cucd::Transfer*> transfers;
+    Q_FOREACH (cucd::Transfer *t, d->active_transfers)
+    {
+        if (transfer_worth_saving(t->State()))
+            transfers << t;
+    }
+    out << quint32(transfers.count());
+    Q_FOREACH (cucd::Transfer *t, transfers)
+        t->save_state(out);
+
+    if (out.status() != QDataStream::Ok || not file.commit())
+    {
+        qWarning() << "Failed to write snapshot" << path;
+        return false;
+    }
+    return true;
+}
+
+bool cucd::Service::restore_snapshot(const QString& path)
+{
+    TRACE() << Q_FUNC_INFO << path;
+
+    QFile file(path);
+    if (not file.open(QIODevice::ReadOnly))
+        return false;
+
+    /* A snapshot is only good for one restore */
+    QByteArray data = file.readAll();
+    file.remove();
+
+    QDataStream in(data);
+    in.setVersion(QDataStream::Qt_5_0);
+    quint32 magic, version;
+    in >> magic >> version;
+    if (magic != snapshotMagic || version != snapshotVersion)
+    {
+        qWarning() << "Ignoring incompatible snapshot" << path;
+        return false;
+    }
+
+    qint32 transfer_counter, paste_counter;
+    QStringList pasteFormats;
+    quint64 pasteboard_generation;
+    in >> transfer_counter >> paste_counter >> pasteFormats >> pasteboard_generation;
+    d->transfer_counter = qMax(d->transfer_counter, int(transfer_counter));
+    d->paste_counter = qMax(d->paste_counter, int(paste_counter));
+    d->pasteboard_generation = qMax(d->pasteboard_generation, pasteboard_generation);
+
+    quint32 count;
+    in >> count;
+    for (quint32 i = 0; i < count; i++)
+    {
+        auto paste = cucd::Paste::restore_state(in, this);
+        if (paste == nullptr)
+            break;
+        new PasteAdaptor(paste);
+        d->active_pastes.append(paste);
+
+        QStringList types, added;
+        in >> types;
+        hold_paste_formats(paste->Id(), types, added);
+    }
+
+    /* Keep the order clients saw, the counts come from the pastes */
+    QStringList restoredFormats;
+    Q_FOREACH (const QString& t, pasteFormats)
+    {
+        if (d->pasteFormatRefs.contains(t))
+            restoredFormats << t;
+    }
+    Q_FOREACH (const QString& t, d->pasteFormats)
+    {
+        if (not restoredFormats.contains(t))
+            restoredFormats << t;
+    }
+    d->pasteFormats = restoredFormats;
+
+    in >> count;
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++)
+    {
+        QString id, service, handler_path;
+        QStringList capabilities;
+        in >> id >> service >> handler_path >> capabilities;
+
+        /* The handler went away while we were not running */
+        if (not d->connection.interface()->isServiceRegistered(service))
+            continue;
+
+        auto r = new RegHandler{id,
+            service,
+            new cuc::dbus::Handler(service, handler_path, QDBusConnection::sessionBus(), 0)};
+        r->capabilities = capabilities;
+        r->wants_snapshot = capabilities.contains(HANDLER_CAPABILITY_SNAPSHOT);
+        d->handlers.insert(r);
+        m_watcher->addWatchedService(service);
+    }
+
+    in >> count;
+    for (quint32 i = 0; i < count; i++)
+    {
+        auto transfer = cucd::Transfer::restore_state(in, this);
+        if (transfer == nullptr)
+            break;
+        register_transfer(transfer);
+    }
+
+    if (in.status() != QDataStream::Ok)
+    {
+        qWarning() << "Snapshot" << path << "is truncated, restored what was readable";
+        return false;
+    }
+
+    TRACE() << Q_FUNC_INFO << "Restored" << d->active_pastes.count() << "pastes,"
+            << d->handlers.count() << "handlers," << d->active_transfers.count() << "transfers";
+    return true;
 }
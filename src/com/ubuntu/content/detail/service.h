@@ -26,6 +26,8 @@
 #include <QtDBus/QDBusServiceWatcher>
 #include <QtDBus/QDBusContext>
 
+#include <functional>
+
 #include <com/ubuntu/applicationmanager/application_manager.h>
 #include "handler.h"
 #include "transfer.h"
@@ -38,11 +40,14 @@ namespace content
 {
 namespace detail
 {
+class BulkReader;
 class PeerRegistry;
 
 class Service : public QObject, protected QDBusContext
 {
     Q_OBJECT
+    friend class BulkReader;
+
   public:
     Service(QDBusConnection connection,
             const QSharedPointer<PeerRegistry>& registry,
@@ -53,6 +58,10 @@ class Service : public QObject, protected QDBusContext
 
     Service& operator=(const Service&) = delete;
 
+    static QString snapshot_path();
+    bool save_snapshot(const QString& path);
+    bool restore_snapshot(const QString& path);
+
   public Q_SLOTS:
     QDBusVariant DefaultSourceForType(const QString &type_id);
     QVariantList KnownSourcesForType(const QString &type_id);
@@ -65,8 +74,14 @@ class Service : public QObject, protected QDBusContext
     QByteArray GetLatestPasteData(const QString& surfaceId);
     QByteArray GetPasteData(const QString& surfaceId, const QString& pasteId);
     QStringList PasteFormats();
+    QVariantMap PasteboardState();
+    QByteArray GetLatestPasteDataWithCapabilities(const QString& surfaceId, const QStringList& capabilities);
+    QByteArray GetPasteDataWithCapabilities(const QString& surfaceId, const QString& pasteId, const QStringList& capabilities);
+    QStringList PasteCapabilities();
+    QString BulkAddress();
 
     void RegisterImportExportHandler(const QString&, const QDBusObjectPath& handler);
+    void RegisterImportExportHandlerWithCapabilities(const QString&, const QDBusObjectPath& handler, const QStringList& capabilities);
     void HandlerActive(const QString&);
     void Quit();
     void DownloadManagerError(QString);
@@ -74,22 +89,57 @@ class Service : public QObject, protected QDBusContext
     QDBusVariant PeerForId(const QString&);
 
   private:
-    QByteArray getPasteData(const QString &surfaceId, int pasteId);
+    QByteArray getPasteData(const QString &surfaceId, int pasteId, const QStringList& capabilities = QStringList());
+    QByteArray paste_data(int pasteId, const QStringList& capabilities);
+    QByteArray paste_denied();
+    bool create_paste(const QString& app_id, const QString& sender, const QByteArray& mimeData, const QStringList& types);
+    void hold_paste_formats(int pasteId, const QStringList& types, QStringList& added);
+    void release_paste_formats(int pasteId, QStringList& removed);
+    void announce_pasteboard_change(const QStringList& added, const QStringList& removed);
     bool should_cancel(int);
+    bool focus_needs_checking();
     bool verifiedSurfaceIsFocused(const QString &surfaceId);
-    struct Private;
+    void check_focus(const QString& surfaceId, const std::function<void(bool focused)>& then);
+    bool reply_from_pool(const std::function<QVariant()>& work);
+    bool peer_is_legacy(const QString& peer_id);
+    std::function<QVariant()> peer_query(const QString& member, const QString& arg);
+    void queue_reply(const QDBusConnection& peer, const QDBusMessage& request,
+                     const std::function<QVariant()>& work);
+    void send_paste_data(const QDBusConnection& peer, const QDBusMessage& request,
+                         const QString& surfaceId, int pasteId, const QStringList& capabilities);
+    int latest_paste_id();
+    void register_transfer(com::ubuntu::content::detail::Transfer*);
+    /* Queued, done runs once the app was started or gave up */
+    void launch_application(const QString& app_id,
+                            const QStringList& uris = QStringList(),
+                            const std::function<void(bool ok, bool was_running)>& done = nullptr);
     struct RegHandler;
+    enum HandlerCall { handle_import, handle_export, handle_share };
+    void notify_handler(RegHandler* r, com::ubuntu::content::detail::Transfer* transfer, HandlerCall call);
+    QStringList deliver_to_legacy(com::ubuntu::content::detail::Transfer* transfer);
+    void prelaunch_destination(com::ubuntu::content::detail::Transfer* transfer);
+    std::function<void(bool, bool)> track_launch(com::ubuntu::content::detail::Transfer* transfer, bool prelaunched);
+    void after_launch(com::ubuntu::content::detail::Transfer* transfer, const std::function<void()>& stop);
+    bool started_app_unused(com::ubuntu::content::detail::Transfer* transfer);
+    void apply_item_mode(com::ubuntu::content::detail::Transfer* transfer);
+    void cancel_prelaunch(com::ubuntu::content::detail::Transfer* transfer);
+    void reset_idle_timer();
+    bool is_idle();
+    struct Private;
     QDBusServiceWatcher* m_watcher;
     QScopedPointer<Private> d;
 
   Q_SIGNALS:
     void PasteFormatsChanged(const QStringList &formats);
     void PasteboardChanged();
+    void PasteboardUpdated(qulonglong generation, const QStringList& added, const QStringList& removed);
 
   private Q_SLOTS:
     void handle_imports(int);
     void handle_exports(int);
     void handler_unregistered(const QString&);
+    void idle_timeout();
+    void bulk_peer_connected(const QDBusConnection& connection);
     QDBusObjectPath CreateTransfer(const QString&, const QString&, int, const QString&);
     void download_notify(com::ubuntu::content::detail::Transfer*);
 
@@ -17,11 +17,14 @@
  */
 
 #include "debug.h"
+#include "trace.h"
 #include "transfer.h"
 #include "utils.cpp"
 
 #include <QFileInfo>
+#include <QTimer>
 #include <com/ubuntu/content/hub.h>
+#include <com/ubuntu/content/item.h>
 #include <com/ubuntu/content/store.h>
 #include <com/ubuntu/content/transfer.h>
 #include <ubuntu/download_manager/download.h>
@@ -30,6 +33,14 @@
 namespace cuc = com::ubuntu::content;
 namespace cucd = com::ubuntu::content::detail;
 
+namespace
+{
+/* Items sent along with a handler notification, larger transfers
+ * are collected the usual way
+ */
+const int snapshotItemPage = 32;
+}
+
 struct cucd::Transfer::Private
 {
     Private(const int id,
@@ -43,9 +54,12 @@ struct cucd::Transfer::Private
             destination(destination),
             direction(direction),
             selection_type(cuc::Transfer::single),
+            item_mode(cuc::Transfer::copy),
+            charging(false),
             source_started_by_content_hub(false),
             should_be_started_by_content_hub(true),
-            content_type(content_type)
+            content_type(content_type),
+            purge_store_on_destroy(true)
     {
     }
     
@@ -56,11 +70,21 @@ struct cucd::Transfer::Private
     int direction;
     QString store;
     int selection_type;
+    int item_mode;
     QVariantList items;
+    /* Set between BeginCharge() and CommitCharge() */
+    bool charging;
+    QString charger;
+    QString charge_profile;
     bool source_started_by_content_hub;
     bool should_be_started_by_content_hub;
     QString download_id;
     const QString content_type;
+    bool purge_store_on_destroy;
+    /* Set while an unpacked download is being walked */
+    QSharedPointer<DirectoryWalker> walker;
+    /* What each handed off path was when it was charged */
+    QHash<QString, FileIdentity> handoff_files;
 };
 
 cucd::Transfer::Transfer(const int id,
@@ -77,58 +101,176 @@ cucd::Transfer::Transfer(const int id,
 cucd::Transfer::~Transfer()
 {
     TRACE() << __PRETTY_FUNCTION__;
-    purge_store_cache(d->store);
+    if (d->purge_store_on_destroy)
+        purge_store_cache(d->store);
+}
+
+/* Keeps the store around when the transfer is destroyed,
+ * used when it was saved to a snapshot and will be restored
+ */
+void cucd::Transfer::SetPurgeStoreOnDestroy(bool purge)
+{
+    TRACE() << __PRETTY_FUNCTION__ << purge;
+    d->purge_store_on_destroy = purge;
+}
+
+QVariantMap cucd::Transfer::snapshot()
+{
+    TRACE_EVENT(TraceTransfer, TraceDebug, "id=%d state=%d", d->id, d->state);
+
+    QVariantMap snapshot;
+    snapshot.insert(QStringLiteral("id"), d->id);
+    snapshot.insert(QStringLiteral("state"), int(d->state));
+    snapshot.insert(QStringLiteral("direction"), d->direction);
+    snapshot.insert(QStringLiteral("contentType"), d->content_type);
+    snapshot.insert(QStringLiteral("store"), d->store);
+    snapshot.insert(QStringLiteral("selectionType"), d->selection_type);
+    snapshot.insert(QStringLiteral("itemMode"), d->item_mode);
+    snapshot.insert(QStringLiteral("source"), d->source);
+    snapshot.insert(QStringLiteral("destination"), d->destination);
+    snapshot.insert(QStringLiteral("downloadId"), d->download_id);
+
+    if (d->state == cuc::Transfer::charged)
+    {
+        snapshot.insert(QStringLiteral("itemCount"), d->items.count());
+        snapshot.insert(QStringLiteral("items"), d->items.mid(0, snapshotItemPage));
+    }
+    return snapshot;
+}
+
+void cucd::Transfer::save_state(QDataStream& out)
+{
+    TRACE() << __PRETTY_FUNCTION__ << d->id;
+
+    out << qint32(d->id) << d->source << d->destination << qint32(d->direction)
+        << d->content_type << qint32(d->state) << d->store << qint32(d->selection_type)
+        << d->source_started_by_content_hub << d->should_be_started_by_content_hub
+        << d->download_id << qint32(d->item_mode);
+
+    out << quint32(d->items.count());
+    Q_FOREACH (QVariant v, d->items)
+    {
+        cuc::Item item = v.value<cuc::Item>();
+        out << item.url() << item.name() << item.text() << item.stream() << item.streamType()
+            << item.mimeType();
+    }
+
+    out << quint32(d->handoff_files.count());
+    for (auto it = d->handoff_files.constBegin(); it != d->handoff_files.constEnd(); ++it)
+        out << it.key() << it.value().device << it.value().inode;
+}
+
+cucd::Transfer* cucd::Transfer::restore_state(QDataStream& in, QObject* parent)
+{
+    qint32 id, direction, state, selection_type, item_mode;
+    QString source, destination, content_type, store, download_id;
+    bool source_started, should_be_started;
+    quint32 count;
+
+    in >> id >> source >> destination >> direction
+       >> content_type >> state >> store >> selection_type
+       >> source_started >> should_be_started
+       >> download_id >> item_mode >> count;
+    if (in.status() != QDataStream::Ok)
+        return nullptr;
+
+    auto transfer = new cucd::Transfer(id, source, destination, direction, content_type, parent);
+    transfer->d->state = static_cast<cuc::Transfer::State>(state);
+    transfer->d->store = store;
+    transfer->d->selection_type = selection_type;
+    transfer->d->source_started_by_content_hub = source_started;
+    transfer->d->should_be_started_by_content_hub = should_be_started;
+    transfer->d->download_id = download_id;
+    transfer->d->item_mode = item_mode;
+
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++)
+    {
+        QUrl url;
+        QString name, text, streamType, mimeType;
+        QByteArray stream;
+        in >> url >> name >> text >> stream >> streamType >> mimeType;
+
+        cuc::Item item(url);
+        item.setName(name);
+        item.setText(text);
+        item.setStream(stream);
+        item.setStreamType(streamType);
+        item.setMimeType(mimeType);
+        transfer->d->items << QVariant::fromValue(item);
+    }
+
+    in >> count;
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++)
+    {
+        QString path;
+        FileIdentity identity;
+        in >> path >> identity.device >> identity.inode;
+        transfer->d->handoff_files.insert(path, identity);
+    }
+
+    if (in.status() != QDataStream::Ok)
+    {
+        /* The store belongs to whatever restores the snapshot next */
+        transfer->d->purge_store_on_destroy = false;
+        delete transfer;
+        return nullptr;
+    }
+
+    TRACE() << __PRETTY_FUNCTION__ << id << "state:" << state;
+    return transfer;
 }
 
 /* unique id of the transfer */
 int cucd::Transfer::Id()
 {
-    TRACE() << __PRETTY_FUNCTION__;
+    TRACE_EVENT(TraceTransfer, TraceDebug, "id=%d state=%d", d->id, d->state);
     return d->id;
 }
 
 /* returns the peer_id of the requested export handler */
 QString cucd::Transfer::source()
 {
-    TRACE() << __PRETTY_FUNCTION__;
+    TRACE_EVENT(TraceTransfer, TraceDebug, "id=%d state=%d", d->id, d->state);
     return d->source;
 }
 
 /* returns the peer_id of the application requesting the import */
 QString cucd::Transfer::destination()
 {
-    TRACE() << __PRETTY_FUNCTION__;
+    TRACE_EVENT(TraceTransfer, TraceDebug, "id=%d state=%d", d->id, d->state);
     return d->destination;
 }
 
 int cucd::Transfer::Direction()
 {
-    TRACE() << __PRETTY_FUNCTION__;
+    TRACE_EVENT(TraceTransfer, TraceDebug, "id=%d state=%d", d->id, d->state);
     return d->direction;
 }
 
 int cucd::Transfer::State()
 {
-    TRACE() << __PRETTY_FUNCTION__;
+    TRACE_EVENT(TraceTransfer, TraceDebug, "id=%d state=%d", d->id, d->state);
     return d->state;
 }
 
 void cucd::Transfer::Abort()
 {
-    TRACE() << __PRETTY_FUNCTION__;
+    TRACE_EVENT(TraceTransfer, TraceInfo, "id=%d state=%d", d->id, d->state);
 
     if (d->state == cuc::Transfer::aborted)
         return;
 
     purge_store_cache(d->store);
     d->items.clear();
+    d->handoff_files.clear();
+    d->charging = false;
     d->state = cuc::Transfer::aborted;
     Q_EMIT(StateChanged(d->state));
 }
 
 void cucd::Transfer::Start()
 {
-    TRACE() << __PRETTY_FUNCTION__;
+    TRACE_EVENT(TraceTransfer, TraceInfo, "id=%d state=%d", d->id, d->state);
 
     if (d->state == cuc::Transfer::initiated)
         return;
@@ -139,7 +281,7 @@ void cucd::Transfer::Start()
 
 void cucd::Transfer::Handled()
 {
-    TRACE() << __PRETTY_FUNCTION__;
+    TRACE_EVENT(TraceTransfer, TraceInfo, "id=%d state=%d", d->id, d->state);
 
     if (d->state == cuc::Transfer::in_progress)
         return;
@@ -150,7 +292,7 @@ void cucd::Transfer::Handled()
 
 void cucd::Transfer::Charge(const QVariantList& items)
 {
-    TRACE() << __PRETTY_FUNCTION__;
+    TRACE_EVENT(TraceTransfer, TraceInfo, "id=%d state=%d", d->id, d->state);
 
     if (d->state == cuc::Transfer::charged)
         return;
@@ -168,14 +310,126 @@ void cucd::Transfer::Charge(const QVariantList& items)
         return;
     } 
 
-    QString profile = aa_profile(message().service());
+    QVariantList placed;
+    if (not place_items(items, aa_profile(message().service()), placed) || placed.isEmpty())
+    {
+        qWarning() << "Failed to charge items, aborting";
+        d->state = cuc::Transfer::aborted;
+    }
+    else
+    {
+        d->items = placed;
+        d->state = cuc::Transfer::charged;
+    }
+    Q_EMIT(StateChanged(d->state));
+}
+
+/* Streaming charge: the source sends its items in batches between
+ * BeginCharge() and CommitCharge(), each batch is placed in the store
+ * as it arrives and destinations can collect it right away.
+ */
+void cucd::Transfer::BeginCharge()
+{
+    TRACE_EVENT(TraceTransfer, TraceInfo, "id=%d state=%d", d->id, d->state);
+
+    if (d->state != cuc::Transfer::created
+        && d->state != cuc::Transfer::initiated
+        && d->state != cuc::Transfer::in_progress)
+    {
+        if (calledFromDBus())
+            sendErrorReply(QDBusError::Failed, "Transfer can't be charged in its current state");
+        return;
+    }
+
+    /* The items placed so far belong to the running charge */
+    if (d->charging)
+    {
+        if (calledFromDBus())
+            sendErrorReply(QDBusError::Failed, "Transfer is already being charged");
+        return;
+    }
+
+    d->charger = message().service();
+    d->charge_profile = aa_profile(d->charger);
+    d->charging = true;
+    d->items.clear();
+    d->handoff_files.clear();
+}
+
+void cucd::Transfer::AppendItems(const QVariantList& items)
+{
+    TRACE_EVENT(TraceTransfer, TraceDebug, "id=%d count=%d", d->id, items.count());
+
+    if (not d->charging || message().service() != d->charger)
+    {
+        if (calledFromDBus())
+            sendErrorReply(QDBusError::Failed, "No charge in progress");
+        return;
+    }
+
+    QVariantList placed;
+    if (not place_items(items, d->charge_profile, placed))
+    {
+        qWarning() << "Failed to charge items, aborting";
+        d->charging = false;
+        Abort();
+        if (calledFromDBus())
+            sendErrorReply(QDBusError::Failed, "Failed to charge items");
+        return;
+    }
+
+    d->items.append(placed);
+    Q_EMIT(ItemsAppended(d->items.count()));
+}
+
+void cucd::Transfer::CommitCharge()
+{
+    TRACE_EVENT(TraceTransfer, TraceInfo, "id=%d count=%d", d->id, d->items.count());
+
+    if (not d->charging || message().service() != d->charger)
+    {
+        if (calledFromDBus())
+            sendErrorReply(QDBusError::Failed, "No charge in progress");
+        return;
+    }
+
+    d->charging = false;
+    if (d->items.isEmpty())
+    {
+        qWarning() << "Failed to charge items, aborting";
+        d->state = cuc::Transfer::aborted;
+    }
+    else
+    {
+        d->state = cuc::Transfer::charged;
+    }
+    Q_EMIT(StateChanged(d->state));
+}
+
+/* Handed off items are only for the destination, other callers get
+ * an error reply
+ */
+bool cucd::Transfer::called_by_destination()
+{
+    if (not calledFromDBus() || peer_runs_as(message().service(), d->destination))
+        return true;
+
+    sendErrorReply(QDBusError::AccessDenied, "Only the destination of a transfer may do this");
+    return false;
+}
+
+/* Places items in the store, false as soon as one can't be */
+bool cucd::Transfer::place_items(const QVariantList& items, const QString& profile, QVariantList& placed)
+{
     TRACE() << Q_FUNC_INFO << "PROFILE:" << profile;
 
-    QVariantList ret;
+    placed.reserve(placed.size() + items.size());
     Q_FOREACH(QVariant iv, items) {
         cuc::Item item = qdbus_cast<Item>(iv);
+        /* Destinations only ever see a type detected here */
+        item.setMimeType(QString());
         if (item.url().isEmpty()) {
-            ret.append(QVariant::fromValue(item));
+            placed.append(QVariant::fromValue(item));
         } else {
             TRACE() << Q_FUNC_INFO;
             if (profile.toStdString() != QString("unconfined").toStdString() &&
@@ -186,34 +440,38 @@ void cucd::Transfer::Charge(const QVariantList& items)
                 // Verify app has read access to local file before transfer
                 if (not check_profile_read(profile, file)) {
                     // If failed to access file, abort
-                    ret.clear();
-                    goto abort;
+                    return false;
                 }
             }
+            /* The destination reads it straight from the source through
+             * OpenItem(), only make sure that will work
+             */
+            if (d->item_mode == cuc::Transfer::handoff && item.url().isLocalFile()) {
+                FileIdentity identity;
+                QDBusUnixFileDescriptor fd = open_for_handoff(item.url().toLocalFile(), FileIdentity(), &identity);
+                if (not fd.isValid()) {
+                    qWarning() << "Can't open item for handoff:" << item.url();
+                    return false;
+                }
+                d->handoff_files.insert(item.url().toLocalFile(), identity);
+                item.setMimeType(sniff_mime_type(item.url().toLocalFile(), fd.fileDescriptor()));
+                placed.append(QVariant::fromValue(item));
+                continue;
+            }
             QString newUrl = copy_to_store(item.url().toString(), d->store);
             if (!newUrl.isEmpty()) {
                 item.setUrl(QUrl(newUrl));
+                if (item.url().isLocalFile())
+                    item.setMimeType(sniff_mime_type(item.url().toLocalFile()));
                 TRACE() << Q_FUNC_INFO << "Item:" << item.url();
-                ret.append(QVariant::fromValue(item));
+                placed.append(QVariant::fromValue(item));
             } else {
-                ret.clear();
-                goto abort;
+                return false;
             }
         }
     }
 
-abort:
-    if (ret.count() <= 0)
-    {
-        qWarning() << "Failed to charge items, aborting";
-        d->state = cuc::Transfer::aborted;
-    }
-    else
-    {
-        d->items = ret;
-        d->state = cuc::Transfer::charged;
-    }
-    Q_EMIT(StateChanged(d->state));
+    return true;
 }
 
 void cucd::Transfer::Download()
@@ -246,17 +504,50 @@ void cucd::Transfer::Download()
     }
 }
 
+/* The tree is walked one batch per pass of the event loop, so the
+ * service keeps answering meanwhile and destinations can pick up items
+ * through CollectFrom() as ItemsAppended arrives.  The transfer is
+ * downloaded once the walk is done.
+ */
 void cucd::Transfer::AddItemsFromDir(QDir dir) {
-    QFileInfoList files = dir.entryInfoList(QDir::NoDotAndDotDot | QDir::Dirs | QDir::Files);
-    Q_FOREACH(const QFileInfo &fileInfo, files) {
-        QString path = fileInfo.absoluteFilePath();
-        if(fileInfo.isDir()) {
-            AddItemsFromDir(QDir(path));
-        } else {
+    TRACE() << __PRETTY_FUNCTION__ << dir.absolutePath();
+
+    d->walker.reset(new DirectoryWalker(dir.absolutePath()));
+    walk_next_batch();
+}
+
+void cucd::Transfer::walk_next_batch()
+{
+    if (d->walker.isNull())
+        return;
+
+    /* Aborted while walking */
+    if (d->state != cuc::Transfer::downloading)
+    {
+        d->walker.reset();
+        return;
+    }
+
+    const QStringList files = d->walker->next();
+    if (not files.isEmpty())
+    {
+        d->items.reserve(d->items.size() + files.size());
+        Q_FOREACH(const QString& path, files) {
             cuc::Item item = cuc::Item{QUrl::fromLocalFile(path).toString()};
             d->items.append(QVariant::fromValue(item));
         }
+        Q_EMIT(ItemsAppended(d->items.count()));
+        QTimer::singleShot(0, this, SLOT(walk_next_batch()));
+        return;
     }
+
+    if (d->walker->more())
+        qWarning() << "Stopped walking download after" << d->walker->count() << "items";
+    TRACE() << __PRETTY_FUNCTION__ << "Added" << d->walker->count() << "items";
+    d->walker.reset();
+
+    d->state = cuc::Transfer::downloaded;
+    Q_EMIT(StateChanged(d->state));
 }
 
 void cucd::Transfer::DownloadComplete(QString destFilePath)
@@ -268,10 +559,11 @@ void cucd::Transfer::DownloadComplete(QString destFilePath)
         // send us the path of the directory that multiple files have been
         // unpacked into.
         AddItemsFromDir(QDir(destFilePath));
-    } else {
-        cuc::Item item = cuc::Item{QUrl::fromLocalFile(destFilePath).toString()};
-        d->items.append(QVariant::fromValue(item));
+        return;
     }
+
+    cuc::Item item = cuc::Item{QUrl::fromLocalFile(destFilePath).toString()};
+    d->items.append(QVariant::fromValue(item));
     d->state = cuc::Transfer::downloaded;
     Q_EMIT(StateChanged(d->state));
 }
@@ -286,9 +578,27 @@ void cucd::Transfer::DownloadError(Ubuntu::DownloadManager::Error* error)
     Q_EMIT(StateChanged(d->state));
 }
 
+/* Items from first on, doesn't mark the transfer collected so
+ * destinations can pick up batches while the source is still charging
+ */
+QVariantList cucd::Transfer::CollectFrom(int first)
+{
+    TRACE_EVENT(TraceTransfer, TraceDebug, "id=%d first=%d count=%d", d->id, first, d->items.count());
+
+    if (first < 0 || first >= d->items.count())
+        return QVariantList();
+    return d->items.mid(first);
+}
+
+/* While a charge is streaming in only the items so far are handed
+ * out, the transfer moves on once it is committed
+ */
 QVariantList cucd::Transfer::Collect()
 {
-    TRACE() << __PRETTY_FUNCTION__;
+    TRACE_EVENT(TraceTransfer, TraceInfo, "id=%d state=%d", d->id, d->state);
+
+    if (d->charging)
+        return d->items;
 
     if (d->state != cuc::Transfer::collected)
     {
@@ -301,20 +611,21 @@ QVariantList cucd::Transfer::Collect()
 
 void cucd::Transfer::Finalize()
 {
-    TRACE() << __PRETTY_FUNCTION__;
+    TRACE_EVENT(TraceTransfer, TraceInfo, "id=%d state=%d", d->id, d->state);
 
     if (d->state == cuc::Transfer::finalized)
         return;
 
     purge_store_cache(d->store);
     d->items.clear();
+    d->handoff_files.clear();
     d->state = cuc::Transfer::finalized;
     Q_EMIT(StateChanged(d->state));
 }
 
 QString cucd::Transfer::Store()
 {
-    TRACE() << __PRETTY_FUNCTION__;
+    TRACE_EVENT(TraceTransfer, TraceDebug, "id=%d state=%d", d->id, d->state);
     return d->store;
 }
 
@@ -331,7 +642,7 @@ void cucd::Transfer::SetStore(QString uri)
 
 int cucd::Transfer::SelectionType()
 {
-    TRACE() << __PRETTY_FUNCTION__;
+    TRACE_EVENT(TraceTransfer, TraceDebug, "id=%d state=%d", d->id, d->state);
     return d->selection_type;
 }
 
@@ -347,6 +658,107 @@ void cucd::Transfer::SetSelectionType(int type)
     Q_EMIT(SelectionTypeChanged(d->selection_type));
 }
 
+int cucd::Transfer::ItemMode()
+{
+    TRACE_EVENT(TraceTransfer, TraceDebug, "id=%d state=%d", d->id, d->state);
+    return d->item_mode;
+}
+
+/* Only before the items are charged, they are placed accordingly */
+void cucd::Transfer::SetItemMode(int mode)
+{
+    TRACE_EVENT(TraceTransfer, TraceInfo, "id=%d mode=%d", d->id, mode);
+    if (not called_by_destination())
+        return;
+    if (d->state != cuc::Transfer::created
+        && d->state != cuc::Transfer::initiated
+        && d->state != cuc::Transfer::in_progress)
+        return;
+    if (mode != cuc::Transfer::copy && mode != cuc::Transfer::handoff)
+        return;
+    if (d->item_mode == mode)
+        return;
+
+    d->item_mode = mode;
+    Q_EMIT(ItemModeChanged(d->item_mode));
+}
+
+/* Opens one handed off item for the destination.  Descriptors are only
+ * opened on request and closed once the reply went out, a transfer can
+ * hold far more items than a process may keep open or a message carry.
+ * The file must still be the one that was checked at charge time.
+ */
+QDBusUnixFileDescriptor cucd::Transfer::OpenItem(int index)
+{
+    TRACE_EVENT(TraceTransfer, TraceDebug, "id=%d index=%d", d->id, index);
+
+    if (not called_by_destination())
+        return QDBusUnixFileDescriptor();
+
+    QDBusUnixFileDescriptor fd;
+    if (d->item_mode == cuc::Transfer::handoff
+        && (d->state == cuc::Transfer::charged || d->state == cuc::Transfer::collected)
+        && index >= 0 && index < d->items.count())
+    {
+        cuc::Item item = d->items.at(index).value<cuc::Item>();
+        const QString path = item.url().toLocalFile();
+        if (item.url().isLocalFile() && d->handoff_files.contains(path))
+            fd = open_for_handoff(path, d->handoff_files.value(path));
+    }
+
+    if (not fd.isValid() && calledFromDBus())
+        sendErrorReply(QDBusError::InvalidArgs, "No such handed off item");
+    return fd;
+}
+
+/* Copies handed off items into the store after all, for destinations
+ * that want to keep them, the transfer is a copy afterwards
+ */
+void cucd::Transfer::Persist()
+{
+    TRACE_EVENT(TraceTransfer, TraceInfo, "id=%d state=%d", d->id, d->state);
+
+    if (not called_by_destination())
+        return;
+    if (d->state != cuc::Transfer::charged && d->state != cuc::Transfer::collected)
+        return;
+    if (d->item_mode != cuc::Transfer::handoff)
+        return;
+
+    QVariantList items;
+    items.reserve(d->items.size());
+    Q_FOREACH (const QVariant& v, d->items)
+    {
+        cuc::Item item = v.value<cuc::Item>();
+        if (item.url().isLocalFile())
+        {
+            /* Copied from what was checked at charge time, not whatever
+             * the path points to now
+             */
+            const QString path = item.url().toLocalFile();
+            QString newUrl;
+            QDBusUnixFileDescriptor fd;
+            if (d->handoff_files.contains(path))
+                fd = open_for_handoff(path, d->handoff_files.value(path));
+            if (fd.isValid())
+                newUrl = copy_opened_to_store(fd.fileDescriptor(), path, d->store);
+            if (newUrl.isEmpty())
+            {
+                qWarning() << "Failed to persist" << item.url();
+                if (calledFromDBus())
+                    sendErrorReply(QDBusError::Failed, "Failed to persist items");
+                return;
+            }
+            item.setUrl(QUrl(newUrl));
+        }
+        items << QVariant::fromValue(item);
+    }
+    d->items = items;
+    d->handoff_files.clear();
+    d->item_mode = cuc::Transfer::copy;
+    Q_EMIT(ItemModeChanged(d->item_mode));
+}
+
 QString cucd::Transfer::DownloadId()
 {
     TRACE() << Q_FUNC_INFO;
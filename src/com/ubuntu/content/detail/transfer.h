@@ -18,11 +18,13 @@
 #ifndef TRANSFER_H_
 #define TRANSFER_H_
 
+#include <QDataStream>
 #include <QDir>
 #include <QObject>
 #include <QStringList>
 #include <QtDBus/QDBusMessage>
 #include <QtDBus/QDBusContext>
+#include <QtDBus/QDBusUnixFileDescriptor>
 #include <ubuntu/download_manager/error.h>
 
 namespace com
@@ -39,6 +41,7 @@ class Transfer : public QObject, protected QDBusContext
     Q_PROPERTY(int State READ State NOTIFY StateChanged)
     Q_PROPERTY(QString Store READ Store WRITE SetStore NOTIFY StoreChanged)
     Q_PROPERTY(int SelectionType READ SelectionType WRITE SetSelectionType NOTIFY SelectionTypeChanged)
+    Q_PROPERTY(int ItemMode READ ItemMode WRITE SetItemMode NOTIFY ItemModeChanged)
     Q_PROPERTY(QString DownloadId READ DownloadId WRITE SetDownloadId NOTIFY DownloadIdChanged)
     Q_PROPERTY(int id READ Id)
     Q_PROPERTY(QString source READ source)
@@ -57,11 +60,22 @@ class Transfer : public QObject, protected QDBusContext
     bool WasSourceStartedByContentHub() const;
     void SetShouldBeStartedByContentHub(bool start);
     bool ShouldBeStartedByContentHub() const;
+    void SetPurgeStoreOnDestroy(bool purge);
+
+    /* Everything a handler needs to act on the transfer, see
+     * Handler::HandleImportWithSnapshot()
+     */
+    QVariantMap snapshot();
+
+    void save_state(QDataStream& out);
+    static Transfer* restore_state(QDataStream& in, QObject* parent = nullptr);
 
 Q_SIGNALS:
     void StateChanged(int State);
     void StoreChanged(QString Store);
     void SelectionTypeChanged(int SelectionType);
+    void ItemModeChanged(int ItemMode);
+    void ItemsAppended(int count);
     void DownloadIdChanged(QString DownloadId);
     void DownloadManagerError(QString ErrorMessage);
 
@@ -70,13 +84,21 @@ Q_SIGNALS:
     void Start();
     void Handled();
     void Charge(const QVariantList&);
+    void BeginCharge();
+    void AppendItems(const QVariantList&);
+    void CommitCharge();
     QVariantList Collect();
+    QVariantList CollectFrom(int first);
     void Abort();
     void Finalize();
     QString Store();
     void SetStore(QString);
     int SelectionType();
     void SetSelectionType(int);
+    int ItemMode();
+    void SetItemMode(int);
+    QDBusUnixFileDescriptor OpenItem(int index);
+    void Persist();
     int Id();
     int Direction();
     QString source();
@@ -91,7 +113,13 @@ Q_SIGNALS:
     QString ContentType();
     void AddItemsFromDir(QDir dir);
 
+  private Q_SLOTS:
+    void walk_next_batch();
+
   private:
+    bool place_items(const QVariantList& items, const QString& profile, QVariantList& placed);
+    bool called_by_destination();
+
     struct Private;
     QScopedPointer<Private> d;
 
@@ -0,0 +1,90 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TYPE_TABLE_H_
+#define TYPE_TABLE_H_
+
+#include <QString>
+
+namespace com
+{
+namespace ubuntu
+{
+namespace content
+{
+namespace detail
+{
+/* Every type id is interned to a small dense integer, see
+ * Type::index().  The well-known types always occupy the first
+ * slots in this order, anything else is appended as it is first seen.
+ */
+enum KnownTypeIndex
+{
+    UnknownTypeIndex = 0,
+    AllTypeIndex,
+    PicturesTypeIndex,
+    MusicTypeIndex,
+    DocumentsTypeIndex,
+    ContactsTypeIndex,
+    VideosTypeIndex,
+    LinksTypeIndex,
+    EbooksTypeIndex,
+    TextTypeIndex,
+    EventsTypeIndex,
+    KnownTypeCount
+};
+
+constexpr const char* knownTypeNames[KnownTypeCount] =
+{
+    "unknown",
+    "all",
+    "pictures",
+    "music",
+    "documents",
+    "contacts",
+    "videos",
+    "links",
+    "ebooks",
+    "text",
+    "events"
+};
+
+/* Returns the index of id, registering it if needed */
+int intern_type(const QString& id);
+
+/* Returns the index of id, or -1 if it was never registered */
+int find_type(const QString& id);
+
+/* Returns the id for index, or an empty string if out of range */
+QString type_name(int index);
+
+/* Content can be exchanged for these, "all" and "unknown" excluded */
+constexpr bool is_well_known_type(int index)
+{
+    return index >= PicturesTypeIndex && index < KnownTypeCount;
+}
+
+/* What peers may declare in their hook files */
+constexpr bool is_installable_type(int index)
+{
+    return index >= AllTypeIndex && index < KnownTypeCount;
+}
+}
+}
+}
+}
+
+#endif // TYPE_TABLE_H_
@@ -34,7 +34,9 @@
 #include <libertine.h>
 
 #include <QDBusPendingCallWatcher>
+#include <QDBusServiceWatcher>
 #include <QIcon>
+#include <QMetaMethod>
 #include <QStandardPaths>
 #include <QStringList>
 #include <QProcessEnvironment>
@@ -49,12 +51,158 @@ struct cuc::Hub::Private
             HUB_SERVICE_NAME,
             HUB_SERVICE_PATH,
             QDBusConnection::sessionBus(),
+            parent)),
+        capabilitiesKnown(false),
+        bulkService(nullptr),
+        bulkKnown(false),
+        pasteboardSubscribed(false),
+        legacyPasteboard(false),
+        pasteGeneration(0),
+        ownerWatcher(new QDBusServiceWatcher(
+            HUB_SERVICE_NAME,
+            QDBusConnection::sessionBus(),
+            QDBusServiceWatcher::WatchForOwnerChange,
             parent))
     {
+        QObject::connect(ownerWatcher, &QDBusServiceWatcher::serviceOwnerChanged, parent,
+                [this](const QString&, const QString&, const QString& newOwner)
+                {
+                    service_owner_changed(newOwner);
+                });
+    }
+
+    ~Private()
+    {
+        drop_bulk();
+    }
+
+    /* Older services don't implement PasteCapabilities() at all. Only
+     * the very first lookup waits, a restarted service is asked as soon
+     * as it shows up.
+     */
+    const QStringList& paste_capabilities()
+    {
+        if (not capabilitiesKnown) {
+            if (not capabilitiesPending)
+                request_capabilities();
+            capabilitiesPending->waitForFinished();
+            if (not capabilitiesKnown)
+                capabilities_arrived();
+        }
+        return capabilities;
+    }
+
+    void request_capabilities()
+    {
+        capabilities.clear();
+        capabilitiesKnown = false;
+        capabilitiesPending.reset(new QDBusPendingCallWatcher(service->PasteCapabilities()));
+        QObject::connect(capabilitiesPending.data(), &QDBusPendingCallWatcher::finished,
+                [this](QDBusPendingCallWatcher*) { capabilities_arrived(); });
+    }
+
+    void capabilities_arrived()
+    {
+        QDBusPendingReply<QStringList> reply = *capabilitiesPending;
+        if (not reply.isError())
+            capabilities = reply.value();
+        capabilitiesKnown = true;
+    }
+
+    /* What the last service supported says nothing about the next one */
+    void service_owner_changed(const QString& newOwner)
+    {
+        TRACE() << Q_FUNC_INFO << newOwner;
+        drop_bulk();
+        bulkKnown = false;
+        capabilitiesPending.reset();
+        capabilities.clear();
+        capabilitiesKnown = false;
+        if (not newOwner.isEmpty())
+            request_capabilities();
+    }
+
+    bool supports_v2()
+    {
+        return paste_capabilities().contains(pasteCapabilityV2);
+    }
+
+    bool supports_compression()
+    {
+        return supports_v2() && paste_capabilities().contains(pasteCapabilityZlib);
+    }
+
+    /* What this client can read, restricted to what the service knows */
+    QStringList reader_capabilities()
+    {
+        QStringList result;
+        result << pasteCapabilityV2;
+        if (supports_compression())
+            result << pasteCapabilityZlib;
+        return result;
+    }
+
+    /* Bulk reads go straight to the service over its private endpoint
+     * when it has one, everything else stays on the bus.
+     */
+    com::ubuntu::content::dbus::Service* bulk()
+    {
+        if (bulkService && not bulkService->connection().isConnected())
+        {
+            TRACE() << Q_FUNC_INFO << "Bulk channel went away";
+            drop_bulk();
+        }
+
+        if (not bulkKnown)
+        {
+            bulkKnown = true;
+            if (qgetenv("CONTENT_HUB_BULK_CHANNEL") == "0")
+                return service;
+
+            /* Older services don't have BulkAddress() */
+            auto reply = service->BulkAddress();
+            reply.waitForFinished();
+            if (reply.isError() || reply.value().isEmpty())
+                return service;
+
+            QDBusConnection peer = QDBusConnection::connectToPeer(reply.value(), bulkConnectionName);
+            if (not peer.isConnected())
+            {
+                qWarning() << "Can't connect to bulk channel:" << peer.lastError().message();
+                QDBusConnection::disconnectFromPeer(bulkConnectionName);
+                return service;
+            }
+            bulkService = new com::ubuntu::content::dbus::Service(QString(), HUB_SERVICE_PATH, peer, nullptr);
+        }
+
+        return bulkService ? bulkService : service;
+    }
+
+    void drop_bulk()
+    {
+        if (bulkService == nullptr)
+            return;
+
+        delete bulkService;
+        bulkService = nullptr;
+        QDBusConnection::disconnectFromPeer(bulkConnectionName);
+        /* A restarted service may offer a new one */
+        bulkKnown = false;
     }
 
     com::ubuntu::content::dbus::Service* service;
     QStringList pasteFormats;
+    QStringList capabilities;
+    bool capabilitiesKnown;
+    QScopedPointer<QDBusPendingCallWatcher> capabilitiesPending;
+    com::ubuntu::content::dbus::Service* bulkService;
+    bool bulkKnown;
+    const QString bulkConnectionName{"content-hub-bulk"};
+    bool pasteboardSubscribed;
+    /* The service only sends the full PasteFormatsChanged */
+    bool legacyPasteboard;
+    quint64 pasteGeneration;
+    QDBusServiceWatcher* ownerWatcher;
 };
 
 cuc::Hub::Hub(QObject* parent) : QObject(parent), d{new cuc::Hub::Private{this}}
@@ -82,13 +230,6 @@ cuc::Hub::Hub(QObject* parent) : QObject(parent), d{new cuc::Hub::Private{this}}
         iconPaths << QString(path + "/usr/share/icons/");
     }
     QIcon::setThemeSearchPaths(iconPaths);
-
-    QObject::connect(d->service, &com::ubuntu::content::dbus::Service::PasteFormatsChanged,
-            this, &cuc::Hub::Hub::onPasteFormatsChanged);
-    requestPasteFormats();
-    QObject::connect(d->service, SIGNAL(PasteboardChanged()),
-            this,
-            SIGNAL(pasteboardChanged()));
 }
 
 cuc::Hub::~Hub()
@@ -101,22 +242,113 @@ cuc::Hub* cuc::Hub::Client::instance()
     return hub;
 }
 
+void cuc::Hub::connectNotify(const QMetaMethod& signal)
+{
+    if (signal == QMetaMethod::fromSignal(&cuc::Hub::pasteFormatsChanged)
+        || signal == QMetaMethod::fromSignal(&cuc::Hub::pasteboardChanged))
+        subscribePasteboard();
+}
+
+void cuc::Hub::disconnectNotify(const QMetaMethod&)
+{
+    /* The signal is invalid when everything was disconnected at once */
+    if (not isSignalConnected(QMetaMethod::fromSignal(&cuc::Hub::pasteFormatsChanged))
+        && not isSignalConnected(QMetaMethod::fromSignal(&cuc::Hub::pasteboardChanged)))
+        unsubscribePasteboard();
+}
+
+/* Every copy in the session is broadcast, apps that don't show paste
+ * UI shouldn't be woken up for them
+ */
+void cuc::Hub::subscribePasteboard()
+{
+    if (d->pasteboardSubscribed)
+        return;
+
+    TRACE() << Q_FUNC_INFO;
+    d->pasteboardSubscribed = true;
+    QObject::connect(d->service, &com::ubuntu::content::dbus::Service::PasteboardUpdated,
+            this, &cuc::Hub::onPasteboardUpdated);
+    requestPasteFormats();
+}
+
+void cuc::Hub::unsubscribePasteboard()
+{
+    if (not d->pasteboardSubscribed)
+        return;
+
+    TRACE() << Q_FUNC_INFO;
+    d->pasteboardSubscribed = false;
+    QObject::disconnect(d->service, &com::ubuntu::content::dbus::Service::PasteboardUpdated,
+            this, &cuc::Hub::onPasteboardUpdated);
+    if (d->legacyPasteboard) {
+        d->legacyPasteboard = false;
+        QObject::disconnect(d->service, &com::ubuntu::content::dbus::Service::PasteFormatsChanged,
+                this, &cuc::Hub::onPasteFormatsChanged);
+        QObject::disconnect(d->service, SIGNAL(PasteboardChanged()),
+                this, SIGNAL(pasteboardChanged()));
+    }
+}
+
 void cuc::Hub::requestPasteFormats()
 {
-    auto reply = d->service->PasteFormats();
+    auto reply = d->service->PasteboardState();
 
     auto replyWatcher = new QDBusPendingCallWatcher(reply, this);
     connect(replyWatcher, &QDBusPendingCallWatcher::finished,
             this, [this, replyWatcher]() {
-        QDBusPendingReply<QStringList> reply = *replyWatcher;
+        QDBusPendingReply<QVariantMap> reply = *replyWatcher;
         replyWatcher->deleteLater();
-        if (!reply.isError()) {
-            d->pasteFormats = reply.value();
-            Q_EMIT(pasteFormatsChanged());
+        if (not d->pasteboardSubscribed)
+            return;
+
+        if (reply.isError()) {
+            /* Older services only send the full signals */
+            if (reply.error().type() == QDBusError::UnknownMethod && not d->legacyPasteboard) {
+                d->legacyPasteboard = true;
+                QObject::connect(d->service, &com::ubuntu::content::dbus::Service::PasteFormatsChanged,
+                        this, &cuc::Hub::onPasteFormatsChanged);
+                QObject::connect(d->service, SIGNAL(PasteboardChanged()),
+                        this, SIGNAL(pasteboardChanged()));
+                auto formats = d->service->PasteFormats();
+                formats.waitForFinished();
+                if (not formats.isError())
+                    onPasteFormatsChanged(formats.value());
+            }
+            return;
         }
+
+        /* Taken as is, the service may have restarted */
+        d->pasteGeneration = reply.value().value(QStringLiteral("generation")).toULongLong();
+        d->pasteFormats = reply.value().value(QStringLiteral("formats")).toStringList();
+        Q_EMIT(pasteFormatsChanged());
     });
 }
 
+void cuc::Hub::onPasteboardUpdated(qulonglong generation, const QStringList& added, const QStringList& removed)
+{
+    TRACE() << Q_FUNC_INFO << generation << added << removed;
+
+    /* Missed an update, start over from the full set */
+    if (generation != d->pasteGeneration + 1) {
+        requestPasteFormats();
+        Q_EMIT(pasteboardChanged());
+        return;
+    }
+
+    d->pasteGeneration = generation;
+    Q_FOREACH (const QString& t, removed)
+        d->pasteFormats.removeOne(t);
+    Q_FOREACH (const QString& t, added) {
+        if (not d->pasteFormats.contains(t))
+            d->pasteFormats << t;
+    }
+
+    Q_EMIT(pasteboardChanged());
+    if (not added.isEmpty() || not removed.isEmpty())
+        Q_EMIT(pasteFormatsChanged());
+}
+
 void cuc::Hub::onPasteFormatsChanged(const QStringList &formats)
 {
     TRACE() << Q_FUNC_INFO;
@@ -145,7 +377,12 @@ bool cuc::Hub::eventFilter(QObject *obj, QEvent *event)
 
 void cuc::Hub::register_import_export_handler(cuc::ImportExportHandler* handler)
 {
-    TRACE() << Q_FUNC_INFO;
+    register_import_export_handler(handler, cuc::Transfer::copy);
+}
+
+void cuc::Hub::register_import_export_handler(cuc::ImportExportHandler* handler, cuc::Transfer::ItemMode mode)
+{
+    TRACE() << Q_FUNC_INFO << mode;
     QString id = app_id();
 
     if (id.isEmpty())
@@ -166,9 +403,23 @@ void cuc::Hub::register_import_export_handler(cuc::ImportExportHandler* handler)
         return;
     }
 
-    d->service->RegisterImportExportHandler(
+    QStringList capabilities{HANDLER_CAPABILITY_SNAPSHOT};
+    if (mode == cuc::Transfer::handoff)
+        capabilities << HANDLER_CAPABILITY_ITEM_FD;
+
+    /* Older services don't know the capability variant, fall back */
+    auto reply = d->service->RegisterImportExportHandlerWithCapabilities(
                 id,
-                QDBusObjectPath{handler_path(id)});
+                QDBusObjectPath{handler_path(id)},
+                capabilities);
+
+    auto replyWatcher = new QDBusPendingCallWatcher(reply, this);
+    connect(replyWatcher, &QDBusPendingCallWatcher::finished,
+            this, [this, replyWatcher, id]() {
+        replyWatcher->deleteLater();
+        if (replyWatcher->isError() && replyWatcher->error().type() == QDBusError::UnknownMethod)
+            d->service->RegisterImportExportHandler(id, QDBusObjectPath{handler_path(id)});
+    });
 }
 
 const cuc::Store* cuc::Hub::store_for_scope_and_type(cuc::Scope scope, cuc::Type type)
@@ -197,7 +448,7 @@ const cuc::Store* cuc::Hub::store_for_scope_and_type(cuc::Scope scope, cuc::Type
 cuc::Peer cuc::Hub::default_source_for_type(cuc::Type t)
 {
     TRACE() << Q_FUNC_INFO;
-    auto reply = d->service->DefaultSourceForType(t.id());
+    auto reply = d->bulk()->DefaultSourceForType(t.id());
     reply.waitForFinished();
 
     if (reply.isError())
@@ -211,7 +462,7 @@ QVector<cuc::Peer> cuc::Hub::known_sources_for_type(cuc::Type t)
 {
     QVector<cuc::Peer> result;
 
-    auto reply = d->service->KnownSourcesForType(t.id());
+    auto reply = d->bulk()->KnownSourcesForType(t.id());
     reply.waitForFinished();
 
     if (reply.isError())
@@ -233,7 +484,7 @@ QVector<cuc::Peer> cuc::Hub::known_destinations_for_type(cuc::Type t)
 {
     QVector<cuc::Peer> result;
 
-    auto reply = d->service->KnownDestinationsForType(t.id());
+    auto reply = d->bulk()->KnownDestinationsForType(t.id());
     reply.waitForFinished();
 
     if (reply.isError())
@@ -255,7 +506,7 @@ QVector<cuc::Peer> cuc::Hub::known_shares_for_type(cuc::Type t)
 {
     QVector<cuc::Peer> result;
 
-    auto reply = d->service->KnownSharesForType(t.id());
+    auto reply = d->bulk()->KnownSharesForType(t.id());
     reply.waitForFinished();
 
     if (reply.isError())
@@ -366,7 +617,7 @@ bool cuc::Hub::has_pending(QString peer_id)
 
 cuc::Peer cuc::Hub::peer_for_app_id(QString app_id)
 {
-    auto reply = d->service->PeerForId(app_id);
+    auto reply = d->bulk()->PeerForId(app_id);
     reply.waitForFinished();
 
     if (reply.isError())
@@ -382,7 +633,9 @@ QDBusPendingCall cuc::Hub::createPaste(const QString &surfaceId, const QMimeData
     QString appId = app_id();
     TRACE() << Q_FUNC_INFO << appId;
 
-    auto serializedMimeData = serializeMimeData(mimeData);
+    auto serializedMimeData = d->supports_v2()
+        ? serializeMimeDataV2(mimeData, d->supports_compression())
+        : serializeMimeData(mimeData);
     if (serializedMimeData.isEmpty()) {
         return QDBusPendingCall::fromCompletedCall(
                 QDBusMessage::createError("Data serialization failed","Could not serialize mimeData"));
@@ -401,13 +654,18 @@ bool cuc::Hub::createPasteSync(const QString &surfaceId, const QMimeData& data)
 QDBusPendingCall cuc::Hub::requestLatestPaste(const QString &surfaceId)
 {
     TRACE() << Q_FUNC_INFO;
-    return d->service->GetLatestPasteData(surfaceId);
+    if (d->supports_v2())
+        return d->bulk()->GetLatestPasteDataWithCapabilities(surfaceId, d->reader_capabilities());
+    return d->bulk()->GetLatestPasteData(surfaceId);
 }
 
 QDBusPendingCall cuc::Hub::requestPasteById(const QString &surfaceId, int pasteId)
 {
     TRACE() << Q_FUNC_INFO;
-    return d->service->GetPasteData(surfaceId, QString::number(pasteId));
+    if (d->supports_v2())
+        return d->bulk()->GetPasteDataWithCapabilities(surfaceId, QString::number(pasteId),
+                                                       d->reader_capabilities());
+    return d->bulk()->GetPasteData(surfaceId, QString::number(pasteId));
 }
 
 QMimeData* cuc::Hub::paste(QDBusPendingCall pendingCall)
@@ -434,5 +692,13 @@ QMimeData* cuc::Hub::pasteById(const QString &surfaceId, int pasteId)
 
 QStringList cuc::Hub::pasteFormats() {
     TRACE() << Q_FUNC_INFO;
+
+    /* Nothing keeps the list current without a subscription */
+    if (not d->pasteboardSubscribed) {
+        auto reply = d->bulk()->PasteFormats();
+        reply.waitForFinished();
+        if (not reply.isError())
+            d->pasteFormats = reply.value();
+    }
     return d->pasteFormats;
 }
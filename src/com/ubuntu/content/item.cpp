@@ -29,14 +29,16 @@ struct cuc::Item::Private
     QString name;
     QByteArray stream;
     QString streamType;
+    QString mimeType;
 
+    /* mimeType is derived from the content, it doesn't make items differ */
     bool operator==(const Private& rhs) const
     {
         return url == rhs.url && name == rhs.name && stream == rhs.stream && streamType == rhs.streamType;
     }
 };
 
-cuc::Item::Item(const QUrl& url, QObject* parent) : QObject(parent), d{new cuc::Item::Private{url, QString(), QByteArray(), QString()}}
+cuc::Item::Item(const QUrl& url, QObject* parent) : QObject(parent), d{new cuc::Item::Private{url, QString(), QByteArray(), QString(), QString()}}
 {
 }
 
@@ -124,10 +126,23 @@ void cuc::Item::setStreamType(const QString& newStreamType) const
         d->streamType = newStreamType;
 }
 
+/* Detected by the service when the item is charged, empty until then */
+const QString& cuc::Item::mimeType() const
+{
+    return d->mimeType;
+}
+
+void cuc::Item::setMimeType(const QString& newMimeType) const
+{
+    if (newMimeType != d->mimeType)
+        d->mimeType = newMimeType;
+}
+
 QDBusArgument &operator<<(QDBusArgument &argument, const cuc::Item& item)
 {
     argument.beginStructure();
     argument << item.streamType() << item.stream() << item.name() << item.url().toDisplayString();
+    argument << item.mimeType();
     argument.endStructure();
     return argument;
 }
@@ -140,13 +155,19 @@ const QDBusArgument &operator>>(const QDBusArgument &argument, cuc::Item &item)
     QByteArray stream;
     QString streamType;
 
+    QString mimeType;
+
     argument.beginStructure();
     argument >> streamType >> stream >> name >> urlString;
+    /* Items sent by older peers stop here */
+    if (not argument.atEnd())
+        argument >> mimeType;
     argument.endStructure();
 
     item = cuc::Item{QUrl(urlString)};
     item.setName(name);
     item.setStream(stream);
     item.setStreamType(streamType);
+    item.setMimeType(mimeType);
     return argument;
 }
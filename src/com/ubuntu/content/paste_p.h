@@ -19,6 +19,7 @@
 #define COM_UBUNTU_CONTENT_PASTE_P_H_
 
 #include "common.h"
+#include "proxy_pool.h"
 #include "ContentPasteInterface.h"
 
 #include <com/ubuntu/content/item.h>
@@ -46,11 +47,8 @@ class Paste::Private : public QObject
 
     Private(const QDBusObjectPath& paste, QObject* parent)
             : QObject(parent),
-              remote_paste(
-                  new com::ubuntu::content::dbus::Paste(
-                      HUB_SERVICE_NAME,
-                      paste.path(),
-                      QDBusConnection::sessionBus(), this))
+              proxy(detail::ProxyPool<com::ubuntu::content::dbus::Paste>::acquire(paste.path())),
+              remote_paste(proxy.data())
     {
     }
 
@@ -91,6 +89,8 @@ class Paste::Private : public QObject
         return static_cast<QString>(reply.value());
     }
 
+    /* Shared with every other Private for the same object */
+    QSharedPointer<com::ubuntu::content::dbus::Paste> proxy;
     com::ubuntu::content::dbus::Paste* remote_paste;
 };
 }
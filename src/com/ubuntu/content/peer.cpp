@@ -19,6 +19,7 @@
 #include <com/ubuntu/content/peer.h>
 #include <QMetaType>
 #include "debug.h"
+#include "trace.h"
 #include "utils.cpp"
 
 namespace cuc = com::ubuntu::content;
@@ -28,13 +29,10 @@ struct cuc::Peer::Private
 {
     Private (QString id, bool isDefaultPeer) : id(id), isDefaultPeer(isDefaultPeer)
     {
-        TRACE() << Q_FUNC_INFO << id;
         if (not id.isEmpty()) {
-            TRACE() << Q_FUNC_INFO << "Getting appinfo for" << id;
-
             auto info = info_for_app_id(id);
-            TRACE() << Q_FUNC_INFO << "name:" << info["name"];
-            TRACE() << Q_FUNC_INFO << "iconPath:" << info["iconPath"];
+            TRACE_EVENT(TracePeer, TraceDebug, "%s name=%s icon=%s", qPrintable(id),
+                        qPrintable(info["name"]), qPrintable(info["iconPath"]));
             name = info["name"];
             if (QFile::exists(info["iconPath"])) {
                 QFile iconFile(info["iconPath"]);
@@ -48,7 +46,7 @@ struct cuc::Peer::Private
 
     Private (QString id, QString name, QByteArray iconData, QString iconName, bool isDefaultPeer) : id(id), name(name), iconData(iconData), iconName(iconName), isDefaultPeer(isDefaultPeer)
     {
-        TRACE() << Q_FUNC_INFO << id;
+        TRACE_EVENT(TracePeer, TraceDebug, "%s", qPrintable(id));
     }
 
     QString id;
@@ -66,12 +64,10 @@ const cuc::Peer& cuc::Peer::unknown()
 
 cuc::Peer::Peer(const QString& id, bool isDefaultPeer, QObject* parent) : QObject(parent), d(new cuc::Peer::Private{id, isDefaultPeer})
 {
-    TRACE() << Q_FUNC_INFO;
 }
 
 cuc::Peer::Peer(const QString& id, const QString& name, QByteArray& iconData, const QString& iconName, bool isDefaultPeer, QObject* parent) : QObject(parent), d(new cuc::Peer::Private{id, name, iconData, iconName, isDefaultPeer})
 {
-    TRACE() << Q_FUNC_INFO;
 }
 
 cuc::Peer::Peer(const cuc::Peer& rhs) : QObject(rhs.parent()), d(rhs.d)
@@ -149,7 +145,6 @@ QDBusArgument &operator<<(QDBusArgument &argument, const cuc::Peer& peer)
 
 const QDBusArgument &operator>>(const QDBusArgument &argument, cuc::Peer &peer)
 {
-    TRACE() << Q_FUNC_INFO;
     QString id;
     QString name;
     QByteArray ic;
@@ -159,6 +154,7 @@ const QDBusArgument &operator>>(const QDBusArgument &argument, cuc::Peer &peer)
     argument.beginStructure();
     argument >> id >> name >> ic >> iconName >> isDefaultPeer;
     argument.endStructure();
+    TRACE_EVENT(TracePeer, TraceDebug, "%s default=%d icon=%d bytes", qPrintable(id), isDefaultPeer, ic.size());
 
     peer = cuc::Peer{id, name, ic, iconName, isDefaultPeer};
     return argument;
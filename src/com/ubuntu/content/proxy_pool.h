@@ -0,0 +1,100 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COM_UBUNTU_CONTENT_PROXY_POOL_H_
+#define COM_UBUNTU_CONTENT_PROXY_POOL_H_
+
+#include "common.h"
+
+#include <QHash>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QWeakPointer>
+#include <QtDBus/QDBusConnection>
+
+namespace com
+{
+namespace ubuntu
+{
+namespace content
+{
+namespace detail
+{
+/* Shares generated D-Bus proxies between everything looking at the
+ * same object.  Each proxy registers its own signal match rules with
+ * the bus daemon, with the pool that happens once per connection and
+ * object path, and the rules go away with the last user.
+ */
+template<typename Interface>
+class ProxyPool
+{
+  public:
+    static QSharedPointer<Interface> acquire(const QString& path,
+                                             const QDBusConnection& connection = QDBusConnection::sessionBus())
+    {
+        const QString key = connection.name() + QLatin1Char(' ') + path;
+
+        QMutexLocker locker(&mutex());
+        auto& pool = proxies();
+        QSharedPointer<Interface> proxy = pool.value(key).toStrongRef();
+        if (proxy)
+            return proxy;
+
+        prune(pool);
+        proxy = QSharedPointer<Interface>(new Interface(HUB_SERVICE_NAME, path, connection, nullptr),
+                                          &QObject::deleteLater);
+        pool.insert(key, proxy.toWeakRef());
+        return proxy;
+    }
+
+    /* Number of proxies currently in use */
+    static int size()
+    {
+        QMutexLocker locker(&mutex());
+        prune(proxies());
+        return proxies().size();
+    }
+
+  private:
+    static void prune(QHash<QString, QWeakPointer<Interface>>& pool)
+    {
+        for (auto it = pool.begin(); it != pool.end();)
+        {
+            if (it.value().isNull())
+                it = pool.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    static QHash<QString, QWeakPointer<Interface>>& proxies()
+    {
+        static QHash<QString, QWeakPointer<Interface>> pool;
+        return pool;
+    }
+
+    static QMutex& mutex()
+    {
+        static QMutex m;
+        return m;
+    }
+};
+}
+}
+}
+}
+
+#endif // COM_UBUNTU_CONTENT_PROXY_POOL_H_
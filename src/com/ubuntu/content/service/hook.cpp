@@ -17,30 +17,163 @@
  */
 
 #include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QFile>
 #include <QDir>
+#include <QSaveFile>
+#include <QSet>
 #include <QStandardPaths>
 #include <QTimer>
 #include <QVector>
+#include <QtConcurrent/QtConcurrentMap>
 #include <com/ubuntu/content/peer.h>
 
 #include "debug.h"
+#include "detail/type_table.h"
 #include "hook.h"
 
 namespace cucd = com::ubuntu::content::detail;
 
+// Begin anonymous namespace
+namespace {
+
+const int manifestVersion = 1;
+
+/* Below this many files parsing on a thread pool doesn't pay off */
+const int parallelParseThreshold = 8;
+
+QVector<QDir> default_content_dirs()
+{
+    QVector<QDir> contentDirs;
+
+    contentDirs.append(QDir(
+        QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation)
+        + QString("/")
+        + QString("content-hub")));
+
+    contentDirs.append(QDir("/usr/share/content-hub/peers/"));
+    contentDirs.append(QDir("/usr/share/local/content-hub/peers/"));
+
+    return contentDirs;
+}
+
+QString default_manifest_path()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)
+        + QString("/content-hub/peer-hook-manifest.json");
+}
+
+/* Fills files with what the last run recorded, keyed by absolute path.
+ * Returns false if there is no usable manifest, an empty one is fine.
+ */
+bool load_manifest(const QString& path, QJsonObject& files)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QJsonParseError e;
+    QJsonDocument doc = QJsonDocument::fromJson(file.readAll(), &e);
+    if (e.error != QJsonParseError::NoError || not doc.isObject())
+    {
+        qWarning() << "Ignoring invalid peer manifest" << path << e.errorString();
+        return false;
+    }
+
+    QJsonObject obj = doc.object();
+    if (obj.value("version").toInt() != manifestVersion || not obj.value("files").isObject())
+        return false;
+
+    files = obj.value("files").toObject();
+    return true;
+}
+
+bool save_manifest(const QString& path, const QJsonObject& files)
+{
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    QJsonObject obj;
+    obj.insert("version", manifestVersion);
+    obj.insert("files", files);
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        qWarning() << "Failed to write peer manifest" << path;
+        return false;
+    }
+    file.write(QJsonDocument(obj).toJson(QJsonDocument::Compact));
+    return file.commit();
+}
+
+QString file_hash(const QFileInfo& info)
+{
+    QFile file(info.absoluteFilePath());
+    if (!file.open(QIODevice::ReadOnly))
+        return QString();
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(&file);
+    return QString::fromLatin1(hash.result().toHex());
+}
+
+QJsonObject manifest_entry(const QFileInfo& info, const QString& hash)
+{
+    QJsonObject entry;
+    entry.insert("mtime", double(info.lastModified().toMSecsSinceEpoch()));
+    entry.insert("size", double(info.size()));
+    entry.insert("hash", hash);
+    return entry;
+}
+
+/* Peer files list types either as an array or as a single string */
+QStringList string_list(const QJsonValue& value)
+{
+    QStringList result;
+    if (value.isString())
+        result << value.toString();
+    Q_FOREACH(const QJsonValue& v, value.toArray())
+        result << v.toString();
+    return result;
+}
+
+bool manifest_entry_matches(const QJsonObject& entry, const QFileInfo& info)
+{
+    return entry.value("mtime").toDouble() == double(info.lastModified().toMSecsSinceEpoch())
+        && entry.value("size").toDouble() == double(info.size());
+}
+
+} // End anonymous namespace
+
 cucd::Hook::Hook(QObject *parent) :
     QObject(parent),
-    registry(new Registry())
+    registry(new Registry()),
+    contentDirs(default_content_dirs()),
+    manifestPath(default_manifest_path())
 {
     QTimer::singleShot(200, this, SLOT(run()));
 }
 
 cucd::Hook::Hook(com::ubuntu::content::detail::PeerRegistry *registry, QObject *parent) :
     QObject(parent),
-    registry(registry)
+    registry(registry),
+    contentDirs(default_content_dirs()),
+    manifestPath(default_manifest_path())
+{
+}
+
+cucd::Hook::Hook(com::ubuntu::content::detail::PeerRegistry *registry,
+                 const QVector<QDir>& contentDirs,
+                 const QString& manifestPath,
+                 QObject *parent) :
+    QObject(parent),
+    registry(registry),
+    contentDirs(contentDirs),
+    manifestPath(manifestPath)
 {
 }
 
@@ -51,6 +184,16 @@ cucd::Hook::~Hook()
 }
 
 void cucd::Hook::run()
+{
+    TRACE() << Q_FUNC_INFO;
+
+    update_peers();
+
+    deleteLater();
+    QCoreApplication::instance()->quit();
+}
+
+bool cucd::Hook::update_peers()
 {
     TRACE() << Q_FUNC_INFO;
     /* Looks for files in ${HOME}/.local/share/content-hub/${id} installed
@@ -63,19 +206,113 @@ void cucd::Hook::run()
      *     ]
      * }
      *
-     * The hook also iterates known peers and removes them if there is
-     * no JSON file installed in this path.
+     * The hook keeps a manifest of the files it has applied, with their
+     * mtime, size and hash, so that only added, changed or removed files
+     * touch the registry.  Without a manifest all known peers are checked
+     * and the ones with no JSON file installed in this path are removed.
      */
 
-    QVector<QDir> contentDirs;
+    bool peerDirsExist = false;
+    QFileInfoList files;
 
-    contentDirs.append(QDir(
-        QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation)
-        + QString("/")
-        + QString("content-hub")));
-    
-    contentDirs.append(QDir("/usr/share/content-hub/peers/"));
-    contentDirs.append(QDir("/usr/share/local/content-hub/peers/"));
+    Q_FOREACH(QDir contentDir, contentDirs)
+    {
+        if (contentDir.exists())
+        {
+            peerDirsExist = true;
+            files << contentDir.entryInfoList(QDir::Files);
+        }
+    }
+
+    QJsonObject manifest;
+    QJsonObject applied;
+    /* Not recorded, so that the next run tries them again */
+    QSet<QString> unparsed;
+
+    /* All registry changes of this run are written out in one batch */
+    registry->begin_transaction();
+
+    if (not load_manifest(manifestPath, manifest))
+    {
+        TRACE() << Q_FUNC_INFO << "No manifest, rescanning all peers";
+        rescan_known_peers(files);
+
+        unparsed = add_peers(files);
+        Q_FOREACH(QFileInfo f, files)
+            applied.insert(f.absoluteFilePath(), manifest_entry(f, file_hash(f)));
+    }
+    else
+    {
+        /* Peers whose declarations changed or went away, their old
+         * registrations are dropped before the current files are applied.
+         */
+        QSet<QString> stalePeers;
+        QSet<QString> dirtyPeers;
+
+        Q_FOREACH(QFileInfo f, files)
+        {
+            const QString path = f.absoluteFilePath();
+            const QJsonObject entry = manifest.take(path).toObject();
+
+            if (!entry.isEmpty() && manifest_entry_matches(entry, f))
+            {
+                applied.insert(path, entry);
+                continue;
+            }
+
+            const QString hash = file_hash(f);
+            applied.insert(path, manifest_entry(f, hash));
+            if (!entry.isEmpty() && entry.value("hash").toString() == hash)
+                continue;
+
+            TRACE() << Q_FUNC_INFO << (entry.isEmpty() ? "Added:" : "Changed:") << path;
+            if (!entry.isEmpty())
+                stalePeers.insert(f.fileName());
+            dirtyPeers.insert(f.fileName());
+        }
+
+        /* Whatever is left in the manifest is no longer installed */
+        Q_FOREACH(QString path, manifest.keys())
+        {
+            TRACE() << Q_FUNC_INFO << "Removed:" << path;
+            stalePeers.insert(QFileInfo(path).fileName());
+            dirtyPeers.insert(QFileInfo(path).fileName());
+        }
+
+        Q_FOREACH(QString p, stalePeers)
+            registry->remove_peer(com::ubuntu::content::Peer{p});
+
+        /* The same peer may be declared in more than one directory */
+        QFileInfoList changed;
+        Q_FOREACH(QFileInfo f, files)
+        {
+            if (dirtyPeers.contains(f.fileName()))
+                changed.append(f);
+        }
+        unparsed = add_peers(changed);
+    }
+
+    Q_FOREACH(QString path, unparsed)
+        applied.remove(path);
+
+    if (registry->commit_transaction())
+        save_manifest(manifestPath, applied);
+    else
+        qWarning() << "Failed to update the peer registry, keeping the previous manifest";
+
+    if(!peerDirsExist)
+        return return_error("No peer setting directories exist.");
+
+    return true;
+}
+
+void cucd::Hook::rescan_known_peers(const QFileInfoList& files)
+{
+    TRACE() << Q_FUNC_INFO;
+
+    QSet<QString> installed;
+    Q_FOREACH(QFileInfo f, files)
+        installed.insert(f.fileName());
 
     QStringList all_peers;
     registry->enumerate_known_peers([&all_peers](const com::ubuntu::content::Peer& peer)
@@ -86,68 +323,106 @@ void cucd::Hook::run()
     Q_FOREACH(QString p, all_peers)
     {
         TRACE() << Q_FUNC_INFO << "Looking for" << p;
+        if (installed.contains(p))
+            continue;
+
         bool foundPeer = false;
-        Q_FOREACH(QDir contentDir, contentDirs)
+        Q_FOREACH(QString name, installed)
         {
-            QStringList pp = contentDir.entryList(QStringList("*"+ p));
-            if (!pp.isEmpty()) {
+            if (name.endsWith(p))
+            {
                 foundPeer = true;
+                break;
             }
         }
-        if(!foundPeer) {
+        if (!foundPeer)
             registry->remove_peer(com::ubuntu::content::Peer{p});
-        }
     }
+}
 
-    bool peerDirsExist = false;
-
-    Q_FOREACH(QDir contentDir, contentDirs)
-    {
+bool cucd::Hook::add_peer(QFileInfo result)
+{
+    TRACE() << Q_FUNC_INFO << "Hook:" << result.filePath();
 
-        if (contentDir.exists()) 
-        {
-            peerDirsExist = true;
+    return install_peer(parse_peer(result));
+}
 
-            Q_FOREACH(QFileInfo f, contentDir.entryInfoList(QDir::Files))
-                add_peer(f);
-        }
+QSet<QString> cucd::Hook::add_peers(const QFileInfoList& files)
+{
+    TRACE() << Q_FUNC_INFO << files.count();
 
+    QVector<cucd::PeerDeclaration> peers;
+    if (files.count() >= parallelParseThreshold)
+    {
+        /* Parsing is independent per file, only installing touches
+         * the registry and that stays on this thread.
+         */
+        peers = QtConcurrent::blockingMapped<QVector<cucd::PeerDeclaration>>(files, &cucd::Hook::parse_peer);
+    }
+    else
+    {
+        Q_FOREACH(QFileInfo f, files)
+            peers.append(parse_peer(f));
     }
 
-    if(!peerDirsExist)
-        return_error("No peer setting directories exist.");
-
-    deleteLater();
-    QCoreApplication::instance()->quit();
+    QSet<QString> unparsed;
+    Q_FOREACH(const cucd::PeerDeclaration& peer, peers)
+    {
+        if (not peer.valid)
+            unparsed.insert(peer.path);
+        install_peer(peer);
+    }
+    return unparsed;
 }
 
-bool cucd::Hook::add_peer(QFileInfo result)
+cucd::PeerDeclaration cucd::Hook::parse_peer(const QFileInfo& result)
 {
-    TRACE() << Q_FUNC_INFO << "Hook:" << result.filePath();
-
-    QStringList knownTypes;
-    knownTypes << "all" << "pictures" << "music" << "contacts" << "documents" << "videos" << "links" << "ebooks" << "text" << "events";
-    QString app_id = result.fileName();
-    auto peer = cuc::Peer(app_id);
+    cucd::PeerDeclaration peer;
+    peer.app_id = result.fileName();
+    peer.path = result.absoluteFilePath();
 
     QFile contentJson(result.absoluteFilePath());
     if (!contentJson.open(QIODevice::ReadOnly | QIODevice::Text))
-        return_error("couldn't open " + result.absoluteFilePath());
+    {
+        peer.error = "couldn't open " + result.absoluteFilePath();
+        return peer;
+    }
 
-    QJsonParseError *e = new QJsonParseError();
-    QJsonDocument contentDoc = QJsonDocument::fromJson(contentJson.readAll(), e);
+    QJsonParseError e;
+    QJsonDocument contentDoc = QJsonDocument::fromJson(contentJson.readAll(), &e);
 
-    if (e->error != 0)
-        return return_error(e->errorString());
+    if (e.error != QJsonParseError::NoError)
+    {
+        peer.error = e.errorString();
+        return peer;
+    }
 
     if (not contentDoc.isObject())
-        return return_error("invalid JSON object");
+    {
+        peer.error = "invalid JSON object";
+        return peer;
+    }
 
     QJsonObject contentObj = contentDoc.object();
-    QVariant sources = contentObj.toVariantMap()["source"];
-    Q_FOREACH(QString k, sources.toStringList())
+    peer.sources = string_list(contentObj.value("source"));
+    peer.destinations = string_list(contentObj.value("destination"));
+    peer.shares = string_list(contentObj.value("share"));
+    peer.valid = true;
+    return peer;
+}
+
+bool cucd::Hook::install_peer(const cucd::PeerDeclaration& declaration)
+{
+    TRACE() << Q_FUNC_INFO << declaration.app_id;
+
+    if (not declaration.valid)
+        return return_error(declaration.error);
+
+    auto peer = cuc::Peer(declaration.app_id);
+
+    Q_FOREACH(QString k, declaration.sources)
     {
-        if (knownTypes.contains(k))
+        if (cucd::is_installable_type(cucd::find_type(k)))
         {
             if (registry->install_source_for_type(cuc::Type{k}, peer))
                 TRACE() << "Installed source:" << peer.id() << "for type:" << k;
@@ -156,10 +431,9 @@ bool cucd::Hook::add_peer(QFileInfo result)
             qWarning() << "Failed to install" << peer.id() << "unknown type:" << k;
     }
 
-    QVariant dests = contentObj.toVariantMap()["destination"];
-    Q_FOREACH(QString k, dests.toStringList())
+    Q_FOREACH(QString k, declaration.destinations)
     {
-        if (knownTypes.contains(k))
+        if (cucd::is_installable_type(cucd::find_type(k)))
         {
             if (registry->install_destination_for_type(cuc::Type{k}, peer))
                 TRACE() << "Installed destination:" << peer.id() << "for type:" << k;
@@ -168,10 +442,9 @@ bool cucd::Hook::add_peer(QFileInfo result)
             qWarning() << "Failed to install" << peer.id() << "unknown type:" << k;
     }
 
-    QVariant shares = contentObj.toVariantMap()["share"];
-    Q_FOREACH(QString k, shares.toStringList())
+    Q_FOREACH(QString k, declaration.shares)
     {
-        if (knownTypes.contains(k))
+        if (cucd::is_installable_type(cucd::find_type(k)))
         {
             if (registry->install_share_for_type(cuc::Type{k}, peer))
                 TRACE() << "Installed share:" << peer.id() << "for type:" << k;
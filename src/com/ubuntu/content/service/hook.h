@@ -19,8 +19,12 @@
 #ifndef HOOK_H
 #define HOOK_H
 
+#include <QDir>
 #include <QObject>
+#include <QSet>
 #include <QFileInfo>
+#include <QStringList>
+#include <QVector>
 #include <com/ubuntu/content/peer.h>
 
 #include "registry.h"
@@ -33,22 +37,48 @@ namespace content
 {
 namespace detail
 {
+/* A parsed peer declaration file */
+struct PeerDeclaration
+{
+    QString app_id;
+    QString path;
+    QStringList sources;
+    QStringList destinations;
+    QStringList shares;
+    bool valid = false;
+    QString error;
+};
+
 class Hook : public QObject
 {
     Q_OBJECT
 public:
     explicit Hook(QObject *parent = 0);
     Hook(com::ubuntu::content::detail::PeerRegistry *registry, QObject *parent = 0);
+    Hook(com::ubuntu::content::detail::PeerRegistry *registry,
+         const QVector<QDir>& contentDirs,
+         const QString& manifestPath,
+         QObject *parent = 0);
     ~Hook();
 
 public Q_SLOTS:
     bool return_error(QString err = "");
     void run();
+    bool update_peers();
     bool add_peer(QFileInfo);
 
+public:
+    static PeerDeclaration parse_peer(const QFileInfo&);
+    bool install_peer(const PeerDeclaration&);
+
 private:
+    /* Returns the paths of the files that couldn't be parsed */
+    QSet<QString> add_peers(const QFileInfoList& files);
+    void rescan_known_peers(const QFileInfoList& files);
     com::ubuntu::content::detail::PeerRegistry* registry;
-    
+    QVector<QDir> contentDirs;
+    QString manifestPath;
+
 };
 }
 }
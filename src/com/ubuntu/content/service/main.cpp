@@ -17,13 +17,16 @@
  */
 
 #include <QCoreApplication>
+#include <QElapsedTimer>
 #include <QProcessEnvironment>
 #include <csignal>
+#include <unistd.h>
 #include <com/ubuntu/content/item.h>
 
 #include "detail/app_manager.h"
 #include "debug.h"
 #include "common.h"
+#include "trace.h"
 #include "registry.h"
 #include "detail/i18n.h"
 #include "detail/service.h"
@@ -40,11 +43,29 @@ namespace {
         TRACE() << Q_FUNC_INFO << sig;
         QCoreApplication::instance()->quit();
     }
+
+    void dump_trace(int sig)
+    {
+        Q_UNUSED(sig);
+        trace_dump(STDERR_FILENO);
+    }
+
+    /* Logs how long a startup phase took and restarts the timer */
+    void startup_phase(QElapsedTimer& timer, const char* phase)
+    {
+        TRACE() << "Startup phase" << phase << "took" << timer.nsecsElapsed() / 1000 << "us";
+        timer.restart();
+    }
 }
 
 int main(int argc, char** argv)
 {
     int ret = 0;
+    QElapsedTimer total;
+    total.start();
+    QElapsedTimer phase;
+    phase.start();
+
     QCoreApplication *app = new QCoreApplication(argc, argv);
 
     cucd::initTr(I18N_DOMAIN, NULL);
@@ -58,21 +79,24 @@ int main(int argc, char** argv)
         if (isOk)
             setLoggingLevel(value);
     }
+    trace_init();
+    startup_phase(phase, "init");
 
     auto connection = QDBusConnection::sessionBus();
+    startup_phase(phase, "bus connection");
 
+    /* Constructing these must stay cheap, anything expensive
+     * (default source sync, focus tracking) happens on first use.
+     */
     auto registry = QSharedPointer<cucd::PeerRegistry>(new Registry());
-
     auto app_manager = QSharedPointer<cuca::ApplicationManager>(new cucd::AppManager());
-
     auto server = new cucd::Service(connection, registry, app_manager, app->parent());
     new ServiceAdaptor(server);
+    startup_phase(phase, "service objects");
 
-    if (not connection.registerService(HUB_SERVICE_NAME))
-    {
-        qWarning() << "Failed to register" << HUB_SERVICE_NAME;
-        ret = 1;
-    }
+    /* The object has to be exported before the name is claimed,
+     * otherwise activating callers get UnknownObject errors.
+     */
     if (not connection.registerObject(HUB_SERVICE_PATH,
                                       server,
                                       QDBusConnection::ExportAdaptors))
@@ -80,11 +104,23 @@ int main(int argc, char** argv)
         qWarning() << "Failed to register object on" << HUB_SERVICE_PATH;
         ret = 1;
     }
+    if (ret == 0 && not connection.registerService(HUB_SERVICE_NAME))
+    {
+        qWarning() << "Failed to register" << HUB_SERVICE_NAME;
+        ret = 1;
+    }
+    startup_phase(phase, "bus name");
+
+    /* Pick up where an idle exit left off */
+    if (ret == 0 && server->restore_snapshot(cucd::Service::snapshot_path()))
+        startup_phase(phase, "snapshot restore");
+    TRACE() << "Startup took" << total.nsecsElapsed() / 1000 << "us";
 
     std::signal(SIGTERM, shutdown);
     std::signal(SIGHUP, shutdown);
     std::signal(SIGKILL, shutdown);
     std::signal(SIGINT, shutdown);
+    std::signal(SIGUSR1, dump_trace);
 
     if (ret == 1)
         app->exit(ret);
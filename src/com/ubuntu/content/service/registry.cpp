@@ -17,11 +17,15 @@
  */
 
 #include "debug.h"
+#include "detail/mime_classifier.h"
+#include "detail/type_table.h"
 #include "registry.h"
+#include "trace.h"
 #include "utils.cpp"
 #include <QMap>
 #include <QVector>
 #include <com/ubuntu/content/type.h>
+#include <gio/gio.h>
 #include <gio/gdesktopappinfo.h>
 #include <libertine.h>
 #include <ubuntu-app-launch.h>
@@ -29,21 +33,19 @@
 // Begin anonymous namespace
 namespace {
 
+const char* defaultSourcesSchema = "com.ubuntu.content.hub.default";
+const char* defaultSourcesPath = "/com/ubuntu/content/hub/peers/";
+const char* sourcesSchema = "com.ubuntu.content.hub.source";
+const char* sourcesPath = "/com/ubuntu/content/hub/source/";
+const char* destinationsSchema = "com.ubuntu.content.hub.destination";
+const char* destinationsPath = "/com/ubuntu/content/hub/destination/";
+const char* sharesSchema = "com.ubuntu.content.hub.share";
+const char* sharesPath = "/com/ubuntu/content/hub/share/";
+
 cuc::Type mime_to_wellknown_type (const char * type)
 {
     TRACE() << Q_FUNC_INFO << "TYPE:" << type;
-
-    if (QString(type).contains("document"))
-        return cuc::Type::Known::documents();
-    else if (g_str_has_prefix (type, "x-scheme-handler/http"))
-        return cuc::Type::Known::links();
-    else if (g_str_has_prefix (type, "audio"))
-        return cuc::Type::Known::music();
-    else if (g_str_has_prefix (type, "image"))
-        return cuc::Type::Known::pictures();
-    else if (g_str_has_prefix (type, "video"))
-        return cuc::Type::Known::videos();
-    return cuc::Type::unknown();
+    return known_type(cucd::MimeClassifier::instance().classify(QByteArray(type)));
 }
 
 QMap<QString, QVector<QString>> libertine_apps()
@@ -145,20 +147,38 @@ QStringList libertine_app_ids(QString type)
 } // End anonymous namespace
 
 Registry::Registry() :
-    m_defaultSources(new QGSettings("com.ubuntu.content.hub.default",
-                                  "/com/ubuntu/content/hub/peers/")),
-    m_sources(new QGSettings("com.ubuntu.content.hub.source",
-                           "/com/ubuntu/content/hub/source/")),
-    m_dests(new QGSettings("com.ubuntu.content.hub.destination",
-                           "/com/ubuntu/content/hub/destination/")),
-    m_shares(new QGSettings("com.ubuntu.content.hub.share",
-                           "/com/ubuntu/content/hub/share/"))
+    m_defaultSources(new QGSettings(defaultSourcesSchema, defaultSourcesPath)),
+    m_sources(new QGSettings(sourcesSchema, sourcesPath)),
+    m_dests(new QGSettings(destinationsSchema, destinationsPath)),
+    m_shares(new QGSettings(sharesSchema, sharesPath)),
+    m_transactionDepth(0)
+{
+}
+
+Registry::~Registry()
+{
+    TRACE() << Q_FUNC_INFO;
+}
+
+/* Syncing walks every known type and may write to GSettings, so it is
+ * deferred until something actually looks at the registered sources
+ * instead of delaying service activation.
+ */
+void Registry::ensure_default_sources()
 {
+    std::call_once(m_defaultSourcesSynced, [this]() { sync_default_sources(); });
+}
+
+void Registry::sync_default_sources()
+{
+    TRACE() << Q_FUNC_INFO;
+
     /* ensure all default sources are registered as available sources */
+    begin_transaction();
     QList<cuc::Type> types = known_types();
     Q_FOREACH (cuc::Type type, types)
     {
-        if (m_defaultSources->keys().contains(type.id()))
+        if (type_keys(m_defaultSources.data()).contains(type.index()))
         {
             QVariant peer_v = m_defaultSources->get(type.id());
             // If default isn't a StringList, attempt to reset
@@ -192,17 +212,15 @@ Registry::Registry() :
             }
         }
     }
-}
-
-Registry::~Registry()
-{
-    TRACE() << Q_FUNC_INFO;
+    commit_transaction();
 }
 
 cuc::Peer Registry::default_source_for_type(cuc::Type type)
 {
+    std::lock_guard<std::recursive_mutex> guard(m_lock);
     TRACE() << Q_FUNC_INFO << type.id();
-    if (m_defaultSources->keys().contains(type.id()))
+    ensure_default_sources();
+    if (type_keys(m_defaultSources.data()).contains(type.index()))
     {
         QVariant peer_v = m_defaultSources->get(type.id());
         if (peer_v.type() != QVariant::StringList)
@@ -224,32 +242,34 @@ cuc::Peer Registry::default_source_for_type(cuc::Type type)
 
 void Registry::enumerate_known_peers(const std::function<void(const cuc::Peer&)>&for_each)
 {
+    std::lock_guard<std::recursive_mutex> guard(m_lock);
     TRACE() << Q_FUNC_INFO;
+    ensure_default_sources();
 
-    Q_FOREACH (QString type_id, m_sources->keys())
+    Q_FOREACH (int type, type_keys(m_sources.data()))
     {
-        TRACE() << Q_FUNC_INFO << type_id;
-        Q_FOREACH (QString k, m_sources->get(type_id).toStringList())
+        TRACE_EVENT(TraceRegistry, TraceDebug, "type=%d", type);
+        Q_FOREACH (QString k, peers_for_key(m_sources.data(), type))
         {
-            TRACE() << Q_FUNC_INFO << k;
+            TRACE_EVENT(TraceRegistry, TraceDebug, "peer=%s", qPrintable(k));
             for_each(cuc::Peer{k});
         }
     }
-    Q_FOREACH (QString type_id, m_dests->keys())
+    Q_FOREACH (int type, type_keys(m_dests.data()))
     {
-        TRACE() << Q_FUNC_INFO << type_id;
-        Q_FOREACH (QString k, m_dests->get(type_id).toStringList())
+        TRACE_EVENT(TraceRegistry, TraceDebug, "type=%d", type);
+        Q_FOREACH (QString k, peers_for_key(m_dests.data(), type))
         {
-            TRACE() << Q_FUNC_INFO << k;
+            TRACE_EVENT(TraceRegistry, TraceDebug, "peer=%s", qPrintable(k));
             for_each(cuc::Peer{k});
         }
     }
-    Q_FOREACH (QString type_id, m_shares->keys())
+    Q_FOREACH (int type, type_keys(m_shares.data()))
     {
-        TRACE() << Q_FUNC_INFO << type_id;
-        Q_FOREACH (QString k, m_shares->get(type_id).toStringList())
+        TRACE_EVENT(TraceRegistry, TraceDebug, "type=%d", type);
+        Q_FOREACH (QString k, peers_for_key(m_shares.data(), type))
         {
-            TRACE() << Q_FUNC_INFO << k;
+            TRACE_EVENT(TraceRegistry, TraceDebug, "peer=%s", qPrintable(k));
             for_each(cuc::Peer{k});
         }
     }
@@ -257,16 +277,18 @@ void Registry::enumerate_known_peers(const std::function<void(const cuc::Peer&)>
 
 void Registry::enumerate_known_sources_for_type(cuc::Type type, const std::function<void(const cuc::Peer&)>&for_each)
 {
+    std::lock_guard<std::recursive_mutex> guard(m_lock);
     TRACE() << Q_FUNC_INFO << type.id();
+    ensure_default_sources();
 
     QStringList peers;
-    peers << m_sources->get("all").toStringList();
+    peers << peers_for_key(m_sources.data(), cucd::AllTypeIndex);
     if (type != cuc::Type::unknown() && valid_type(type))
-        peers << m_sources->get(type.id()).toStringList();
+        peers << peers_for_key(m_sources.data(), type.index());
 
     Q_FOREACH (QString k, peers)
     {
-        TRACE() << Q_FUNC_INFO << k;
+        TRACE_EVENT(TraceRegistry, TraceDebug, "peer=%s", qPrintable(k));
         bool defaultPeer = false;
         QVariant peer_v;
         if (type != cuc::Type::unknown())
@@ -293,16 +315,22 @@ void Registry::enumerate_known_destinations_for_type(cuc::Type type, const std::
 {
     TRACE() << Q_FUNC_INFO << type.id();
 
+    /* Scanning the libertine containers is slow and needs no lock */
+    const QStringList legacy = libertine_app_ids(type.id());
+
     QStringList peers;
-    peers << m_dests->get("all").toStringList();
-    if (type != cuc::Type::unknown() && valid_type(type))
-        peers << m_dests->get(type.id()).toStringList();
+    {
+        std::lock_guard<std::recursive_mutex> guard(m_lock);
+        peers << peers_for_key(m_dests.data(), cucd::AllTypeIndex);
+        if (type != cuc::Type::unknown() && valid_type(type))
+            peers << peers_for_key(m_dests.data(), type.index());
+    }
 
-    peers << libertine_app_ids(type.id());
+    peers << legacy;
 
     Q_FOREACH (QString k, peers)
     {
-        TRACE() << Q_FUNC_INFO << k;
+        TRACE_EVENT(TraceRegistry, TraceDebug, "peer=%s", qPrintable(k));
         for_each(cuc::Peer{k});
     }
 }
@@ -314,22 +342,29 @@ void Registry::enumerate_known_shares_for_type(cuc::Type type, const std::functi
     if (type == cuc::Type::unknown() || !valid_type(type))
         return;
 
+    const QStringList legacy = libertine_app_ids(type.id());
+
     QStringList peers;
-    peers << m_shares->get(type.id()).toStringList();
+    {
+        std::lock_guard<std::recursive_mutex> guard(m_lock);
+        peers << peers_for_key(m_shares.data(), type.index());
+    }
 
-    peers << libertine_app_ids(type.id());
+    peers << legacy;
 
     Q_FOREACH (QString k, peers)
     {
-        TRACE() << Q_FUNC_INFO << k;
+        TRACE_EVENT(TraceRegistry, TraceDebug, "peer=%s", qPrintable(k));
         for_each(cuc::Peer{k});
     }
 }
 
 bool Registry::install_default_source_for_type(cuc::Type type, cuc::Peer peer)
 {
+    std::lock_guard<std::recursive_mutex> guard(m_lock);
     TRACE() << Q_FUNC_INFO << "type:" << type.id() << "peer:" << peer.id();
-    if (m_defaultSources->keys().contains(type.id()))
+    ensure_default_sources();
+    if (type_keys(m_defaultSources.data()).contains(type.index()))
     {
         TRACE() << Q_FUNC_INFO << "Default peer for" << type.id() << "already installed.";
         return false;
@@ -341,74 +376,223 @@ bool Registry::install_default_source_for_type(cuc::Type type, cuc::Peer peer)
 
 bool Registry::install_source_for_type(cuc::Type type, cuc::Peer peer)
 {
+    std::lock_guard<std::recursive_mutex> guard(m_lock);
     TRACE() << Q_FUNC_INFO << "type:" << type.id() << "peer:" << peer.id();
-    QStringList l = m_sources->get(type.id()).toStringList();
+    QStringList l = peers_for_key(m_sources.data(), type.index());
     if (not l.contains(peer.id()))
     {
         l.append(peer.id());
-        return m_sources->trySet(type.id(), QVariant(l));
+        return set_peers_for_key(m_sources.data(), type.index(), l);
     }
     return false;
 }
 
 bool Registry::install_destination_for_type(cuc::Type type, cuc::Peer peer)
 {
+    std::lock_guard<std::recursive_mutex> guard(m_lock);
     TRACE() << Q_FUNC_INFO << "type:" << type.id() << "peer:" << peer.id();
-    QStringList l = m_dests->get(type.id()).toStringList();
+    QStringList l = peers_for_key(m_dests.data(), type.index());
     if (not l.contains(peer.id()))
     {
         l.append(peer.id());
-        return m_dests->trySet(type.id(), QVariant(l));
+        return set_peers_for_key(m_dests.data(), type.index(), l);
     }
     return false;
 }
 
 bool Registry::install_share_for_type(cuc::Type type, cuc::Peer peer)
 {
+    std::lock_guard<std::recursive_mutex> guard(m_lock);
     TRACE() << Q_FUNC_INFO << "type:" << type.id() << "peer:" << peer.id();
-    QStringList l = m_shares->get(type.id()).toStringList();
+    QStringList l = peers_for_key(m_shares.data(), type.index());
     if (not l.contains(peer.id()))
     {
         l.append(peer.id());
-        return m_shares->trySet(type.id(), QVariant(l));
+        return set_peers_for_key(m_shares.data(), type.index(), l);
     }
     return false;
 }
 
 bool Registry::remove_peer(cuc::Peer peer)
 {
+    std::lock_guard<std::recursive_mutex> guard(m_lock);
     TRACE() << Q_FUNC_INFO << "peer:" << peer.id();
+    ensure_default_sources();
     bool ret = false;
-    Q_FOREACH (QString type_id, m_sources->keys())
+    begin_transaction();
+    Q_FOREACH (int type, type_keys(m_sources.data()))
     {
-        QStringList l = m_sources->get(type_id).toStringList();
+        QStringList l = peers_for_key(m_sources.data(), type);
         if (l.contains(peer.id()))
         {
             l.removeAll(peer.id());
-            ret = m_sources->trySet(type_id, QVariant(l));
+            ret = set_peers_for_key(m_sources.data(), type, l);
         }
     }
-    Q_FOREACH (QString type_id, m_dests->keys())
+    Q_FOREACH (int type, type_keys(m_dests.data()))
     {
-        QStringList l = m_dests->get(type_id).toStringList();
+        QStringList l = peers_for_key(m_dests.data(), type);
         if (l.contains(peer.id()))
         {
             l.removeAll(peer.id());
-            ret = m_dests->trySet(type_id, QVariant(l));
+            ret = set_peers_for_key(m_dests.data(), type, l);
         }
     }
-    Q_FOREACH (QString type_id, m_shares->keys())
+    Q_FOREACH (int type, type_keys(m_shares.data()))
     {
-        QStringList l = m_shares->get(type_id).toStringList();
+        QStringList l = peers_for_key(m_shares.data(), type);
         if (l.contains(peer.id()))
         {
             l.removeAll(peer.id());
-            ret = m_shares->trySet(type_id, QVariant(l));
+            ret = set_peers_for_key(m_shares.data(), type, l);
         }
     }
+    commit_transaction();
     return ret;
 }
+
+/* Only asks libertine, so it doesn't wait for queries holding the lock */
 bool Registry::peer_is_legacy(QString peer_id)
 {
     return libertine_app_ids("all").contains(peer_id);
 }
+
+void Registry::begin_transaction()
+{
+    std::lock_guard<std::recursive_mutex> guard(m_lock);
+    TRACE() << Q_FUNC_INFO << m_transactionDepth;
+    m_transactionDepth++;
+}
+
+bool Registry::commit_transaction()
+{
+    std::lock_guard<std::recursive_mutex> guard(m_lock);
+    TRACE() << Q_FUNC_INFO << m_transactionDepth;
+    if (m_transactionDepth == 0)
+    {
+        qWarning() << Q_FUNC_INFO << "No transaction to commit";
+        return false;
+    }
+
+    if (--m_transactionDepth > 0)
+        return true;
+
+    return apply_all_pending();
+}
+
+/* Keys that failed stay pending.  Both the next commit and the next
+ * write outside a transaction retry them.
+ */
+bool Registry::apply_all_pending()
+{
+    bool ret = apply_pending(m_sources.data(), sourcesSchema, sourcesPath);
+    ret = apply_pending(m_dests.data(), destinationsSchema, destinationsPath) && ret;
+    ret = apply_pending(m_shares.data(), sharesSchema, sharesPath) && ret;
+
+    return ret;
+}
+
+/* Keys of a schema are type ids, interned once per schema */
+const QVector<int>& Registry::type_keys(QGSettings* settings)
+{
+    auto it = m_typeKeys.find(settings);
+    if (it == m_typeKeys.end())
+    {
+        QVector<int> types;
+        Q_FOREACH (QString key, settings->keys())
+            types.append(cucd::intern_type(key));
+        it = m_typeKeys.insert(settings, types);
+    }
+    return it.value();
+}
+
+QStringList Registry::peers_for_key(QGSettings* settings, int type)
+{
+    auto pending = m_pending.constFind(settings);
+    if (pending != m_pending.constEnd() && pending->contains(type))
+        return pending->value(type);
+
+    return settings->get(cucd::type_name(type)).toStringList();
+}
+
+bool Registry::set_peers_for_key(QGSettings* settings, int type, const QStringList& peers)
+{
+    if (m_transactionDepth == 0)
+    {
+        if (not settings->trySet(cucd::type_name(type), QVariant(peers)))
+            return false;
+        /* Supersedes whatever an earlier commit failed to write */
+        auto pending = m_pending.find(settings);
+        if (pending != m_pending.end())
+            pending->remove(type);
+        if (not m_pending.isEmpty())
+            apply_all_pending();
+        return true;
+    }
+
+    if (not type_keys(settings).contains(type))
+        return false;
+
+    m_pending[settings].insert(type, peers);
+    return true;
+}
+
+/* Writes all pending keys of one schema in a single delayed apply, so
+ * dconf sees one change set and listeners get one notification per key.
+ * Only the keys that were written are dropped from m_pending.
+ */
+bool Registry::apply_pending(QGSettings* settings, const char* schema, const char* path)
+{
+    auto pending = m_pending.find(settings);
+    if (pending == m_pending.end())
+        return true;
+
+    const QMap<int, QStringList> keys = pending.value();
+    if (keys.isEmpty())
+    {
+        m_pending.erase(pending);
+        return true;
+    }
+
+    TRACE() << Q_FUNC_INFO << schema << keys.keys();
+
+    GSettings* gsettings = g_settings_new_with_path(schema, path);
+    g_settings_delay(gsettings);
+
+    bool ret = true;
+    for (auto it = keys.constBegin(); it != keys.constEnd(); ++it)
+    {
+        const QString key = cucd::type_name(it.key());
+        if (write_key(gsettings, key, it.value()))
+        {
+            pending->remove(it.key());
+        }
+        else
+        {
+            qWarning() << "Failed to set" << key << "in" << schema << "- kept pending for the next write";
+            ret = false;
+        }
+    }
+
+    g_settings_apply(gsettings);
+    g_settings_sync();
+    g_object_unref(gsettings);
+
+    if (pending->isEmpty())
+        m_pending.erase(pending);
+    return ret;
+}
+
+bool Registry::write_key(GSettings* settings, const QString& key, const QStringList& peers)
+{
+    QList<QByteArray> values;
+    QVector<const gchar*> strv;
+    Q_FOREACH (const QString& peer, peers)
+    {
+        values.append(peer.toUtf8());
+        strv.append(values.last().constData());
+    }
+    strv.append(nullptr);
+
+    return g_settings_set_strv(settings, key.toUtf8().constData(), strv.constData());
+}
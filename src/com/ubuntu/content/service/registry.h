@@ -20,13 +20,24 @@
 #define REGISTRY_H
 
 #include <QGSettings/QGSettings>
+#include <QMap>
+#include <QStringList>
+#include <QVector>
+#include <mutex>
 #include <com/ubuntu/content/peer.h>
 #include <com/ubuntu/content/type.h>
 #include "detail/peer_registry.h"
 
+typedef struct _GSettings GSettings;
+
 namespace cucd = com::ubuntu::content::detail;
 namespace cuc = com::ubuntu::content;
 
+/* The service queries this from its worker threads.  Entry points
+ * hold m_lock while they touch GSettings, which also serializes access
+ * to the QGSettings objects.  Their change signals still arrive on the
+ * thread that created them.  The libertine scan runs unlocked.
+ */
 class Registry : public cucd::PeerRegistry
 {
 
@@ -44,12 +55,32 @@ public:
     bool install_share_for_type(cuc::Type type, cuc::Peer peer);
     bool remove_peer(cuc::Peer peer);
     bool peer_is_legacy(QString type);
+    void begin_transaction();
+    bool commit_transaction();
+
+protected:
+    /* Stages one key of a delayed apply, see apply_pending() */
+    virtual bool write_key(GSettings* settings, const QString& key, const QStringList& peers);
 
 private:
+    void ensure_default_sources();
+    void sync_default_sources();
+    const QVector<int>& type_keys(QGSettings* settings);
+    QStringList peers_for_key(QGSettings* settings, int type);
+    bool set_peers_for_key(QGSettings* settings, int type, const QStringList& peers);
+    bool apply_pending(QGSettings* settings, const char* schema, const char* path);
+    bool apply_all_pending();
+
     QScopedPointer<QGSettings> m_defaultSources;
     QScopedPointer<QGSettings> m_sources;
     QScopedPointer<QGSettings> m_dests;
     QScopedPointer<QGSettings> m_shares;
+    int m_transactionDepth;
+    QMap<QGSettings*, QMap<int, QStringList>> m_pending;
+    QMap<QGSettings*, QVector<int>> m_typeKeys;
+    std::once_flag m_defaultSourcesSynced;
+    /* Recursive, entry points call each other */
+    std::recursive_mutex m_lock;
 };
 
 #endif // REGISTRY_H
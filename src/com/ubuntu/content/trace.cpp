@@ -0,0 +1,162 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "debug.h"
+#include "trace.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <time.h>
+#include <unistd.h>
+
+std::atomic<unsigned int> traceCategoryMask{~0u};
+
+namespace
+{
+const int ringSize = 1024;
+const int textSize = 200;
+
+const char* categoryNames[TraceCategoryCount] = {
+    "service", "transfer", "paste", "peer", "registry", "hook", "client"
+};
+
+struct Slot
+{
+    /* 0 while being written, otherwise the event number + 1 */
+    std::atomic<unsigned long long> seq;
+    long long timestamp;
+    const char* func;
+    unsigned char category;
+    unsigned char level;
+    char text[textSize];
+};
+
+Slot ring[ringSize];
+std::atomic<unsigned long long> ringHead{0};
+
+long long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* snprintf isn't async-signal-safe, these are all trace_dump needs */
+char* append(char* out, char* end, const char* s)
+{
+    while (*s && out < end)
+        *out++ = *s++;
+    return out;
+}
+
+char* append_number(char* out, char* end, long long n)
+{
+    char digits[24];
+    int i = 0;
+    if (n < 0)
+        n = 0;
+    do {
+        digits[i++] = '0' + n % 10;
+        n /= 10;
+    } while (n > 0);
+    while (i > 0 && out < end)
+        *out++ = digits[--i];
+    return out;
+}
+}
+
+void trace_init()
+{
+    const char* spec = getenv("CONTENT_HUB_TRACE");
+    if (spec == nullptr)
+        return;
+
+    unsigned int mask = 0;
+    if (strcmp(spec, "all") == 0)
+        mask = ~0u;
+    else if (strcmp(spec, "none") != 0)
+    {
+        for (int c = 0; c < TraceCategoryCount; c++)
+        {
+            const char* found = strstr(spec, categoryNames[c]);
+            size_t len = strlen(categoryNames[c]);
+            if (found && (found == spec || found[-1] == ',') && (found[len] == '\0' || found[len] == ','))
+                mask |= 1u << c;
+        }
+    }
+    traceCategoryMask.store(mask, std::memory_order_relaxed);
+}
+
+void trace_record(TraceCategory category, TraceLevel level, const char* func, const char* format, ...)
+{
+    unsigned long long n = ringHead.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = ring[n % ringSize];
+
+    slot.seq.store(0, std::memory_order_release);
+    slot.timestamp = now_us();
+    slot.func = func;
+    slot.category = category;
+    slot.level = level;
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(slot.text, textSize, format, args);
+    va_end(args);
+
+    slot.seq.store(n + 1, std::memory_order_release);
+
+    if (debugEnabled())
+        qDebug() << categoryNames[category] << func << slot.text;
+}
+
+void trace_dump(int fd)
+{
+    unsigned long long head = ringHead.load(std::memory_order_acquire);
+    unsigned long long first = head > (unsigned long long)ringSize ? head - ringSize : 0;
+
+    for (unsigned long long n = first; n < head; n++)
+    {
+        Slot& slot = ring[n % ringSize];
+        if (slot.seq.load(std::memory_order_acquire) != n + 1)
+            continue;
+
+        char line[textSize + 128];
+        char* end = line + sizeof(line) - 1;
+        char* out = line;
+        out = append(out, end, "[");
+        out = append_number(out, end, slot.timestamp);
+        out = append(out, end, "] ");
+        out = append(out, end, categoryNames[slot.category]);
+        out = append(out, end, " ");
+        out = append(out, end, slot.func);
+        out = append(out, end, ": ");
+        char text[textSize];
+        memcpy(text, slot.text, textSize);
+        text[textSize - 1] = '\0';
+
+        /* Overwritten while copying, drop it */
+        if (slot.seq.load(std::memory_order_acquire) != n + 1)
+            continue;
+
+        out = append(out, end, text);
+        *out++ = '\n';
+
+        ssize_t ignored = write(fd, line, out - line);
+        (void) ignored;
+    }
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+
+/* Structured tracing for hot paths.
+ *
+ * Events are formatted printf style straight into a fixed size ring
+ * buffer, nothing is allocated and the arguments are only evaluated
+ * when the category is enabled.  Events below CONTENT_HUB_TRACE_MIN_LEVEL
+ * are compiled out entirely.  The ring can be dumped with trace_dump(),
+ * the service does so on SIGUSR1.
+ */
+
+enum TraceLevel
+{
+    TraceDebug = 0,
+    TraceInfo = 1,
+    TraceWarning = 2
+};
+
+enum TraceCategory
+{
+    TraceService = 0,
+    TraceTransfer,
+    TracePaste,
+    TracePeer,
+    TraceRegistry,
+    TraceHook,
+    TraceClient,
+    TraceCategoryCount
+};
+
+#ifndef CONTENT_HUB_TRACE_MIN_LEVEL
+#define CONTENT_HUB_TRACE_MIN_LEVEL TraceInfo
+#endif
+
+/* One bit per category, see CONTENT_HUB_TRACE */
+extern std::atomic<unsigned int> traceCategoryMask;
+
+static inline bool traceEnabled(TraceCategory category)
+{
+    return traceCategoryMask.load(std::memory_order_relaxed) & (1u << category);
+}
+
+void trace_record(TraceCategory category, TraceLevel level, const char* func, const char* format, ...)
+    __attribute__((format(printf, 4, 5)));
+
+/* Writes the ring to fd oldest first, async-signal-safe */
+void trace_dump(int fd);
+
+/* Reads CONTENT_HUB_TRACE, a comma separated list of categories,
+ * "all" or "none".  Everything is enabled by default.
+ */
+void trace_init();
+
+#define TRACE_EVENT(category, level, ...) \
+    do { \
+        if ((level) >= CONTENT_HUB_TRACE_MIN_LEVEL && traceEnabled(category)) \
+            trace_record(category, level, __func__, __VA_ARGS__); \
+    } while (0)
+
+#endif // TRACE_H
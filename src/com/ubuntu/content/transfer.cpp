@@ -39,6 +39,14 @@ cuc::Transfer::Transfer(const QSharedPointer<cuc::Transfer::Private>& d, QObject
                 SIGNAL (SelectionTypeChanged(int)),
                 this,
                 SIGNAL (selectionTypeChanged()));
+    QObject::connect(d->remote_transfer,
+                SIGNAL (ItemModeChanged(int)),
+                this,
+                SIGNAL (itemModeChanged()));
+    QObject::connect(d->remote_transfer,
+                SIGNAL (ItemsAppended(int)),
+                this,
+                SIGNAL (itemsAppended(int)));
 }
 
 cuc::Transfer::~Transfer()
@@ -136,3 +144,43 @@ QString cuc::Transfer::destination() const
 {
     return d->destination();
 }
+
+cuc::Transfer::ItemMode cuc::Transfer::itemMode() const
+{
+    return d->item_mode();
+}
+
+bool cuc::Transfer::setItemMode(const cuc::Transfer::ItemMode& mode)
+{
+    return d->setItemMode(mode);
+}
+
+QDBusUnixFileDescriptor cuc::Transfer::openItem(int index)
+{
+    return d->open_item(index);
+}
+
+bool cuc::Transfer::persist()
+{
+    return d->persist();
+}
+
+bool cuc::Transfer::beginCharge()
+{
+    return d->begin_charge();
+}
+
+void cuc::Transfer::appendItems(const QVector<cuc::Item>& items)
+{
+    d->append_items(items);
+}
+
+bool cuc::Transfer::commitCharge()
+{
+    return d->commit_charge();
+}
+
+QVector<cuc::Item> cuc::Transfer::collectFrom(int first)
+{
+    return d->collect_from(first);
+}
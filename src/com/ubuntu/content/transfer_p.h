@@ -19,6 +19,7 @@
 #define COM_UBUNTU_CONTENT_TRANSFER_P_H_
 
 #include "common.h"
+#include "proxy_pool.h"
 #include "ContentTransferInterface.h"
 
 #include <com/ubuntu/content/item.h>
@@ -37,24 +38,34 @@ class Transfer::Private : public QObject
 {
     Q_OBJECT
   public:
-    static Transfer* make_transfer(const QDBusObjectPath& transfer, QObject* parent)
+    /* snapshot is what the service sent along with a handler call,
+     * see detail::Transfer::snapshot()
+     */
+    static Transfer* make_transfer(const QDBusObjectPath& transfer, QObject* parent,
+                                   const QVariantMap& snapshot = QVariantMap())
     {
-        QSharedPointer<Private> d{new Private{transfer, parent}};
+        QSharedPointer<Private> d{new Private{transfer, parent, snapshot}};
         return new Transfer{d, parent};
     }
 
-    Private(const QDBusObjectPath& transfer, QObject* parent)
+    Private(const QDBusObjectPath& transfer, QObject* parent,
+            const QVariantMap& snapshot = QVariantMap())
             : QObject(parent),
-              remote_transfer(
-                  new com::ubuntu::content::dbus::Transfer(
-                      HUB_SERVICE_NAME,
-                      transfer.path(), 
-                      QDBusConnection::sessionBus(), this))
+              proxy(detail::ProxyPool<com::ubuntu::content::dbus::Transfer>::acquire(transfer.path())),
+              remote_transfer(proxy.data()),
+              snapshot(snapshot)
     {
+        QObject::connect(remote_transfer, SIGNAL(StateChanged(int)), this, SLOT(invalidate()));
+        QObject::connect(remote_transfer, SIGNAL(StoreChanged(QString)), this, SLOT(invalidate()));
+        QObject::connect(remote_transfer, SIGNAL(SelectionTypeChanged(int)), this, SLOT(invalidate()));
+        QObject::connect(remote_transfer, SIGNAL(ItemModeChanged(int)), this, SLOT(invalidate()));
     }
 
     int id()
     {
+        if (snapshot.contains(QStringLiteral("id")))
+            return snapshot.value(QStringLiteral("id")).toInt();
+
         auto reply = remote_transfer->Id();
         reply.waitForFinished();
 
@@ -63,6 +74,9 @@ class Transfer::Private : public QObject
 
     State state()
     {
+        if (snapshot.contains(QStringLiteral("state")))
+            return static_cast<Transfer::State>(snapshot.value(QStringLiteral("state")).toInt());
+
         auto reply = remote_transfer->State();
         reply.waitForFinished();
 
@@ -74,6 +88,7 @@ class Transfer::Private : public QObject
 
     bool start()
     {
+        invalidate();
         auto reply = remote_transfer->Start();
         reply.waitForFinished();
         
@@ -82,6 +97,7 @@ class Transfer::Private : public QObject
 
     bool handled()
     {
+        invalidate();
         auto reply = remote_transfer->Handled();
         reply.waitForFinished();
 
@@ -90,6 +106,7 @@ class Transfer::Private : public QObject
 
     bool abort()
     {
+        invalidate();
         auto reply = remote_transfer->Abort();
         reply.waitForFinished();
         
@@ -98,6 +115,7 @@ class Transfer::Private : public QObject
 
     bool finalize()
     {
+        invalidate();
         auto reply = remote_transfer->Finalize();
         reply.waitForFinished();
 
@@ -106,21 +124,107 @@ class Transfer::Private : public QObject
 
     bool charge(const QVector<Item>& items)
     {
+        /* The service places each batch while the next is marshalled,
+         * older services only know the single call
+         */
+        if (items.count() > charge_batch_size && begin_charge())
+        {
+            for (int i = 0; i < items.count(); i += charge_batch_size)
+                append_items(items.mid(i, charge_batch_size));
+            return commit_charge();
+        }
+
         QVariantList itemVariants;
         Q_FOREACH(const Item& item, items)
         {   
             itemVariants << QVariant::fromValue(item);
         }
+        invalidate();
         auto reply = remote_transfer->Charge(itemVariants);
         reply.waitForFinished();
 
         return not reply.isError();
     }
 
+    bool begin_charge()
+    {
+        pending_appends.clear();
+        auto reply = remote_transfer->BeginCharge();
+        reply.waitForFinished();
+
+        return not reply.isError();
+    }
+
+    void append_items(const QVector<Item>& items)
+    {
+        QVariantList itemVariants;
+        itemVariants.reserve(items.count());
+        Q_FOREACH(const Item& item, items)
+            itemVariants << QVariant::fromValue(item);
+
+        pending_appends << remote_transfer->AppendItems(itemVariants);
+    }
+
+    bool commit_charge()
+    {
+        invalidate();
+        auto reply = remote_transfer->CommitCharge();
+        reply.waitForFinished();
+
+        /* The service answers in order, these are all in by now */
+        bool ok = not reply.isError();
+        Q_FOREACH(QDBusPendingReply<> append, pending_appends)
+        {
+            append.waitForFinished();
+            if (append.isError())
+                ok = false;
+        }
+        pending_appends.clear();
+
+        return ok;
+    }
+
+    QVector<Item> collect_from(int first)
+    {
+        QVector<Item> result;
+
+        auto reply = remote_transfer->CollectFrom(first);
+        reply.waitForFinished();
+
+        if (reply.isError())
+            return result;
+
+        auto items = reply.value();
+        result.reserve(items.count());
+        Q_FOREACH(const QVariant& itemVariant, items)
+            result << qdbus_cast<Item>(itemVariant);
+
+        return result;
+    }
+
     QVector<Item> collect()
     {
         QVector<Item> result;
 
+        /* Small transfers come with all their items */
+        if (snapshot.contains(QStringLiteral("items")))
+        {
+            /* Over the bus the list arrives still marshalled */
+            const QVariantList items = qdbus_cast<QVariantList>(snapshot.value(QStringLiteral("items")));
+            if (items.count() == snapshot.value(QStringLiteral("itemCount")).toInt())
+            {
+                Q_FOREACH(const QVariant& itemVariant, items)
+                    result << qdbus_cast<Item>(itemVariant);
+
+                /* The service still has to move the transfer on, nothing
+                 * here needs its answer
+                 */
+                invalidate();
+                remote_transfer->Collect();
+                return result;
+            }
+        }
+
         auto reply = remote_transfer->Collect();
         reply.waitForFinished();
         
@@ -139,6 +243,9 @@ class Transfer::Private : public QObject
 
     Store store()
     {
+        if (snapshot.contains(QStringLiteral("store")))
+            return Store{snapshot.value(QStringLiteral("store")).toString()};
+
         auto reply = remote_transfer->Store();
         reply.waitForFinished();
 
@@ -154,6 +261,7 @@ class Transfer::Private : public QObject
 
     bool setStore(const Store* store)
     {
+        invalidate();
         auto reply = remote_transfer->SetStore(store->uri());
         reply.waitForFinished();
 
@@ -162,6 +270,9 @@ class Transfer::Private : public QObject
 
     SelectionType selection_type()
     {
+        if (snapshot.contains(QStringLiteral("selectionType")))
+            return static_cast<Transfer::SelectionType>(snapshot.value(QStringLiteral("selectionType")).toInt());
+
         auto reply = remote_transfer->SelectionType();
         reply.waitForFinished();
 
@@ -174,14 +285,64 @@ class Transfer::Private : public QObject
 
     bool setSelectionType(int type)
     {
+        invalidate();
         auto reply = remote_transfer->SetSelectionType(type);
         reply.waitForFinished();
 
         return not reply.isError();
     }
 
+    ItemMode item_mode()
+    {
+        if (snapshot.contains(QStringLiteral("itemMode")))
+            return static_cast<Transfer::ItemMode>(snapshot.value(QStringLiteral("itemMode")).toInt());
+
+        auto reply = remote_transfer->ItemMode();
+        reply.waitForFinished();
+
+        /* if ItemMode fails, default to copy */
+        if (reply.isError())
+            return Transfer::ItemMode::copy;
+
+        return static_cast<Transfer::ItemMode>(reply.value());
+    }
+
+    bool setItemMode(int mode)
+    {
+        invalidate();
+        auto reply = remote_transfer->SetItemMode(mode);
+        reply.waitForFinished();
+
+        return not reply.isError();
+    }
+
+    QDBusUnixFileDescriptor open_item(int index)
+    {
+        auto reply = remote_transfer->OpenItem(index);
+        reply.waitForFinished();
+
+        if (reply.isError())
+            return QDBusUnixFileDescriptor();
+
+        return reply.value();
+    }
+
+    bool persist()
+    {
+        /* The items move into the store */
+        snapshot.remove(QStringLiteral("items"));
+        snapshot.remove(QStringLiteral("itemCount"));
+        auto reply = remote_transfer->Persist();
+        reply.waitForFinished();
+
+        return not reply.isError();
+    }
+
     Direction direction()
     {
+        if (snapshot.contains(QStringLiteral("direction")))
+            return static_cast<Transfer::Direction>(snapshot.value(QStringLiteral("direction")).toInt());
+
         auto reply = remote_transfer->Direction();
         reply.waitForFinished();
 
@@ -194,6 +355,9 @@ class Transfer::Private : public QObject
 
     QString downloadId()
     {
+        if (snapshot.contains(QStringLiteral("downloadId")))
+            return snapshot.value(QStringLiteral("downloadId")).toString();
+
         auto reply = remote_transfer->DownloadId();
         reply.waitForFinished();
 
@@ -205,6 +369,7 @@ class Transfer::Private : public QObject
 
     bool setDownloadId(QString downloadId)
     {
+        invalidate();
         auto reply = remote_transfer->SetDownloadId(downloadId);
         reply.waitForFinished();
 
@@ -213,6 +378,7 @@ class Transfer::Private : public QObject
 
     bool download()
     {
+        invalidate();
         auto reply = remote_transfer->Download();
         reply.waitForFinished();
 
@@ -221,6 +387,9 @@ class Transfer::Private : public QObject
 
     QString contentType()
     {
+        if (snapshot.contains(QStringLiteral("contentType")))
+            return snapshot.value(QStringLiteral("contentType")).toString();
+
         auto reply = remote_transfer->ContentType();
         reply.waitForFinished();
 
@@ -229,6 +398,9 @@ class Transfer::Private : public QObject
 
     QString source()
     {
+        if (snapshot.contains(QStringLiteral("source")))
+            return snapshot.value(QStringLiteral("source")).toString();
+
         auto reply = remote_transfer->source();
         reply.waitForFinished();
 
@@ -237,13 +409,38 @@ class Transfer::Private : public QObject
 
     QString destination()
     {
+        if (snapshot.contains(QStringLiteral("destination")))
+            return snapshot.value(QStringLiteral("destination")).toString();
+
         auto reply = remote_transfer->destination();
         reply.waitForFinished();
 
         return static_cast<QString>(reply.value());
     }
 
+    /* Shared with every other Private for the same object */
+    QSharedPointer<com::ubuntu::content::dbus::Transfer> proxy;
     com::ubuntu::content::dbus::Transfer* remote_transfer;
+
+  public Q_SLOTS:
+    /* Drops whatever can change, the rest is fixed for the
+     * lifetime of the transfer
+     */
+    void invalidate()
+    {
+        snapshot.remove(QStringLiteral("state"));
+        snapshot.remove(QStringLiteral("store"));
+        snapshot.remove(QStringLiteral("selectionType"));
+        snapshot.remove(QStringLiteral("itemMode"));
+        snapshot.remove(QStringLiteral("downloadId"));
+    }
+
+  private:
+    /* Items per AppendItems() call when charge() streams */
+    static const int charge_batch_size = 256;
+
+    QVariantMap snapshot;
+    QList<QDBusPendingReply<>> pending_appends;
 };
 }
 }
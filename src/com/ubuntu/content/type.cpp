@@ -17,17 +17,86 @@
  */
 
 #include <com/ubuntu/content/type.h>
+#include "detail/type_table.h"
 
 #include <QCoreApplication>
+#include <QHash>
+#include <QReadWriteLock>
+#include <QVector>
 
 namespace cuc = com::ubuntu::content;
+namespace cucd = com::ubuntu::content::detail;
+
+namespace
+{
+struct TypeTable
+{
+    TypeTable()
+    {
+        for (int i = 0; i < cucd::KnownTypeCount; i++)
+        {
+            names.append(QString::fromLatin1(cucd::knownTypeNames[i]));
+            indices.insert(names.last(), i);
+        }
+    }
+
+    QReadWriteLock lock;
+    QHash<QString, int> indices;
+    QVector<QString> names;
+};
+
+TypeTable& type_table()
+{
+    static TypeTable table;
+    return table;
+}
+}
+
+int cucd::intern_type(const QString& id)
+{
+    TypeTable& table = type_table();
+    {
+        QReadLocker reader(&table.lock);
+        auto it = table.indices.constFind(id);
+        if (it != table.indices.constEnd())
+            return it.value();
+    }
+
+    QWriteLocker writer(&table.lock);
+    auto it = table.indices.constFind(id);
+    if (it != table.indices.constEnd())
+        return it.value();
+
+    table.names.append(id);
+    table.indices.insert(id, table.names.size() - 1);
+    return table.names.size() - 1;
+}
+
+int cucd::find_type(const QString& id)
+{
+    TypeTable& table = type_table();
+    QReadLocker reader(&table.lock);
+    return table.indices.value(id, -1);
+}
+
+QString cucd::type_name(int index)
+{
+    TypeTable& table = type_table();
+    QReadLocker reader(&table.lock);
+    return table.names.value(index);
+}
 
 struct cuc::Type::Private
 {
     QString id;
+    int index;
 };
 
-cuc::Type::Type(const QString& id, QObject* parent) : QObject(parent), d(new Private{id})
+/* Ids come off the bus, registering every one of them would grow the
+ * table without bound.  Only the known types and the registry's schema
+ * keys are interned.
+ */
+cuc::Type::Type(const QString& id, QObject* parent) : QObject(parent), d(new Private{id, cucd::find_type(id)})
 {
 }
 
@@ -47,18 +116,14 @@ cuc::Type& cuc::Type::operator=(const cuc::Type& rhs)
 
 bool cuc::Type::operator==(const cuc::Type& rhs) const
 {
-    if (d == rhs.d)
-        return true;
-
-    return d->id == rhs.d->id;
+    if (d->index < 0 || rhs.d->index < 0)
+        return d->id == rhs.d->id;
+    return d->index == rhs.d->index;
 }
 
 bool cuc::Type::operator!=(const cuc::Type& rhs) const
 {
-    if (d == rhs.d)
-        return false;
-
-    return d->id != rhs.d->id;
+    return not (*this == rhs);
 }
 
 bool cuc::Type::operator<(const cuc::Type& rhs) const
@@ -71,6 +136,11 @@ const QString& cuc::Type::id() const
     return d->id;
 }
 
+int cuc::Type::index() const
+{
+    return d->index;
+}
+
 const cuc::Type& cuc::Type::unknown()
 {
     static cuc::Type t("unknown", nullptr);
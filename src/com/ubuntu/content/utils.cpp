@@ -22,10 +22,13 @@
 #include <QFileInfo>
 #include <QMap>
 #include <QMimeData>
+#include <QMimeDatabase>
 #include <QProcess>
 #include <QtCore>
+#include <QtEndian>
 #include <QtDBus/QDBusMessage>
 #include <QtDBus/QDBusConnection>
+#include <QtDBus/QDBusUnixFileDescriptor>
 #include <QUrl>
 #include <nih/alloc.h>
 #include <nih-dbus/dbus_util.h>
@@ -33,6 +36,14 @@
 #include "common.h"
 #include "debug.h"
 #include "com/ubuntu/content/type.h"
+#include "detail/type_table.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <functional>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 #include <liblibertine/libertine.h>
 #include <ubuntu-app-launch/appid.h>
@@ -40,6 +51,7 @@
 #include <ubuntu-app-launch/registry.h>
 
 #include <sys/apparmor.h>
+#include <zlib.h>
 /* need to be exposed in libapparmor but for now ... */
 #define AA_CLASS_FILE 2
 #define AA_MAY_READ (1 << 2)
@@ -53,6 +65,11 @@ namespace {
 const int maxFormatsCount = 16;
 const int maxBufferSize = 4 * 1024 * 1024;  // 4 Mb
 
+/* Used when walking unpacked downloads */
+const int maxWalkItems = 10000;
+const int maxWalkDepth = 16;
+const int walkBatchSize = 64;
+
 /*
   Data format:
    number of mime types      (sizeof(int))
@@ -105,39 +122,514 @@ QByteArray serializeMimeData(const QMimeData &mimeData)
     return serializedMimeData;
 }
 
-QMimeData *deserializeMimeData(const QByteArray &serializedMimeData)
+/*
+  Data format v2, all integers little endian:
+   header                    (16 bytes)
+     magic                   (4 bytes, "CHP2")
+     version                 (2 bytes)
+     flags                   (2 bytes)
+     number of mime types    (4 bytes)
+     reserved                (4 bytes)
+   index, sorted by name     (32 bytes * number of mime types)
+     name offset             (8 bytes)
+     name size               (4 bytes)
+     flags                   (4 bytes)
+     data offset             (8 bytes)
+     data size               (8 bytes)
+   names and data            (each starting on an 8 byte boundary)
+
+  The magic can never be a valid v1 format count, which is how
+  readers tell the two apart.
+*/
+const quint32 pasteFormatMagic = 0x32504843;
+const quint16 pasteFormatVersion = 2;
+const int pasteHeaderSize = 16;
+const int pasteEntrySize = 32;
+const int pasteAlignment = 8;
+
+/* Advertised by the service through PasteCapabilities() */
+const QLatin1String pasteCapabilityV2("paste-format-v2");
+const QLatin1String pasteCapabilityZlib("paste-compression-zlib");
+
+/* Entry flags */
+const quint32 pasteEntryZlib = 0x1;
+
+/* Formats smaller than this aren't worth compressing */
+const int pasteCompressionThreshold = 4 * 1024;
+/* How much of a format is test compressed before doing all of it */
+const int pasteCompressionSample = 16 * 1024;
+/* A format is kept compressed only if it shrinks below this ratio */
+const double pasteCompressionRatio = 0.9;
+/* Upper bound on what all formats of one paste may expand to */
+const int maxUncompressedSize = 4 * maxBufferSize;
+
+/* Text and uncompressed images, everything else (png, jpeg, ...)
+ * is usually compressed already
+ */
+bool paste_format_compressible(const QByteArray &format)
 {
-    if (static_cast<std::size_t>(serializedMimeData.size()) < sizeof(int)) {
-        // Data is invalid
-        return nullptr;
+    return format.startsWith("text/")
+        || format == "image/bmp"
+        || format == "application/x-qt-image";
+}
+
+/* Returns the zlib stream when compressing pays off, otherwise an
+ * empty array.  qCompress() prefixes the stream with the big endian
+ * uncompressed size, which qUncompress() relies on.
+ */
+QByteArray compress_paste_format(const QByteArray &format, const QByteArray &data)
+{
+    if (data.size() < pasteCompressionThreshold || data.size() > maxUncompressedSize
+        || not paste_format_compressible(format))
+        return QByteArray();
+
+    if (data.size() > 2 * pasteCompressionSample) {
+        const QByteArray sample = QByteArray::fromRawData(data.constData(), pasteCompressionSample);
+        if (qCompress(sample, 1).size() > pasteCompressionSample * pasteCompressionRatio)
+            return QByteArray();
     }
 
-    QMimeData *mimeData = new QMimeData;
+    QByteArray compressed = qCompress(data);
+    if (compressed.size() > data.size() * pasteCompressionRatio)
+        return QByteArray();
+    return compressed;
+}
 
-    const char* const buffer = serializedMimeData.constData();
-    const int* const header = reinterpret_cast<const int*>(serializedMimeData.constData());
+/* The size a compressed format claims to expand to, -1 if it can't */
+qint64 uncompressed_paste_size(const char *data, qint64 size)
+{
+    if (size < 4)
+        return -1;
+    return qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(data));
+}
 
-    const int count = qMin(header[0], maxFormatsCount);
+/* Inflates a qCompress() stream.  Unlike qUncompress(), which keeps
+ * growing its buffer, nothing past the size prefix is produced, a
+ * stream that expands further is rejected.
+ */
+QByteArray uncompress_paste_format(const char *data, qint64 size)
+{
+    const qint64 expected = uncompressed_paste_size(data, size);
+    if (expected < 0 || expected > maxUncompressedSize)
+        return QByteArray();
 
-    for (int i = 0; i < count; i++) {
-        const int formatOffset = header[i*4+1];
-        const int formatSize = header[i*4+2];
-        const int dataOffset = header[i*4+3];
-        const int dataSize = header[i*4+4];
+    QByteArray result(int(expected), Qt::Uninitialized);
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit(&stream) != Z_OK)
+        return QByteArray();
 
-        if (formatOffset + formatSize <= serializedMimeData.size()
-            && dataOffset + dataSize <= serializedMimeData.size()) {
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data + 4));
+    stream.avail_in = uInt(size - 4);
+    stream.next_out = reinterpret_cast<Bytef*>(result.data());
+    stream.avail_out = uInt(expected);
+    const int rc = inflate(&stream, Z_FINISH);
+    const qint64 produced = stream.total_out;
+    inflateEnd(&stream);
+
+    if (rc != Z_STREAM_END || produced != expected)
+        return QByteArray();
+    return result;
+}
 
-            QString mimeType = QString::fromLatin1(&buffer[formatOffset], formatSize);
-            QByteArray mimeDataBytes(&buffer[dataOffset], dataSize);
+qint64 align_paste_offset(qint64 offset)
+{
+    return (offset + pasteAlignment - 1) & ~qint64(pasteAlignment - 1);
+}
+
+/* With compress set, large text and image formats are stored zlib
+ * compressed when that pays off, see compress_paste_format().  Only
+ * the stored size counts against maxBufferSize.
+ */
+QByteArray serializeMimeDataV2(const QMimeData &mimeData, bool compress = false)
+{
+    QList<QByteArray> names;
+    Q_FOREACH (QString format, mimeData.formats().mid(0, maxFormatsCount))
+        names << format.toLatin1();
+    std::sort(names.begin(), names.end());
 
-            mimeData->setData(mimeType, mimeDataBytes);
+    QList<QByteArray> datas;
+    QVector<quint32> flags(names.size(), 0);
+    qint64 bufferSize = pasteHeaderSize + qint64(names.size()) * pasteEntrySize;
+    qint64 uncompressedSize = 0;
+    for (int i = 0; i < names.size(); i++) {
+        datas << mimeData.data(QString::fromLatin1(names[i]));
+        uncompressedSize += datas[i].size();
+        if (compress) {
+            QByteArray compressed = compress_paste_format(names[i], datas[i]);
+            if (not compressed.isEmpty()) {
+                datas[i] = compressed;
+                flags[i] |= pasteEntryZlib;
+            }
         }
+        bufferSize = align_paste_offset(bufferSize) + names[i].size();
+        bufferSize = align_paste_offset(bufferSize) + datas[i].size();
     }
 
-    return mimeData;
+    if (bufferSize > maxBufferSize || uncompressedSize > maxUncompressedSize) {
+        qWarning("Not sending contents (%lld bytes) to the global clipboard as it's"
+                " bigger than the maximum allowed size of %d bytes", qMax(bufferSize, uncompressedSize),
+                bufferSize > maxBufferSize ? maxBufferSize : maxUncompressedSize);
+        return QByteArray();
+    }
+
+    QByteArray serializedMimeData(bufferSize, '\0');
+    uchar *buffer = reinterpret_cast<uchar*>(serializedMimeData.data());
+    qToLittleEndian<quint32>(pasteFormatMagic, buffer);
+    qToLittleEndian<quint16>(pasteFormatVersion, buffer + 4);
+    qToLittleEndian<quint16>(0, buffer + 6);
+    qToLittleEndian<quint32>(names.size(), buffer + 8);
+    qToLittleEndian<quint32>(0, buffer + 12);
+
+    qint64 offset = pasteHeaderSize + qint64(names.size()) * pasteEntrySize;
+    for (int i = 0; i < names.size(); i++) {
+        uchar *entry = buffer + pasteHeaderSize + i * pasteEntrySize;
+        const qint64 nameOffset = align_paste_offset(offset);
+        const qint64 dataOffset = align_paste_offset(nameOffset + names[i].size());
+        memcpy(buffer + nameOffset, names[i].constData(), names[i].size());
+        memcpy(buffer + dataOffset, datas[i].constData(), datas[i].size());
+        qToLittleEndian<quint64>(nameOffset, entry);
+        qToLittleEndian<quint32>(names[i].size(), entry + 8);
+        qToLittleEndian<quint32>(flags[i], entry + 12);
+        qToLittleEndian<quint64>(dataOffset, entry + 16);
+        qToLittleEndian<quint64>(datas[i].size(), entry + 24);
+        offset = dataOffset + datas[i].size();
+    }
+
+    return serializedMimeData;
 }
 
+/* Read-only access to serialized mime data of either version.
+ *
+ * Nothing is copied, formats and data are handed out as
+ * QByteArray::fromRawData slices of the serialized buffer, which
+ * the view keeps a reference to.  The slices must not outlive it.
+ * Compressed formats are the exception, data() inflates those into
+ * a fresh array.
+ */
+class MimeDataView
+{
+public:
+    explicit MimeDataView(const QByteArray &serializedMimeData)
+        : m_buffer(serializedMimeData), m_version(0), m_sorted(false)
+    {
+        if (static_cast<std::size_t>(m_buffer.size()) >= pasteHeaderSize
+            && qFromLittleEndian<quint32>(bytes()) == pasteFormatMagic)
+            parse_v2();
+        else if (static_cast<std::size_t>(m_buffer.size()) >= sizeof(int))
+            parse_v1();
+    }
+
+    bool isValid() const { return m_version != 0; }
+    int version() const { return m_version; }
+    int count() const { return m_entries.size(); }
+
+    QByteArray name(int i) const
+    {
+        const Entry &e = m_entries.at(i);
+        return QByteArray::fromRawData(m_buffer.constData() + e.nameOffset, e.nameSize);
+    }
+
+    QString format(int i) const
+    {
+        const Entry &e = m_entries.at(i);
+        return QString::fromLatin1(m_buffer.constData() + e.nameOffset, e.nameSize);
+    }
+
+    QByteArray data(int i) const
+    {
+        const Entry &e = m_entries.at(i);
+        if (e.flags & pasteEntryZlib)
+            return uncompress_paste_format(m_buffer.constData() + e.dataOffset, e.dataSize);
+        return rawData(i);
+    }
+
+    /* The stored bytes, still compressed if isCompressed(i) */
+    QByteArray rawData(int i) const
+    {
+        const Entry &e = m_entries.at(i);
+        return QByteArray::fromRawData(m_buffer.constData() + e.dataOffset, e.dataSize);
+    }
+
+    bool isCompressed(int i) const { return m_entries.at(i).flags & pasteEntryZlib; }
+
+    bool hasCompressedFormats() const
+    {
+        for (int i = 0; i < m_entries.size(); i++) {
+            if (isCompressed(i))
+                return true;
+        }
+        return false;
+    }
+
+    int indexOf(const QString &format) const
+    {
+        const QByteArray wanted = format.toLatin1();
+        if (m_sorted) {
+            int lo = 0, hi = m_entries.size() - 1;
+            while (lo <= hi) {
+                int mid = (lo + hi) / 2;
+                int cmp = compare(name(mid), wanted);
+                if (cmp == 0)
+                    return mid;
+                if (cmp < 0)
+                    lo = mid + 1;
+                else
+                    hi = mid - 1;
+            }
+            return -1;
+        }
+
+        for (int i = 0; i < m_entries.size(); i++) {
+            if (name(i) == wanted)
+                return i;
+        }
+        return -1;
+    }
+
+    bool hasFormat(const QString &format) const { return indexOf(format) >= 0; }
+
+    QByteArray data(const QString &format) const
+    {
+        int i = indexOf(format);
+        return i < 0 ? QByteArray() : data(i);
+    }
+
+    QStringList formats() const
+    {
+        QStringList result;
+        for (int i = 0; i < m_entries.size(); i++)
+            result << format(i);
+        return result;
+    }
+
+    /* Copies everything out, the result owns its data */
+    QMimeData *toMimeData() const
+    {
+        QMimeData *mimeData = new QMimeData;
+        for (int i = 0; i < m_entries.size(); i++) {
+            if (isCompressed(i)) {
+                mimeData->setData(format(i), data(i));
+            } else {
+                const Entry &e = m_entries.at(i);
+                mimeData->setData(format(i), QByteArray(m_buffer.constData() + e.dataOffset, e.dataSize));
+            }
+        }
+        return mimeData;
+    }
+
+private:
+    struct Entry
+    {
+        qint64 nameOffset;
+        qint64 nameSize;
+        qint64 dataOffset;
+        qint64 dataSize;
+        quint32 flags;
+    };
+
+    const uchar *bytes() const { return reinterpret_cast<const uchar*>(m_buffer.constData()); }
+
+    static int compare(const QByteArray &a, const QByteArray &b)
+    {
+        int cmp = memcmp(a.constData(), b.constData(), qMin(a.size(), b.size()));
+        return cmp != 0 ? cmp : a.size() - b.size();
+    }
+
+    bool in_bounds(qint64 offset, qint64 size) const
+    {
+        return offset >= 0 && size >= 0 && size <= m_buffer.size() && offset <= m_buffer.size() - size;
+    }
+
+    void parse_v1()
+    {
+        const int* const header = reinterpret_cast<const int*>(m_buffer.constData());
+        const int count = qMin(header[0], maxFormatsCount);
+        const qint64 headerSize = sizeof(int) + qint64(qMax(count, 0)) * 4 * sizeof(int);
+        m_version = 1;
+        if (headerSize > m_buffer.size())
+            return;
+
+        for (int i = 0; i < count; i++) {
+            Entry e{header[i*4+1], header[i*4+2], header[i*4+3], header[i*4+4], 0};
+            if (in_bounds(e.nameOffset, e.nameSize) && in_bounds(e.dataOffset, e.dataSize))
+                m_entries << e;
+        }
+    }
+
+    /* Entries may neither share bytes nor names, nor expand past
+     * maxUncompressedSize together.  One small compressed blob could
+     * otherwise be inflated once for every entry pointing at it.
+     */
+    void parse_v2()
+    {
+        if (qFromLittleEndian<quint16>(bytes() + 4) != pasteFormatVersion)
+            return;
+
+        const quint32 count = qFromLittleEndian<quint32>(bytes() + 8);
+        if (count > quint32(maxFormatsCount)
+            || count > quint32((m_buffer.size() - pasteHeaderSize) / pasteEntrySize))
+            return;
+
+        m_entries.reserve(count);
+        m_sorted = true;
+        for (quint32 i = 0; i < count; i++) {
+            const uchar *entry = bytes() + pasteHeaderSize + i * pasteEntrySize;
+            const quint64 nameOffset = qFromLittleEndian<quint64>(entry);
+            const quint64 dataOffset = qFromLittleEndian<quint64>(entry + 16);
+            const quint64 dataSize = qFromLittleEndian<quint64>(entry + 24);
+            if (nameOffset > quint64(m_buffer.size()) || dataOffset > quint64(m_buffer.size())
+                || dataSize > quint64(m_buffer.size())) {
+                m_entries.clear();
+                return;
+            }
+            Entry e{qint64(nameOffset), qFromLittleEndian<quint32>(entry + 8),
+                    qint64(dataOffset), qint64(dataSize), qFromLittleEndian<quint32>(entry + 12)};
+            if (not in_bounds(e.nameOffset, e.nameSize) || not in_bounds(e.dataOffset, e.dataSize)) {
+                m_entries.clear();
+                return;
+            }
+            m_entries << e;
+            if (i > 0 && compare(name(i - 1), name(i)) >= 0)
+                m_sorted = false;
+        }
+
+        if (not entries_are_disjoint(pasteHeaderSize + qint64(count) * pasteEntrySize)) {
+            m_entries.clear();
+            return;
+        }
+
+        QSet<QByteArray> names;
+        qint64 uncompressedSize = 0;
+        for (int i = 0; i < m_entries.size(); i++) {
+            const Entry &e = m_entries.at(i);
+            const qint64 size = (e.flags & pasteEntryZlib)
+                ? uncompressed_paste_size(m_buffer.constData() + e.dataOffset, e.dataSize)
+                : e.dataSize;
+            uncompressedSize += size;
+            if (size < 0 || uncompressedSize > maxUncompressedSize || names.contains(name(i))) {
+                m_entries.clear();
+                return;
+            }
+            names.insert(name(i));
+        }
+        m_version = 2;
+    }
+
+    /* Names and data of all entries lie past the entry table, one
+     * after the other
+     */
+    bool entries_are_disjoint(qint64 tableEnd) const
+    {
+        QVector<QPair<qint64, qint64>> ranges;
+        ranges.reserve(m_entries.size() * 2);
+        Q_FOREACH (const Entry &e, m_entries) {
+            ranges << qMakePair(e.nameOffset, e.nameSize) << qMakePair(e.dataOffset, e.dataSize);
+        }
+        std::sort(ranges.begin(), ranges.end());
+
+        qint64 end = tableEnd;
+        for (int i = 0; i < ranges.size(); i++) {
+            if (ranges[i].second == 0)
+                continue;
+            if (ranges[i].first < end)
+                return false;
+            end = ranges[i].first + ranges[i].second;
+        }
+        return true;
+    }
+
+    QByteArray m_buffer;
+    QVector<Entry> m_entries;
+    int m_version;
+    bool m_sorted;
+};
+
+/* What readers get back from deserializeMimeData().  A format is
+ * only copied out of the serialized buffer, or inflated, once it is
+ * asked for, so reading the text of a paste that also carries a
+ * large image never touches the image.  Data set later wins.
+ */
+class PastedMimeData : public QMimeData
+{
+public:
+    explicit PastedMimeData(const QByteArray &serializedMimeData)
+        : m_view(serializedMimeData)
+    {
+    }
+
+    bool isValid() const { return m_view.isValid(); }
+
+    QStringList formats() const override
+    {
+        QStringList result = m_view.formats();
+        Q_FOREACH (const QString &format, QMimeData::formats()) {
+            if (not result.contains(format))
+                result << format;
+        }
+        return result;
+    }
+
+protected:
+    QVariant retrieveData(const QString &mimeType, QVariant::Type type) const override
+    {
+        if (QMimeData::formats().contains(mimeType))
+            return QMimeData::retrieveData(mimeType, type);
+
+        const int i = m_view.indexOf(mimeType);
+        if (i < 0)
+            return QVariant();
+        if (m_view.isCompressed(i))
+            return m_view.data(i);
+
+        /* The view hands out slices, the caller may outlive it */
+        const QByteArray slice = m_view.rawData(i);
+        return QByteArray(slice.constData(), slice.size());
+    }
+
+private:
+    MimeDataView m_view;
+};
+
+/* Accepts both v1 and v2 data */
+QMimeData *deserializeMimeData(const QByteArray &serializedMimeData)
+{
+    QScopedPointer<PastedMimeData> mimeData(new PastedMimeData(serializedMimeData));
+    if (not mimeData->isValid())
+        return nullptr;
+
+    return mimeData.take();
+}
+
+/* Rewrites v2 data as v1 for readers that predate it */
+QByteArray convertMimeDataToV1(const QByteArray &serializedMimeData)
+{
+    MimeDataView view(serializedMimeData);
+    if (view.version() != 2)
+        return serializedMimeData;
+
+    QScopedPointer<QMimeData> mimeData(view.toMimeData());
+    return serializeMimeData(*mimeData);
+}
+
+/* Rewrites paste data into something a reader with the given
+ * capabilities understands, leaving it alone when it already does.
+ */
+QByteArray convertMimeDataForReader(const QByteArray &serializedMimeData, const QStringList &capabilities)
+{
+    if (not capabilities.contains(pasteCapabilityV2))
+        return convertMimeDataToV1(serializedMimeData);
+
+    if (capabilities.contains(pasteCapabilityZlib))
+        return serializedMimeData;
+
+    MimeDataView view(serializedMimeData);
+    if (view.version() != 2 || not view.hasCompressedFormats())
+        return serializedMimeData;
+
+    QScopedPointer<QMimeData> mimeData(view.toMimeData());
+    return serializeMimeDataV2(*mimeData);
+}
 
 QList<cuc::Type> known_types()
 {
@@ -154,15 +646,20 @@ QList<cuc::Type> known_types()
     return types;
 }
 
-bool valid_type(cuc::Type type)
+/* The well-known type for a KnownTypeIndex, unknown for anything else */
+cuc::Type known_type(int index)
 {
     Q_FOREACH (cuc::Type t, known_types())
     {
-        TRACE() << Q_FUNC_INFO << t.id();
-        if (t.id() == type.id())
-            return true;
+        if (t.index() == index)
+            return t;
     }
-    return false;
+    return cuc::Type::unknown();
+}
+
+bool valid_type(cuc::Type type)
+{
+    return com::ubuntu::content::detail::is_well_known_type(type.index());
 }
 
 /* sanitize the dbus names */
@@ -272,6 +769,19 @@ QString aa_profile(QString uniqueConnectionId)
     return aaProfile;
 }
 
+/* Whether the peer behind a connection runs as id, unconfined peers
+ * may read anything anyway
+ */
+bool peer_runs_as(const QString& uniqueConnectionId, const QString& id)
+{
+    /* Test peers run without AppArmor */
+    if (!qgetenv("CONTENT_HUB_TESTING").isNull())
+        return true;
+
+    const QString profile = aa_profile(uniqueConnectionId);
+    return profile == QLatin1String("unconfined") || profile == id;
+}
+
 bool is_persistent(QString store)
 {
     TRACE() << Q_FUNC_INFO << store;
@@ -281,24 +791,45 @@ bool is_persistent(QString store)
     return not rx.exactMatch(store);
 }
 
-QString copy_to_store(const QString& src, const QString& store)
+/* Enough for the magic rules of every common format */
+const int sniffSize = 4096;
+
+/* Detects the type of a local file from its name and first few
+ * bytes, the rest of the file is never read.  Only regular files are
+ * read, symlinks, FIFOs and devices are typed by name alone.  The
+ * header is read from fd when the file is open already.
+ */
+QString sniff_mime_type(const QString& path, int fd = -1)
 {
-    TRACE() << Q_FUNC_INFO;
-    QUrl srcUrl(src);
-    if (not srcUrl.isLocalFile())
-        return srcUrl.url();
+    QByteArray header;
+    int opened = -1;
+    if (fd < 0)
+        fd = opened = open(QFile::encodeName(path).constData(),
+                           O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NOFOLLOW | O_NONBLOCK);
 
-    QFileInfo fi(srcUrl.toLocalFile());
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+    {
+        header.resize(sniffSize);
+        ssize_t n = pread(fd, header.data(), sniffSize, 0);
+        header.truncate(n < 0 ? 0 : int(n));
+    }
+    if (opened >= 0)
+        close(opened);
 
-    QDir st(store);
-    if (not st.exists())
-        st.mkpath(st.absolutePath());
+    static const QMimeDatabase db;
+    return db.mimeTypeForFileNameAndData(path, header).name();
+}
+
+/* Picks a path for fi in store that isn't taken yet by inserting an
+ * incremented number into the file name.
+ */
+QString unique_store_path(const QFileInfo& fi, const QString& store)
+{
     QString suffix = fi.completeSuffix();
     QString filename = fi.fileName();
     QString filenameWithoutSuffix = filename.left(filename.size() - suffix.size());
     QString destFilePath = store + QDir::separator() + filenameWithoutSuffix + suffix;
-    // Avoid filename collision by automatically inserting an incremented
-    // number into the filename if the original name already exists.
     if (QFile::exists(destFilePath)) {
         qWarning() << "Destination file already exists, attempt to resolve:" << destFilePath;
         int append = 1;
@@ -307,26 +838,334 @@ QString copy_to_store(const QString& src, const QString& store)
             append++;
         } while (QFile::exists(destFilePath));
     }
-    TRACE() << Q_FUNC_INFO << destFilePath;
-    bool copy_failed = true;
-    if (not is_persistent(store))
+    return destFilePath;
+}
+
+/* Shares the blocks of src on filesystems that can (btrfs, xfs),
+ * copies otherwise.  Either way dest can change without touching src.
+ */
+bool clone_or_copy(const QString& src, const QString& dest)
+{
+#ifdef FICLONE
+    int in = open(QFile::encodeName(src).constData(), O_RDONLY | O_CLOEXEC);
+    if (in >= 0)
     {
-        if (link( fi.absoluteFilePath().toStdString().c_str(),
-            destFilePath.toStdString().c_str() ) < 0)
+        struct stat st;
+        bool cloned = false;
+        int out = -1;
+        if (fstat(in, &st) == 0)
+            out = open(QFile::encodeName(dest).constData(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 0777);
+        if (out >= 0)
         {
-            qWarning() << "Can't create hard link to Store:" << store;
-        } else
-            copy_failed = false;
+            cloned = ioctl(out, FICLONE, in) == 0;
+            close(out);
+            if (not cloned)
+                unlink(QFile::encodeName(dest).constData());
+        }
+        close(in);
+        if (cloned)
+            return true;
+    }
+#endif
+    return QFile::copy(src, dest);
+}
+
+/* Hard links cost nothing but need src and dest on one filesystem */
+bool link_or_copy(const QString& src, const QString& dest)
+{
+    if (link(QFile::encodeName(src).constData(), QFile::encodeName(dest).constData()) == 0)
+        return true;
+    return clone_or_copy(src, dest);
+}
+
+/* Identifies the file a handed off item was charged with */
+struct FileIdentity
+{
+    quint64 device = 0;
+    quint64 inode = 0;
+
+    bool isValid() const { return inode != 0; }
+    bool operator==(const FileIdentity& rhs) const { return device == rhs.device && inode == rhs.inode; }
+};
+
+/* Opens a regular file read only so it can be handed to another app,
+ * the caller has made sure the owner of the transfer may read it.
+ * Symlinks aren't followed and FIFOs or devices can't block the
+ * service.  A valid expected identity must match the file opened,
+ * the path may have been swapped since it was checked.
+ */
+QDBusUnixFileDescriptor open_for_handoff(const QString& path,
+                                         const FileIdentity& expected = FileIdentity(),
+                                         FileIdentity* opened = nullptr)
+{
+    int fd = open(QFile::encodeName(path).constData(),
+                  O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NOFOLLOW | O_NONBLOCK);
+    if (fd < 0)
+        return QDBusUnixFileDescriptor();
+
+    struct stat st;
+    FileIdentity identity;
+    bool ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    if (ok)
+    {
+        identity.device = st.st_dev;
+        identity.inode = st.st_ino;
+        ok = not expected.isValid() || identity == expected;
     }
-    if (copy_failed)
+    if (not ok)
+    {
+        close(fd);
+        return QDBusUnixFileDescriptor();
+    }
+
+    /* Reads block as usual for the destination */
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    if (opened)
+        *opened = identity;
+
+    /* QDBusUnixFileDescriptor keeps a dup */
+    QDBusUnixFileDescriptor result(fd);
+    close(fd);
+    return result;
+}
+
+QString copy_to_store(const QString& src, const QString& store)
+{
+    TRACE() << Q_FUNC_INFO;
+    QUrl srcUrl(src);
+    if (not srcUrl.isLocalFile())
+        return srcUrl.url();
+
+    QFileInfo fi(srcUrl.toLocalFile());
+
+    QDir st(store);
+    if (not st.exists())
+        st.mkpath(st.absolutePath());
+    // Avoid filename collision by automatically inserting an incremented
+    // number into the filename if the original name already exists.
+    QString destFilePath = unique_store_path(fi, store);
+    TRACE() << Q_FUNC_INFO << destFilePath;
+    /* Persistent stores get their own copy, the source app may
+     * still change the original.
+     */
+    bool ok = is_persistent(store) ? clone_or_copy(fi.absoluteFilePath(), destFilePath)
+                                   : link_or_copy(fi.absoluteFilePath(), destFilePath);
+    if (not ok)
+        qWarning() << "Failed to copy to Store:" << store;
+
+    return QUrl::fromLocalFile(destFilePath).toString();
+}
+
+/* Copies an already opened file into store, named after path */
+QString copy_opened_to_store(int fd, const QString& path, const QString& store)
+{
+    TRACE() << Q_FUNC_INFO << path;
+
+    if (not QDir().mkpath(store))
+        return QString();
+
+    QFile in;
+    if (not in.open(fd, QIODevice::ReadOnly, QFileDevice::DontCloseHandle))
+        return QString();
+
+    const QString destFilePath = unique_store_path(QFileInfo(path), store);
+    QFile out(destFilePath);
+    if (not out.open(QIODevice::WriteOnly))
+        return QString();
+
+    QByteArray buffer(64 * 1024, Qt::Uninitialized);
+    for (qint64 n = in.read(buffer.data(), buffer.size()); n != 0; n = in.read(buffer.data(), buffer.size()))
     {
-        if (not QFile::copy(fi.filePath(), destFilePath))
-            qWarning() << "Failed to copy to Store:" << store;
+        if (n < 0 || out.write(buffer.constData(), n) != n)
+        {
+            qWarning() << "Failed to copy" << path << "to Store:" << store;
+            out.remove();
+            return QString();
+        }
     }
 
     return QUrl::fromLocalFile(destFilePath).toString();
 }
 
+/* Places the local files among urls in store in one pass and returns
+ * the paths they got there, anything else is skipped.  Files coming
+ * from a transient store are linked rather than copied, the store is
+ * purged once the transfer is done anyway.
+ */
+QStringList deliver_to_store(const QList<QUrl>& urls, const QString& store)
+{
+    TRACE() << Q_FUNC_INFO << store << urls.size();
+
+    QStringList paths;
+    if (not QDir().mkpath(store))
+    {
+        qWarning() << "Can't create store:" << store;
+        return paths;
+    }
+
+    paths.reserve(urls.size());
+    Q_FOREACH (const QUrl& url, urls)
+    {
+        if (not url.isLocalFile())
+            continue;
+
+        QFileInfo fi(url.toLocalFile());
+        QString dest = unique_store_path(fi, store);
+        bool ok = is_persistent(fi.absolutePath()) ? clone_or_copy(fi.absoluteFilePath(), dest)
+                                                   : link_or_copy(fi.absoluteFilePath(), dest);
+        if (ok)
+            paths << dest;
+        else
+            qWarning() << "Failed to deliver" << fi.absoluteFilePath() << "to" << store;
+    }
+    return paths;
+}
+
+/* Layout of the records returned by getdents64 */
+struct linux_dirent64
+{
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/* Walks the tree below root without recursion.  Each next() hands out
+ * the following regular files, at most walkBatchSize paths, and an empty
+ * list once the walk is done.  Symlinks are not followed.  The walk stops
+ * after maxItems files or below maxDepth levels.
+ */
+class DirectoryWalker
+{
+  public:
+    DirectoryWalker(const QString& root,
+                    int maxItems = maxWalkItems,
+                    int maxDepth = maxWalkDepth)
+        : maxItems(maxItems),
+          maxDepth(maxDepth),
+          handedOut(0)
+    {
+        TRACE() << Q_FUNC_INFO << root;
+        pending.append(PendingDir{QFile::encodeName(root), 0});
+    }
+
+    QStringList next()
+    {
+        QStringList batch;
+        while (batch.size() < walkBatchSize && handedOut < maxItems && more())
+        {
+            batch.append(QFile::decodeName(files.takeFirst()));
+            handedOut++;
+        }
+        return batch;
+    }
+
+    int count() const
+    {
+        return handedOut;
+    }
+
+    /* Whether a file is left, reads ahead as far as needed to know */
+    bool more()
+    {
+        while (files.isEmpty() && not pending.isEmpty())
+            read_directory(pending.takeLast());
+        return not files.isEmpty();
+    }
+
+  private:
+    struct PendingDir
+    {
+        QByteArray path;
+        int depth;
+    };
+
+    void read_directory(const PendingDir& dir)
+    {
+        int fd = openat(AT_FDCWD, dir.path.constData(),
+                        O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0)
+        {
+            qWarning() << "Failed to open directory:" << dir.path << strerror(errno);
+            return;
+        }
+
+        QList<QByteArray> names;
+        QList<QByteArray> subdirs;
+        long nread;
+        while ((nread = syscall(SYS_getdents64, fd, buffer, sizeof(buffer))) > 0)
+        {
+            for (long pos = 0; pos < nread;)
+            {
+                auto entry = reinterpret_cast<struct linux_dirent64*>(buffer + pos);
+                pos += entry->d_reclen;
+
+                const char* name = entry->d_name;
+                if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+                    continue;
+
+                unsigned char type = entry->d_type;
+                if (type == DT_UNKNOWN)
+                {
+                    struct stat st;
+                    if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+                        continue;
+                    if (S_ISDIR(st.st_mode))
+                        type = DT_DIR;
+                    else if (S_ISREG(st.st_mode))
+                        type = DT_REG;
+                }
+
+                if (type == DT_REG)
+                    names.append(QByteArray(name));
+                else if (type == DT_DIR && dir.depth < maxDepth)
+                    subdirs.append(QByteArray(name));
+            }
+        }
+        if (nread < 0)
+            qWarning() << "Failed to read directory:" << dir.path << strerror(errno);
+        close(fd);
+
+        /* getdents64 returns entries in no particular order */
+        std::sort(names.begin(), names.end());
+        std::sort(subdirs.begin(), subdirs.end());
+
+        Q_FOREACH (const QByteArray& name, names)
+            files.append(dir.path + '/' + name);
+
+        /* Pushed in reverse so that the first subdirectory is walked next */
+        for (int i = subdirs.size() - 1; i >= 0; i--)
+            pending.append(PendingDir{dir.path + '/' + subdirs[i], dir.depth + 1});
+    }
+
+    const int maxItems;
+    const int maxDepth;
+    int handedOut;
+    /* Files of the directory being walked that weren't handed out yet */
+    QList<QByteArray> files;
+    QVector<PendingDir> pending;
+    char buffer[32 * 1024];
+};
+
+/* Walks all of root in one go, handing the files found to for_batch.
+ * Returns the number of files handed out.
+ */
+int walk_directory(const QString& root,
+                   const std::function<void(const QStringList&)>& for_batch,
+                   int maxItems = maxWalkItems,
+                   int maxDepth = maxWalkDepth)
+{
+    DirectoryWalker walker(root, maxItems, maxDepth);
+    for (QStringList batch = walker.next(); not batch.isEmpty(); batch = walker.next())
+        for_batch(batch);
+
+    if (walker.more())
+        qWarning() << "Stopped walking" << root << "after" << walker.count() << "items";
+
+    return walker.count();
+}
+
 bool purge_store_cache(QString store)
 {
     TRACE() << Q_FUNC_INFO << "Store:" << store;
@@ -30,6 +30,7 @@
 #include <com/ubuntu/content/import_export_handler.h>
 
 #include "com/ubuntu/content/utils.cpp"
+#include "com/ubuntu/content/transfer_p.h"
 #include "com/ubuntu/content/detail/peer_registry.h"
 #include "com/ubuntu/content/detail/service.h"
 #include "com/ubuntu/content/serviceadaptor.h"
@@ -160,3 +161,136 @@ TEST(Handler, handler_on_bus)
 
     EXPECT_TRUE(test::fork_and_run(child, parent) != EXIT_FAILURE);
 }
+
+TEST(Handler, handler_collects_from_snapshot_sent_over_bus)
+{
+    using namespace ::testing;
+
+    QString default_peer_id{"com.does.not.exist.anywhere.application"};
+    QString default_dest_peer_id{"com.also.does.not.exist.anywhere.application"};
+
+    test::CrossProcessSync sync;
+
+    auto parent = [&sync]()
+    {
+        int argc = 0;
+        QCoreApplication app{argc, nullptr};
+
+        QDBusConnection connection = QDBusConnection::sessionBus();
+
+        QSharedPointer<cucd::PeerRegistry> registry{new NiceMock<MockedPeerRegistry>{}};
+        auto app_manager = QSharedPointer<cua::ApplicationManager>(new MockedAppManager());
+        cucd::Service implementation(connection, registry, app_manager, &app);
+        new ServiceAdaptor(std::addressof(implementation));
+
+        connection.registerService(service_name);
+        connection.registerObject("/", (std::addressof(implementation)));
+
+        QObject::connect(&app, &QCoreApplication::aboutToQuit, [&](){
+            connection.unregisterObject("/");
+            connection.unregisterService(service_name);
+        });
+
+        sync.signal_ready();
+
+        app.exec();
+    };
+
+    auto child = [&sync, default_peer_id, default_dest_peer_id]()
+    {
+        sync.wait_for_signal_ready();
+
+        int argc = 0;
+        QCoreApplication app(argc, nullptr);
+
+        test::TestHarness harness;
+        harness.add_test_case([default_peer_id, default_dest_peer_id]()
+        {
+            QVector<cuc::Item> items;
+            items << cuc::Item() << cuc::Item();
+            items[0].setText("data1");
+            items[1].setText("data2");
+
+            QVector<cuc::Item> collected;
+            cuc::Transfer::State state_after_collect = cuc::Transfer::created;
+            bool handled = false;
+
+            /* The destination's handler gets the snapshot with the call */
+            auto mock_handler = new MockedHandler{};
+            EXPECT_CALL(*mock_handler, handle_import(_))
+                .Times(Exactly(1))
+                .WillOnce(Invoke([&](cuc::Transfer* t)
+                {
+                    collected = t->collect();
+                    state_after_collect = t->state();
+                    handled = true;
+                }));
+            qputenv("APP_ID", default_dest_peer_id.toLatin1());
+            auto hub = cuc::Hub::Client::instance();
+            hub->register_import_export_handler(mock_handler);
+
+            auto transfer = hub->create_import_from_peer(cuc::Peer(default_peer_id));
+            ASSERT_TRUE(transfer != nullptr);
+            EXPECT_TRUE(transfer->start());
+            EXPECT_TRUE(transfer->charge(items));
+
+            for (int i = 0; i < 50 and not handled; i++)
+                QTest::qWait(100);
+
+            ASSERT_TRUE(handled);
+            EXPECT_EQ(items, collected);
+            /* The service is still told the items were collected */
+            EXPECT_EQ(cuc::Transfer::collected, state_after_collect);
+            hub->quit();
+            delete mock_handler;
+        });
+
+        EXPECT_EQ(0, QTest::qExec(std::addressof(harness)));
+    };
+
+    EXPECT_TRUE(test::fork_and_run(child, parent) != EXIT_FAILURE);
+}
+
+TEST(Handler, transfer_snapshot_answers_without_the_service)
+{
+    using namespace ::testing;
+
+    int argc = 0;
+    QCoreApplication app(argc, nullptr);
+    qDBusRegisterMetaType<cuc::Item>();
+
+    QVariantList items;
+    items << QVariant::fromValue(cuc::Item(QUrl("file:///tmp/file1")));
+    items << QVariant::fromValue(cuc::Item(QUrl("file:///tmp/file2")));
+
+    QVariantMap snapshot;
+    snapshot.insert("id", 42);
+    snapshot.insert("state", int(cuc::Transfer::charged));
+    snapshot.insert("direction", int(cuc::Transfer::Export));
+    snapshot.insert("contentType", cuc::Type::Known::pictures().id());
+    snapshot.insert("store", "/tmp/store");
+    snapshot.insert("selectionType", int(cuc::Transfer::multiple));
+    snapshot.insert("source", "com.does.not.exist.anywhere.application");
+    snapshot.insert("destination", "com.also.does.not.exist.anywhere.application");
+    snapshot.insert("itemCount", items.count());
+    snapshot.insert("items", items);
+
+    /* Nothing serves this path, every answer has to come from the snapshot */
+    auto transfer = cuc::Transfer::Private::make_transfer(
+        QDBusObjectPath{"/transfers/does/not/exist"}, nullptr, snapshot);
+
+    EXPECT_EQ(42, transfer->id());
+    EXPECT_EQ(cuc::Transfer::charged, transfer->state());
+    EXPECT_EQ(cuc::Transfer::Export, transfer->direction());
+    EXPECT_EQ(cuc::Type::Known::pictures().id(), transfer->contentType());
+    EXPECT_EQ(QString("/tmp/store"), transfer->store().uri());
+    EXPECT_EQ(cuc::Transfer::multiple, transfer->selectionType());
+
+    QVector<cuc::Item> expected_items;
+    expected_items << cuc::Item(QUrl("file:///tmp/file1")) << cuc::Item(QUrl("file:///tmp/file2"));
+    EXPECT_EQ(expected_items, transfer->collect());
+    /* Collecting moves the state on, it is asked for again */
+    EXPECT_EQ(cuc::Transfer::aborted, transfer->state());
+
+    delete transfer;
+}
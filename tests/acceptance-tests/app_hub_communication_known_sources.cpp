@@ -26,6 +26,7 @@
 #include <com/ubuntu/content/scope.h>
 #include <com/ubuntu/content/store.h>
 #include <com/ubuntu/content/type.h>
+#include <com/ubuntu/content/transfer.h>
 
 #include "com/ubuntu/content/detail/peer_registry.h"
 #include "com/ubuntu/content/detail/service.h"
@@ -35,10 +36,15 @@
 #include <gtest/gtest.h>
 
 #include <QCoreApplication>
+#include <QElapsedTimer>
 #include <QtDBus/QDBusConnection>
+#include <QtDBus/QDBusInterface>
+#include <QtDBus/QDBusPendingCall>
+#include <QtDBus/QDBusReply>
 #include <QStandardPaths>
 #include <QtTest/QTest>
 
+#include <chrono>
 #include <thread>
 
 namespace cua = com::ubuntu::ApplicationManager;
@@ -165,3 +171,162 @@ TEST(Hub, querying_known_peers_returns_correct_value)
 
     EXPECT_TRUE(test::fork_and_run(child, parent) != EXIT_FAILURE);
 }
+
+TEST(Hub, slow_registry_queries_do_not_block_other_calls)
+{
+    using namespace ::testing;
+
+    test::CrossProcessSync sync;
+
+    auto parent = [&sync]()
+    {
+        int argc = 0;
+        QCoreApplication app{argc, nullptr};
+
+        QDBusConnection connection = QDBusConnection::sessionBus();
+
+        auto mock = new MockedPeerRegistry{};
+        EXPECT_CALL(*mock, enumerate_known_sources_for_type(_, _)).
+        Times(Exactly(1)).
+        WillRepeatedly(Invoke([](cuc::Type, const std::function<void(const cuc::Peer&)>& f)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds{1000});
+            f(cuc::Peer("com.does.not.exist.anywhere.application1"));
+        }));
+
+        QSharedPointer<cucd::PeerRegistry> registry{mock};
+
+        auto app_manager = QSharedPointer<cua::ApplicationManager>(new MockedAppManager());
+        cucd::Service implementation(connection, registry, app_manager, &app);
+        new ServiceAdaptor(std::addressof(implementation));
+
+        connection.registerService(service_name);
+        connection.registerObject("/", std::addressof(implementation));
+
+        QObject::connect(&app, &QCoreApplication::aboutToQuit, [&](){
+            connection.unregisterObject("/");
+            connection.unregisterService(service_name);
+        });
+
+        sync.signal_ready();
+
+        app.exec();
+    };
+
+    auto child = [&sync]()
+    {
+        sync.wait_for_signal_ready();
+
+        int argc = 0;
+        QCoreApplication app(argc, nullptr);
+
+        test::TestHarness harness;
+        harness.add_test_case([]()
+        {
+            QDBusInterface service(service_name, "/", "com.ubuntu.content.dbus.Service");
+            QDBusPendingCall slow = service.asyncCall("KnownSourcesForType", cuc::Type::Known::pictures().id());
+
+            QElapsedTimer timer;
+            timer.start();
+            QDBusReply<QStringList> formats = service.call("PasteFormats");
+            EXPECT_TRUE(formats.isValid());
+            EXPECT_GT(500, timer.elapsed());
+
+            slow.waitForFinished();
+            EXPECT_FALSE(slow.isError());
+            EXPECT_LE(900, timer.elapsed());
+        });
+
+        EXPECT_EQ(0, QTest::qExec(std::addressof(harness)));
+
+        cuc::Hub::Client::instance()->quit();
+    };
+
+    EXPECT_TRUE(test::fork_and_run(child, parent) != EXIT_FAILURE);
+}
+
+TEST(Hub, legacy_checks_do_not_wait_for_registry_queries)
+{
+    using namespace ::testing;
+
+    test::CrossProcessSync sync;
+
+    auto parent = [&sync]()
+    {
+        int argc = 0;
+        QCoreApplication app{argc, nullptr};
+
+        QDBusConnection connection = QDBusConnection::sessionBus();
+
+        auto mock = new NiceMock<MockedPeerRegistry>{};
+        EXPECT_CALL(*mock, enumerate_known_sources_for_type(_, _)).
+        Times(Exactly(1)).
+        WillRepeatedly(Invoke([](cuc::Type, const std::function<void(const cuc::Peer&)>&)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds{1000});
+        }));
+        EXPECT_CALL(*mock, peer_is_legacy(_)).
+        Times(AtLeast(1)).
+        WillRepeatedly(Return(false));
+
+        QSharedPointer<cucd::PeerRegistry> registry{mock};
+
+        auto app_manager = QSharedPointer<cua::ApplicationManager>(new MockedAppManager());
+        cucd::Service implementation(connection, registry, app_manager, &app);
+        new ServiceAdaptor(std::addressof(implementation));
+
+        connection.registerService(service_name);
+        connection.registerObject("/", std::addressof(implementation));
+
+        QObject::connect(&app, &QCoreApplication::aboutToQuit, [&](){
+            connection.unregisterObject("/");
+            connection.unregisterService(service_name);
+        });
+
+        sync.signal_ready();
+
+        app.exec();
+    };
+
+    auto child = [&sync]()
+    {
+        sync.wait_for_signal_ready();
+
+        int argc = 0;
+        QCoreApplication app(argc, nullptr);
+
+        test::TestHarness harness;
+        harness.add_test_case([]()
+        {
+            qputenv("APP_ID", "com.also.does.not.exist.anywhere.application");
+            QDBusInterface service(service_name, "/", "com.ubuntu.content.dbus.Service");
+            QDBusPendingCall slow = service.asyncCall("KnownSourcesForType", cuc::Type::Known::pictures().id());
+            /* Let the query get going on the pool */
+            QTest::qWait(100);
+
+            QVector<cuc::Item> items;
+            items << cuc::Item();
+            items[0].setText("data");
+
+            /* Charging checks whether the destination is legacy */
+            QElapsedTimer timer;
+            timer.start();
+            auto hub = cuc::Hub::Client::instance();
+            auto transfer = hub->create_import_from_peer(cuc::Peer("com.does.not.exist.anywhere.application"));
+            ASSERT_TRUE(transfer != nullptr);
+            EXPECT_TRUE(transfer->start());
+            EXPECT_TRUE(transfer->charge(items));
+            EXPECT_EQ(cuc::Transfer::charged, transfer->state());
+            EXPECT_GT(500, timer.elapsed());
+
+            slow.waitForFinished();
+            EXPECT_FALSE(slow.isError());
+        });
+
+        EXPECT_EQ(0, QTest::qExec(std::addressof(harness)));
+
+        cuc::Hub::Client::instance()->quit();
+    };
+
+    EXPECT_TRUE(test::fork_and_run(child, parent) != EXIT_FAILURE);
+}
@@ -33,7 +33,11 @@
 #include <gtest/gtest.h>
 
 #include <QCoreApplication>
+#include <QFileInfo>
 #include <QtDBus/QDBusConnection>
+#include <QtDBus/QDBusInterface>
+#include <QtDBus/QDBusReply>
+#include <QSignalSpy>
 #include <QStandardPaths>
 #include <QTemporaryDir>
 #include <QtTest/QTest>
@@ -138,3 +142,260 @@ TEST(Hub, transfer_creation_and_states_work)
 
     EXPECT_EQ(EXIT_SUCCESS, test::fork_and_run(child, parent));
 }
+
+TEST(Hub, pastes_survive_snapshot_and_restore)
+{
+    using namespace ::testing;
+
+    test::CrossProcessSync sync;
+
+    auto parent = [&sync]()
+    {
+        int argc = 0;
+        QCoreApplication app{argc, nullptr};
+
+        QDBusConnection connection = QDBusConnection::sessionBus();
+
+        auto mock = new ::testing::NiceMock<MockedPeerRegistry>{};
+
+        QSharedPointer<cucd::PeerRegistry> registry{mock};
+        auto app_manager = QSharedPointer<cua::ApplicationManager>(new MockedAppManager());
+        cucd::Service implementation(connection, registry, app_manager, &app);
+        new ServiceAdaptor(std::addressof(implementation));
+
+        connection.registerService(service_name);
+        connection.registerObject("/", std::addressof(implementation));
+
+        QObject::connect(&app, &QCoreApplication::aboutToQuit, [&](){
+            connection.unregisterObject("/");
+            connection.unregisterService(service_name);
+        });
+
+        sync.signal_ready();
+
+        app.exec();
+
+        QString surfaceId("some-bogus-fake-surface-id");
+        QTemporaryDir tmp;
+        ASSERT_TRUE(tmp.isValid());
+        QString snapshot = tmp.path() + "/service.snapshot";
+        ASSERT_TRUE(implementation.save_snapshot(snapshot));
+        /* Holds paste contents, nobody else may read it */
+        EXPECT_EQ(0, int(QFileInfo(snapshot).permissions()
+                         & (QFileDevice::ReadGroup | QFileDevice::WriteGroup
+                            | QFileDevice::ReadOther | QFileDevice::WriteOther)));
+
+        cucd::Service restored(connection, registry, app_manager, &app);
+        ASSERT_TRUE(restored.restore_snapshot(snapshot));
+        EXPECT_FALSE(QFile::exists(snapshot));
+        EXPECT_EQ(implementation.PasteFormats(), restored.PasteFormats());
+        EXPECT_FALSE(restored.GetLatestPasteData(surfaceId).isEmpty());
+        EXPECT_EQ(implementation.GetLatestPasteData(surfaceId), restored.GetLatestPasteData(surfaceId));
+        EXPECT_EQ(implementation.GetPasteData(surfaceId, "1"), restored.GetPasteData(surfaceId, "1"));
+    };
+
+    auto child = [&sync]()
+    {
+        int argc = 0;
+        QCoreApplication app(argc, nullptr);
+
+        sync.wait_for_signal_ready();
+
+        test::TestHarness harness;
+        harness.add_test_case([]()
+        {
+            qputenv("APP_ID", "some-app");
+
+            QMimeData data;
+            data.setText("some text");
+            auto hub = cuc::Hub::Client::instance();
+            QString surfaceId("some-bogus-fake-surface-id");
+            ASSERT_TRUE(hub->createPasteSync(surfaceId, const_cast<const QMimeData&>(data)));
+
+            hub->quit();
+        });
+        EXPECT_EQ(0, QTest::qExec(std::addressof(harness)));
+    };
+
+    EXPECT_EQ(EXIT_SUCCESS, test::fork_and_run(child, parent));
+}
+
+TEST(Hub, pastes_are_read_over_the_bulk_channel)
+{
+    using namespace ::testing;
+
+    test::CrossProcessSync sync;
+
+    auto parent = [&sync]()
+    {
+        int argc = 0;
+        QCoreApplication app{argc, nullptr};
+
+        QDBusConnection connection = QDBusConnection::sessionBus();
+
+        auto mock = new ::testing::NiceMock<MockedPeerRegistry>{};
+
+        QSharedPointer<cucd::PeerRegistry> registry{mock};
+        auto app_manager = QSharedPointer<cua::ApplicationManager>(new MockedAppManager());
+        cucd::Service implementation(connection, registry, app_manager, &app);
+        new ServiceAdaptor(std::addressof(implementation));
+
+        connection.registerService(service_name);
+        connection.registerObject("/", std::addressof(implementation));
+
+        QObject::connect(&app, &QCoreApplication::aboutToQuit, [&](){
+            connection.unregisterObject("/");
+            connection.unregisterService(service_name);
+        });
+
+        sync.signal_ready();
+
+        app.exec();
+    };
+
+    auto child = [&sync]()
+    {
+        int argc = 0;
+        QCoreApplication app(argc, nullptr);
+
+        sync.wait_for_signal_ready();
+
+        test::TestHarness harness;
+        harness.add_test_case([]()
+        {
+            qputenv("APP_ID", "some-app");
+
+            QMimeData data;
+            data.setText("bulk text");
+            auto hub = cuc::Hub::Client::instance();
+            QString surfaceId("some-bogus-fake-surface-id");
+            ASSERT_TRUE(hub->createPasteSync(surfaceId, const_cast<const QMimeData&>(data)));
+
+            QDBusInterface service(service_name, "/", "com.ubuntu.content.dbus.Service");
+            QDBusReply<QString> address = service.call("BulkAddress");
+            ASSERT_TRUE(address.isValid());
+            ASSERT_FALSE(address.value().isEmpty());
+
+            QDBusConnection peer = QDBusConnection::connectToPeer(address.value(), "bulk-test");
+            ASSERT_TRUE(peer.isConnected());
+            QDBusInterface bulk(QString(), "/", "com.ubuntu.content.dbus.Service", peer);
+
+            QDBusReply<QByteArray> paste = bulk.call("GetLatestPasteData", surfaceId);
+            ASSERT_TRUE(paste.isValid());
+            EXPECT_FALSE(paste.value().isEmpty());
+
+            /* Only reads are exported there, the rest stays on the bus */
+            QDBusReply<bool> created = bulk.call("CreatePaste", QString("some-app"), surfaceId,
+                                                 QByteArray("x"), QStringList());
+            EXPECT_FALSE(created.isValid());
+            QDBusReply<void> active = bulk.call("HandlerActive", QString("some-app"));
+            EXPECT_FALSE(active.isValid());
+            QDBusReply<bool> pending = bulk.call("HasPending", QString("some-app"));
+            EXPECT_FALSE(pending.isValid());
+            QDBusReply<void> error = bulk.call("DownloadManagerError", QString("some text"));
+            EXPECT_FALSE(error.isValid());
+
+            /* The socket is a file only this user can reach */
+            ASSERT_TRUE(address.value().startsWith("unix:path="));
+            QFileInfo socket(address.value().mid(QString("unix:path=").length()));
+            EXPECT_TRUE(socket.exists());
+            EXPECT_EQ(QFileDevice::ReadOwner | QFileDevice::WriteOwner | QFileDevice::ExeOwner,
+                      QFile::permissions(socket.absolutePath()) & (QFileDevice::ReadOwner | QFileDevice::WriteOwner
+                                                                  | QFileDevice::ExeOwner | QFileDevice::ReadGroup
+                                                                  | QFileDevice::ReadOther));
+
+            /* The hub itself reads through the channel */
+            EXPECT_EQ(QString(data.text()), QString(hub->latestPaste(surfaceId)->text()));
+
+            QDBusConnection::disconnectFromPeer("bulk-test");
+            hub->quit();
+        });
+        EXPECT_EQ(0, QTest::qExec(std::addressof(harness)));
+    };
+
+    EXPECT_EQ(EXIT_SUCCESS, test::fork_and_run(child, parent));
+}
+
+TEST(Hub, paste_formats_follow_the_live_pastes)
+{
+    using namespace ::testing;
+
+    test::CrossProcessSync sync;
+
+    auto parent = [&sync]()
+    {
+        int argc = 0;
+        QCoreApplication app{argc, nullptr};
+
+        QDBusConnection connection = QDBusConnection::sessionBus();
+
+        auto mock = new ::testing::NiceMock<MockedPeerRegistry>{};
+
+        QSharedPointer<cucd::PeerRegistry> registry{mock};
+        auto app_manager = QSharedPointer<cua::ApplicationManager>(new MockedAppManager());
+        cucd::Service implementation(connection, registry, app_manager, &app);
+        new ServiceAdaptor(std::addressof(implementation));
+
+        connection.registerService(service_name);
+        connection.registerObject("/", std::addressof(implementation));
+
+        QObject::connect(&app, &QCoreApplication::aboutToQuit, [&](){
+            connection.unregisterObject("/");
+            connection.unregisterService(service_name);
+        });
+
+        sync.signal_ready();
+
+        app.exec();
+    };
+
+    auto child = [&sync]()
+    {
+        int argc = 0;
+        QCoreApplication app(argc, nullptr);
+
+        sync.wait_for_signal_ready();
+
+        test::TestHarness harness;
+        harness.add_test_case([]()
+        {
+            qputenv("APP_ID", "some-app");
+
+            auto hub = cuc::Hub::Client::instance();
+            QString surfaceId("some-bogus-fake-surface-id");
+
+            QMimeData text;
+            text.setText("some text");
+            ASSERT_TRUE(hub->createPasteSync(surfaceId, const_cast<const QMimeData&>(text)));
+            /* Not subscribed, read from the service */
+            EXPECT_TRUE(hub->pasteFormats().contains("text/plain"));
+
+            /* Listening subscribes */
+            QSignalSpy formats(hub, SIGNAL(pasteFormatsChanged()));
+            QSignalSpy boards(hub, SIGNAL(pasteboardChanged()));
+            ASSERT_TRUE(formats.wait());
+
+            /* The text paste falls out of the pasteboard */
+            QMimeData html;
+            html.setHtml("<b>some html</b>");
+            for (int i = 0; i < 5; i++)
+                ASSERT_TRUE(hub->createPasteSync(surfaceId, const_cast<const QMimeData&>(html)));
+            while (boards.count() < 5 && boards.wait())
+                ;
+            EXPECT_EQ(5, boards.count());
+            EXPECT_FALSE(hub->pasteFormats().contains("text/plain"));
+            EXPECT_TRUE(hub->pasteFormats().contains("text/html"));
+
+            QDBusInterface service(service_name, "/", "com.ubuntu.content.dbus.Service");
+            QDBusReply<QVariantMap> state = service.call("PasteboardState");
+            ASSERT_TRUE(state.isValid());
+            EXPECT_EQ(6u, state.value().value("generation").toULongLong());
+            EXPECT_EQ(hub->pasteFormats(), state.value().value("formats").toStringList());
+
+            hub->quit();
+        });
+        EXPECT_EQ(0, QTest::qExec(std::addressof(harness)));
+    };
+
+    EXPECT_EQ(EXIT_SUCCESS, test::fork_and_run(child, parent));
+}
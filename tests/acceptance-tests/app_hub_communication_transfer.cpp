@@ -30,6 +30,7 @@
 #include <com/ubuntu/content/type.h>
 
 #include "com/ubuntu/content/detail/peer_registry.h"
+#include "com/ubuntu/content/transfer_p.h"
 #include "com/ubuntu/content/detail/service.h"
 #include "com/ubuntu/content/serviceadaptor.h"
 
@@ -37,13 +38,18 @@
 #include <gtest/gtest.h>
 
 #include <QCoreApplication>
+#include <QFile>
 #include <QtDBus/QDBusConnection>
+#include <QSignalSpy>
 #include <QStandardPaths>
 #include <QTemporaryDir>
 #include <QtTest/QTest>
 
 #include <thread>
 
+#include <sys/stat.h>
+#include <unistd.h>
+
 namespace cua = com::ubuntu::ApplicationManager;
 namespace cuc = com::ubuntu::content;
 namespace cucd = com::ubuntu::content::detail;
@@ -173,6 +179,8 @@ TEST(Hub, transfer_creation_and_states_work)
             EXPECT_TRUE(transfer->charge(source_items));
             EXPECT_EQ(cuc::Transfer::charged, transfer->state());
             EXPECT_EQ(expected_items, transfer->collect());
+            Q_FOREACH (cuc::Item item, transfer->collect())
+                EXPECT_EQ(item.url().isLocalFile(), not item.mimeType().isEmpty());
             /** [Importing pictures] */
 
             /** Test that the transfer aborts when destination file exists */
@@ -228,3 +236,354 @@ TEST(Hub, transfer_creation_and_states_work)
     
     EXPECT_EQ(EXIT_SUCCESS, test::fork_and_run(child, parent));
 }
+
+TEST(Hub, transfer_items_can_be_handed_off)
+{
+    using namespace ::testing;
+
+    test::CrossProcessSync sync;
+
+    auto parent = [&sync]()
+    {
+        int argc = 0;
+        QCoreApplication app{argc, nullptr};
+
+        QString default_peer_id{"com.does.not.exist.anywhere.application"};
+
+        QDBusConnection connection = QDBusConnection::sessionBus();
+
+        auto mock = new ::testing::NiceMock<MockedPeerRegistry>{};
+        EXPECT_CALL(*mock, default_source_for_type(_)).
+        Times(AtLeast(1)).
+        WillRepeatedly(Return(cuc::Peer{default_peer_id}));
+
+        QSharedPointer<cucd::PeerRegistry> registry{mock};
+        auto app_manager = QSharedPointer<cua::ApplicationManager>(new MockedAppManager());
+        cucd::Service implementation(connection, registry, app_manager, &app);
+        new ServiceAdaptor(std::addressof(implementation));
+
+        connection.registerService(service_name);
+        connection.registerObject("/", std::addressof(implementation));
+
+        QObject::connect(&app, &QCoreApplication::aboutToQuit, [&](){
+            connection.unregisterObject("/");
+            connection.unregisterService(service_name);
+        });
+
+        sync.signal_ready();
+
+        app.exec();
+    };
+
+    auto child = [&sync]()
+    {
+        int argc = 0;
+        QCoreApplication app(argc, nullptr);
+        app.setApplicationName("com.some.test.app");
+
+        sync.wait_for_signal_ready();
+
+        test::TestHarness harness;
+        harness.add_test_case([]()
+        {
+            QTemporaryDir source_dir;
+            QTemporaryDir store_dir;
+            /* More items than a message may carry descriptors */
+            QVector<cuc::Item> source_items;
+            for (int i = 0; i < 40; i++)
+            {
+                QFile file(source_dir.path() + QString("/handoff%1.txt").arg(i));
+                ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+                file.write(QString("handed off %1").arg(i).toUtf8());
+                file.close();
+                source_items << cuc::Item(QUrl::fromLocalFile(file.fileName()));
+            }
+
+            auto hub = cuc::Hub::Client::instance();
+            auto transfer = hub->create_import_from_peer(
+                hub->default_source_for_type(cuc::Type::Known::documents()));
+            ASSERT_TRUE(transfer != nullptr);
+            EXPECT_EQ(cuc::Transfer::copy, transfer->itemMode());
+            EXPECT_TRUE(transfer->setItemMode(cuc::Transfer::handoff));
+            EXPECT_EQ(cuc::Transfer::handoff, transfer->itemMode());
+            transfer->setStore(new cuc::Store{store_dir.path()});
+            EXPECT_TRUE(transfer->start());
+            EXPECT_TRUE(transfer->charge(source_items));
+            EXPECT_EQ(cuc::Transfer::charged, transfer->state());
+
+            /* Nothing is copied, each item is opened on request */
+            auto items = transfer->collect();
+            ASSERT_EQ(source_items.count(), items.count());
+            EXPECT_EQ(source_items[0].url(), items[0].url());
+            EXPECT_FALSE(QFile::exists(store_dir.path() + "/handoff0.txt"));
+
+            for (int i = 0; i < items.count(); i++)
+            {
+                QDBusUnixFileDescriptor fd = transfer->openItem(i);
+                ASSERT_TRUE(fd.isValid());
+                QFile handed;
+                ASSERT_TRUE(handed.open(fd.fileDescriptor(), QIODevice::ReadOnly));
+                EXPECT_EQ(QString("handed off %1").arg(i).toUtf8(), handed.readAll());
+                handed.close();
+            }
+            EXPECT_FALSE(transfer->openItem(items.count()).isValid());
+
+            /* The mode is fixed once the items are charged */
+            EXPECT_TRUE(transfer->setItemMode(cuc::Transfer::copy));
+            EXPECT_EQ(cuc::Transfer::handoff, transfer->itemMode());
+
+            /* Persisting copies the items into the store after all */
+            EXPECT_TRUE(transfer->persist());
+            EXPECT_EQ(cuc::Transfer::copy, transfer->itemMode());
+            items = transfer->collect();
+            ASSERT_EQ(source_items.count(), items.count());
+            EXPECT_EQ(QUrl::fromLocalFile(store_dir.path() + "/handoff0.txt"), items[0].url());
+            EXPECT_TRUE(QFile::exists(store_dir.path() + "/handoff0.txt"));
+            EXPECT_FALSE(transfer->openItem(0).isValid());
+
+            hub->quit();
+        });
+        EXPECT_EQ(0, QTest::qExec(std::addressof(harness)));
+    };
+
+    EXPECT_EQ(EXIT_SUCCESS, test::fork_and_run(child, parent));
+}
+
+TEST(Hub, handed_off_items_must_stay_regular_files)
+{
+    using namespace ::testing;
+
+    test::CrossProcessSync sync;
+
+    auto parent = [&sync]()
+    {
+        int argc = 0;
+        QCoreApplication app{argc, nullptr};
+
+        QString default_peer_id{"com.does.not.exist.anywhere.application"};
+
+        QDBusConnection connection = QDBusConnection::sessionBus();
+
+        auto mock = new ::testing::NiceMock<MockedPeerRegistry>{};
+        EXPECT_CALL(*mock, default_source_for_type(_)).
+        Times(AtLeast(1)).
+        WillRepeatedly(Return(cuc::Peer{default_peer_id}));
+
+        QSharedPointer<cucd::PeerRegistry> registry{mock};
+        auto app_manager = QSharedPointer<cua::ApplicationManager>(new MockedAppManager());
+        cucd::Service implementation(connection, registry, app_manager, &app);
+        new ServiceAdaptor(std::addressof(implementation));
+
+        connection.registerService(service_name);
+        connection.registerObject("/", std::addressof(implementation));
+
+        QObject::connect(&app, &QCoreApplication::aboutToQuit, [&](){
+            connection.unregisterObject("/");
+            connection.unregisterService(service_name);
+        });
+
+        sync.signal_ready();
+
+        app.exec();
+    };
+
+    auto child = [&sync]()
+    {
+        int argc = 0;
+        QCoreApplication app(argc, nullptr);
+        app.setApplicationName("com.some.test.app");
+
+        sync.wait_for_signal_ready();
+
+        test::TestHarness harness;
+        harness.add_test_case([]()
+        {
+            QTemporaryDir source_dir;
+            QTemporaryDir store_dir;
+            auto hub = cuc::Hub::Client::instance();
+
+            auto handoff = [&]() -> cuc::Transfer*
+            {
+                auto transfer = hub->create_import_from_peer(
+                    hub->default_source_for_type(cuc::Type::Known::documents()));
+                if (transfer == nullptr)
+                    return nullptr;
+                transfer->setItemMode(cuc::Transfer::handoff);
+                transfer->setStore(new cuc::Store{store_dir.path()});
+                transfer->start();
+                return transfer;
+            };
+
+            /* Opening a FIFO would block the service */
+            const QString fifo = source_dir.path() + "/fifo";
+            ASSERT_EQ(0, mkfifo(QFile::encodeName(fifo).constData(), 0600));
+            auto transfer = handoff();
+            ASSERT_TRUE(transfer != nullptr);
+            transfer->charge(QVector<cuc::Item>() << cuc::Item(QUrl::fromLocalFile(fifo)));
+            EXPECT_EQ(cuc::Transfer::aborted, transfer->state());
+
+            QFile target(source_dir.path() + "/target.txt");
+            ASSERT_TRUE(target.open(QIODevice::WriteOnly));
+            target.write("target");
+            target.close();
+
+            /* Symlinks aren't followed */
+            const QString link = source_dir.path() + "/link.txt";
+            ASSERT_TRUE(QFile::link(target.fileName(), link));
+            transfer = handoff();
+            ASSERT_TRUE(transfer != nullptr);
+            transfer->charge(QVector<cuc::Item>() << cuc::Item(QUrl::fromLocalFile(link)));
+            EXPECT_EQ(cuc::Transfer::aborted, transfer->state());
+
+            /* Nor is a path swapped after charging */
+            QFile item(source_dir.path() + "/item.txt");
+            ASSERT_TRUE(item.open(QIODevice::WriteOnly));
+            item.write("item");
+            item.close();
+            transfer = handoff();
+            ASSERT_TRUE(transfer != nullptr);
+            EXPECT_TRUE(transfer->charge(QVector<cuc::Item>() << cuc::Item(QUrl::fromLocalFile(item.fileName()))));
+            EXPECT_EQ(cuc::Transfer::charged, transfer->state());
+            EXPECT_TRUE(transfer->openItem(0).isValid());
+
+            ASSERT_TRUE(QFile::remove(item.fileName()));
+            ASSERT_TRUE(QFile::copy(target.fileName(), item.fileName()));
+            EXPECT_FALSE(transfer->openItem(0).isValid());
+            EXPECT_FALSE(transfer->persist());
+
+            hub->quit();
+        });
+        EXPECT_EQ(0, QTest::qExec(std::addressof(harness)));
+    };
+
+    EXPECT_EQ(EXIT_SUCCESS, test::fork_and_run(child, parent));
+}
+
+TEST(Hub, transfer_items_can_be_charged_in_batches)
+{
+    using namespace ::testing;
+
+    test::CrossProcessSync sync;
+
+    auto parent = [&sync]()
+    {
+        int argc = 0;
+        QCoreApplication app{argc, nullptr};
+
+        QString default_peer_id{"com.does.not.exist.anywhere.application"};
+
+        QDBusConnection connection = QDBusConnection::sessionBus();
+
+        auto mock = new ::testing::NiceMock<MockedPeerRegistry>{};
+        EXPECT_CALL(*mock, default_source_for_type(_)).
+        Times(AtLeast(1)).
+        WillRepeatedly(Return(cuc::Peer{default_peer_id}));
+
+        QSharedPointer<cucd::PeerRegistry> registry{mock};
+        auto app_manager = QSharedPointer<cua::ApplicationManager>(new MockedAppManager());
+        cucd::Service implementation(connection, registry, app_manager, &app);
+        new ServiceAdaptor(std::addressof(implementation));
+
+        connection.registerService(service_name);
+        connection.registerObject("/", std::addressof(implementation));
+
+        QObject::connect(&app, &QCoreApplication::aboutToQuit, [&](){
+            connection.unregisterObject("/");
+            connection.unregisterService(service_name);
+        });
+
+        sync.signal_ready();
+
+        app.exec();
+    };
+
+    auto child = [&sync]()
+    {
+        int argc = 0;
+        QCoreApplication app(argc, nullptr);
+        app.setApplicationName("com.some.test.app");
+
+        sync.wait_for_signal_ready();
+
+        test::TestHarness harness;
+        harness.add_test_case([]()
+        {
+            QVector<cuc::Item> items;
+            for (int i = 0; i < 1000; i++)
+            {
+                items << cuc::Item();
+                items[i].setName(QString("name%1").arg(i));
+                items[i].setText(QString("data%1").arg(i));
+            }
+
+            auto hub = cuc::Hub::Client::instance();
+
+            /* Batches can be collected before the charge is committed */
+            auto transfer = hub->create_import_from_peer(
+                hub->default_source_for_type(cuc::Type::Known::documents()));
+            ASSERT_TRUE(transfer != nullptr);
+            QSignalSpy appended(transfer, SIGNAL(itemsAppended(int)));
+            EXPECT_TRUE(transfer->start());
+            EXPECT_TRUE(transfer->beginCharge());
+            transfer->appendItems(items.mid(0, 3));
+            EXPECT_EQ(items.mid(0, 3), transfer->collectFrom(0));
+            EXPECT_EQ(cuc::Transfer::initiated, transfer->state());
+            /* Collecting mid charge doesn't move the transfer on */
+            EXPECT_EQ(items.mid(0, 3), transfer->collect());
+            EXPECT_EQ(cuc::Transfer::initiated, transfer->state());
+            /* Nor can another charge take over */
+            EXPECT_FALSE(transfer->beginCharge());
+            EXPECT_EQ(items.mid(0, 3), transfer->collectFrom(0));
+            transfer->appendItems(items.mid(3, 2));
+            EXPECT_EQ(items.mid(3, 2), transfer->collectFrom(3));
+            EXPECT_TRUE(transfer->commitCharge());
+            EXPECT_EQ(cuc::Transfer::charged, transfer->state());
+            EXPECT_EQ(items.mid(0, 5), transfer->collect());
+            while (appended.count() < 2 && appended.wait())
+                ;
+            ASSERT_EQ(2, appended.count());
+            EXPECT_EQ(5, appended.at(1).at(0).toInt());
+
+            /* Appending outside of a charge fails */
+            transfer->appendItems(items.mid(5, 1));
+            EXPECT_FALSE(transfer->commitCharge());
+
+            /* Large charges are streamed */
+            auto large_transfer = hub->create_import_from_peer(
+                hub->default_source_for_type(cuc::Type::Known::documents()));
+            ASSERT_TRUE(large_transfer != nullptr);
+            EXPECT_TRUE(large_transfer->start());
+            EXPECT_TRUE(large_transfer->charge(items));
+            EXPECT_EQ(cuc::Transfer::charged, large_transfer->state());
+            EXPECT_EQ(items, large_transfer->collect());
+
+            hub->quit();
+        });
+        EXPECT_EQ(0, QTest::qExec(std::addressof(harness)));
+    };
+
+    EXPECT_EQ(EXIT_SUCCESS, test::fork_and_run(child, parent));
+}
+
+TEST(Hub, transfer_proxies_are_shared_per_path)
+{
+    using namespace ::testing;
+
+    int argc = 0;
+    QCoreApplication app(argc, nullptr);
+
+    typedef cucd::ProxyPool<com::ubuntu::content::dbus::Transfer> Pool;
+    const int before = Pool::size();
+
+    auto first = cuc::Transfer::Private::make_transfer(QDBusObjectPath{"/transfers/pool/1"}, nullptr);
+    auto second = cuc::Transfer::Private::make_transfer(QDBusObjectPath{"/transfers/pool/1"}, nullptr);
+    auto third = cuc::Transfer::Private::make_transfer(QDBusObjectPath{"/transfers/pool/2"}, nullptr);
+    EXPECT_EQ(before + 2, Pool::size());
+
+    delete first;
+    EXPECT_EQ(before + 2, Pool::size());
+    delete second;
+    EXPECT_EQ(before + 1, Pool::size());
+    delete third;
+    EXPECT_EQ(before, Pool::size());
+}
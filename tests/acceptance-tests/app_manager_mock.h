@@ -19,6 +19,8 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <unistd.h>
+
 namespace cua = com::ubuntu::ApplicationManager;
 
 namespace
@@ -34,6 +36,18 @@ struct MockedAppManager : public cua::ApplicationManager
         ON_CALL(*this, is_application_started(_)).WillByDefault(Return(true));
     }
 
+    /* Launches block for msec, like a cold start would */
+    void set_launch_latency(int msec)
+    {
+        using namespace ::testing;
+
+        ON_CALL(*this, invoke_application(_,_)).WillByDefault(Invoke([msec](const std::string&, gchar**)
+        {
+            usleep(msec * 1000);
+            return true;
+        }));
+    }
+
     MOCK_METHOD2(invoke_application, bool(const std::string &, gchar ** uris));
     MOCK_METHOD1(stop_application, bool(const std::string &));
     MOCK_METHOD1(is_application_started, bool(const std::string &));
@@ -42,3 +42,255 @@ TEST(PasteBoardTest, MimeDataSerialization)
 
     delete deserializedMimeData;
 }
+
+TEST(PasteBoardTest, MimeDataSerializationV2)
+{
+    QMimeData mimeData;
+    mimeData.setData("text/plain", "Hello World!");
+    mimeData.setData("text/html", "<html lang=\"en\"><body>Hello World!</body></html>");
+    mimeData.setData("application/x-empty", QByteArray());
+
+    QByteArray serializedMimeData = serializeMimeDataV2(const_cast<const QMimeData&>(mimeData));
+    ASSERT_TRUE(serializedMimeData.size() > 0);
+
+    MimeDataView view(serializedMimeData);
+    ASSERT_TRUE(view.isValid());
+    EXPECT_EQ(2, view.version());
+    EXPECT_EQ(3, view.count());
+
+    /* Every payload starts on an aligned offset inside the buffer */
+    for (int i = 0; i < view.count(); i++) {
+        QByteArray slice = view.data(i);
+        if (slice.isEmpty())
+            continue;
+        qint64 offset = slice.constData() - serializedMimeData.constData();
+        EXPECT_GE(offset, 0);
+        EXPECT_LT(offset, serializedMimeData.size());
+        EXPECT_EQ(0, offset % 8);
+    }
+
+    EXPECT_TRUE(view.hasFormat("text/plain"));
+    EXPECT_TRUE(view.hasFormat("application/x-empty"));
+    EXPECT_FALSE(view.hasFormat("image/png"));
+    EXPECT_EQ(mimeData.data("text/html"), view.data(QStringLiteral("text/html")));
+
+    QMimeData *deserializedMimeData = deserializeMimeData(serializedMimeData);
+    ASSERT_TRUE(deserializedMimeData != nullptr);
+    EXPECT_EQ(mimeData.data("text/plain"), deserializedMimeData->data("text/plain"));
+    EXPECT_EQ(mimeData.data("text/html"), deserializedMimeData->data("text/html"));
+    delete deserializedMimeData;
+}
+
+TEST(PasteBoardTest, DeserializedMimeDataReadsFormatsOnDemand)
+{
+    QMimeData mimeData;
+    mimeData.setData("text/plain", "Hello World!");
+    mimeData.setData("application/x-large", QByteArray(64 * 1024, 'x'));
+
+    QByteArray serializedMimeData = serializeMimeDataV2(const_cast<const QMimeData&>(mimeData));
+    QScopedPointer<QMimeData> deserializedMimeData(deserializeMimeData(serializedMimeData));
+    ASSERT_TRUE(deserializedMimeData != nullptr);
+    EXPECT_EQ(mimeData.formats().toSet(), deserializedMimeData->formats().toSet());
+    EXPECT_TRUE(deserializedMimeData->hasFormat("application/x-large"));
+    EXPECT_EQ(QString("Hello World!"), deserializedMimeData->text());
+
+    /* What is read out stays valid without the paste */
+    QByteArray large = deserializedMimeData->data("application/x-large");
+
+    /* Data set afterwards takes precedence */
+    deserializedMimeData->setData("text/plain", "Replaced");
+    deserializedMimeData->setData("text/html", "<b>Added</b>");
+    EXPECT_EQ(QByteArray("Replaced"), deserializedMimeData->data("text/plain"));
+    EXPECT_EQ(QByteArray("<b>Added</b>"), deserializedMimeData->data("text/html"));
+    EXPECT_EQ(3, deserializedMimeData->formats().count());
+
+    deserializedMimeData.reset();
+    serializedMimeData.clear();
+    EXPECT_EQ(QByteArray(64 * 1024, 'x'), large);
+}
+
+TEST(PasteBoardTest, MimeDataViewReadsV1)
+{
+    QMimeData mimeData;
+    mimeData.setData("text/plain", "Hello World!");
+
+    MimeDataView view(serializeMimeData(const_cast<const QMimeData&>(mimeData)));
+    ASSERT_TRUE(view.isValid());
+    EXPECT_EQ(1, view.version());
+    EXPECT_EQ(QByteArray("Hello World!"), view.data(QStringLiteral("text/plain")));
+}
+
+TEST(PasteBoardTest, MimeDataConvertToV1)
+{
+    QMimeData mimeData;
+    mimeData.setData("text/plain", "Hello World!");
+    mimeData.setData("text/html", "<b>Hello World!</b>");
+
+    QByteArray v2 = serializeMimeDataV2(const_cast<const QMimeData&>(mimeData));
+    QByteArray v1 = convertMimeDataToV1(v2);
+
+    MimeDataView view(v1);
+    ASSERT_TRUE(view.isValid());
+    EXPECT_EQ(1, view.version());
+    EXPECT_EQ(mimeData.data("text/plain"), view.data(QStringLiteral("text/plain")));
+    EXPECT_EQ(mimeData.data("text/html"), view.data(QStringLiteral("text/html")));
+
+    /* Already v1, passed through untouched */
+    EXPECT_EQ(v1, convertMimeDataToV1(v1));
+}
+
+TEST(PasteBoardTest, MimeDataViewRejectsTruncatedV2)
+{
+    QMimeData mimeData;
+    mimeData.setData("text/plain", "Hello World!");
+
+    QByteArray serializedMimeData = serializeMimeDataV2(const_cast<const QMimeData&>(mimeData));
+    serializedMimeData.truncate(serializedMimeData.size() / 2);
+
+    MimeDataView view(serializedMimeData);
+    EXPECT_FALSE(view.isValid());
+    EXPECT_EQ(nullptr, deserializeMimeData(serializedMimeData));
+}
+
+TEST(PasteBoardTest, MimeDataCompressesLargeText)
+{
+    QByteArray html;
+    while (html.size() < 64 * 1024)
+        html += "<p>The quick brown fox jumps over the lazy dog</p>\n";
+
+    QByteArray noise(64 * 1024, '\0');
+    quint32 seed = 42;
+    for (int i = 0; i < noise.size(); i++) {
+        seed = seed * 1103515245 + 12345;
+        noise[i] = char(seed >> 16);
+    }
+
+    QMimeData mimeData;
+    mimeData.setData("text/html", html);
+    mimeData.setData("text/plain", "short");
+    mimeData.setData("text/x-noise", noise);
+    mimeData.setData("image/png", html);
+
+    QByteArray compressed = serializeMimeDataV2(const_cast<const QMimeData&>(mimeData), true);
+    QByteArray plain = serializeMimeDataV2(const_cast<const QMimeData&>(mimeData), false);
+    EXPECT_LT(compressed.size(), plain.size());
+
+    MimeDataView view(compressed);
+    ASSERT_TRUE(view.isValid());
+    EXPECT_TRUE(view.isCompressed(view.indexOf("text/html")));
+    EXPECT_FALSE(view.isCompressed(view.indexOf("text/plain")));
+    EXPECT_FALSE(view.isCompressed(view.indexOf("text/x-noise")));
+    EXPECT_FALSE(view.isCompressed(view.indexOf("image/png")));
+
+    EXPECT_EQ(html, view.data(QStringLiteral("text/html")));
+    EXPECT_EQ(noise, view.data(QStringLiteral("text/x-noise")));
+
+    QMimeData *deserializedMimeData = deserializeMimeData(compressed);
+    ASSERT_TRUE(deserializedMimeData != nullptr);
+    EXPECT_EQ(html, deserializedMimeData->data("text/html"));
+    EXPECT_EQ(QByteArray("short"), deserializedMimeData->data("text/plain"));
+    delete deserializedMimeData;
+}
+
+TEST(PasteBoardTest, MimeDataConvertedForReaderCapabilities)
+{
+    QByteArray text(32 * 1024, 'a');
+    QMimeData mimeData;
+    mimeData.setData("text/plain", text);
+
+    QByteArray compressed = serializeMimeDataV2(const_cast<const QMimeData&>(mimeData), true);
+
+    const QStringList all = QStringList() << pasteCapabilityV2 << pasteCapabilityZlib;
+    EXPECT_EQ(compressed, convertMimeDataForReader(compressed, all));
+
+    MimeDataView v2(convertMimeDataForReader(compressed, QStringList() << pasteCapabilityV2));
+    ASSERT_TRUE(v2.isValid());
+    EXPECT_EQ(2, v2.version());
+    EXPECT_FALSE(v2.hasCompressedFormats());
+    EXPECT_EQ(text, v2.data(QStringLiteral("text/plain")));
+
+    MimeDataView v1(convertMimeDataForReader(compressed, QStringList()));
+    ASSERT_TRUE(v1.isValid());
+    EXPECT_EQ(1, v1.version());
+    EXPECT_EQ(text, v1.data(QStringLiteral("text/plain")));
+}
+
+namespace
+{
+/* Hand built v2 data, each entry as name, data offset and flags */
+struct RawEntry
+{
+    QByteArray name;
+    qint64 dataOffset;
+    qint64 dataSize;
+    quint32 flags;
+};
+
+QByteArray buildV2(const QList<RawEntry> &entries, const QByteArray &blob, qint64 blobOffset)
+{
+    qint64 size = pasteHeaderSize + entries.size() * pasteEntrySize;
+    QList<qint64> nameOffsets;
+    Q_FOREACH (const RawEntry &e, entries) {
+        nameOffsets << size;
+        size += e.name.size();
+    }
+    QByteArray buffer(qMax(size, blobOffset + blob.size()), '\0');
+    uchar *bytes = reinterpret_cast<uchar*>(buffer.data());
+    qToLittleEndian<quint32>(pasteFormatMagic, bytes);
+    qToLittleEndian<quint16>(pasteFormatVersion, bytes + 4);
+    qToLittleEndian<quint32>(entries.size(), bytes + 8);
+    for (int i = 0; i < entries.size(); i++) {
+        uchar *entry = bytes + pasteHeaderSize + i * pasteEntrySize;
+        memcpy(bytes + nameOffsets[i], entries[i].name.constData(), entries[i].name.size());
+        qToLittleEndian<quint64>(nameOffsets[i], entry);
+        qToLittleEndian<quint32>(entries[i].name.size(), entry + 8);
+        qToLittleEndian<quint32>(entries[i].flags, entry + 12);
+        qToLittleEndian<quint64>(entries[i].dataOffset, entry + 16);
+        qToLittleEndian<quint64>(entries[i].dataSize, entry + 24);
+    }
+    memcpy(buffer.data() + blobOffset, blob.constData(), blob.size());
+    return buffer;
+}
+}
+
+TEST(PasteBoardTest, MimeDataViewRejectsCompressionBombs)
+{
+    /* A few kilobytes that expand to maxUncompressedSize */
+    const QByteArray blob = qCompress(QByteArray(maxUncompressedSize, 'a'), 9);
+    const qint64 blobOffset = 4096;
+
+    /* On its own it is fine */
+    QList<RawEntry> entries;
+    entries << RawEntry{"text/plain", blobOffset, blob.size(), pasteEntryZlib};
+    const QByteArray alone = buildV2(entries, blob, blobOffset);
+    ASSERT_LT(alone.size(), maxBufferSize);
+    MimeDataView single(alone);
+    ASSERT_TRUE(single.isValid());
+    EXPECT_EQ(maxUncompressedSize, single.data(0).size());
+
+    /* Pointing more entries at the same blob isn't */
+    entries << RawEntry{"text/html", blobOffset, blob.size(), pasteEntryZlib};
+    QByteArray shared = buildV2(entries, blob, blobOffset);
+    EXPECT_FALSE(MimeDataView(shared).isValid());
+    EXPECT_EQ(nullptr, deserializeMimeData(shared));
+
+    /* Nor is repeating a format */
+    entries.clear();
+    entries << RawEntry{"text/plain", blobOffset, 4, 0} << RawEntry{"text/plain", blobOffset + 8, 4, 0};
+    EXPECT_FALSE(MimeDataView(buildV2(entries, QByteArray(16, 'b'), blobOffset)).isValid());
+
+    /* Nor more formats than a paste may carry */
+    entries.clear();
+    for (int i = 0; i <= maxFormatsCount; i++)
+        entries << RawEntry{"text/x-" + QByteArray::number(i), blobOffset + i, 1, 0};
+    EXPECT_FALSE(MimeDataView(buildV2(entries, QByteArray(64, 'c'), blobOffset)).isValid());
+
+    /* Nor a blob that claims less than it expands to */
+    QByteArray understated = blob;
+    qToBigEndian<quint32>(1024, reinterpret_cast<uchar*>(understated.data()));
+    entries.clear();
+    entries << RawEntry{"text/plain", blobOffset, understated.size(), pasteEntryZlib};
+    MimeDataView lying(buildV2(entries, understated, blobOffset));
+    ASSERT_TRUE(lying.isValid());
+    EXPECT_TRUE(lying.data(0).isEmpty());
+}
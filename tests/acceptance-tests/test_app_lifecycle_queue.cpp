@@ -0,0 +1,139 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "app_manager_mock.h"
+#include "com/ubuntu/content/detail/app_lifecycle_queue.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <QCoreApplication>
+#include <QMutex>
+#include <QStringList>
+#include <QtTest/QTest>
+
+namespace cucd = com::ubuntu::content::detail;
+
+TEST(AppLifecycleQueue, launches_for_one_app_are_serialized_and_coalesced)
+{
+    using namespace ::testing;
+
+    int argc = 0;
+    QCoreApplication app{argc, nullptr};
+
+    QMutex mutex;
+    QList<QStringList> launched;
+    auto app_manager = QSharedPointer<MockedAppManager>::create();
+    EXPECT_CALL(*app_manager, invoke_application(_, _)).Times(2).WillRepeatedly(Invoke([&](const std::string&, gchar** uris)
+    {
+        QStringList l;
+        for (gchar** uri = uris; uri && *uri; uri++)
+            l << QString::fromUtf8(*uri);
+        usleep(50 * 1000);
+        QMutexLocker lock(&mutex);
+        launched << l;
+        return true;
+    }));
+
+    cucd::AppLifecycleQueue queue(app_manager);
+    int done = 0;
+    auto count = [&done](bool ok, bool) { EXPECT_TRUE(ok); done++; };
+
+    queue.launch("app", QStringList{"file:///a"}, count);
+    /* These two wait behind the first launch and become one */
+    queue.launch("app", QStringList{"file:///b"}, count);
+    queue.launch("app", QStringList{"file:///b", "file:///c"}, count);
+    EXPECT_EQ(2, queue.pending());
+
+    queue.wait_for_idle();
+
+    EXPECT_EQ(3, done);
+    EXPECT_EQ(0, queue.pending());
+    ASSERT_EQ(2, launched.size());
+    EXPECT_EQ(QStringList{"file:///a"}, launched.at(0));
+    EXPECT_EQ((QStringList{"file:///b", "file:///c"}), launched.at(1));
+}
+
+TEST(AppLifecycleQueue, slow_launches_time_out_once)
+{
+    using namespace ::testing;
+
+    int argc = 0;
+    QCoreApplication app{argc, nullptr};
+
+    auto app_manager = QSharedPointer<MockedAppManager>::create();
+    app_manager->set_launch_latency(300);
+    EXPECT_CALL(*app_manager, is_application_started(_)).WillRepeatedly(Return(false));
+
+    cucd::AppLifecycleQueue queue(app_manager);
+    queue.set_timeout(50);
+
+    int failed = 0;
+    int succeeded = 0;
+    queue.launch("slow-app", QStringList(), [&](bool ok, bool) { ok ? succeeded++ : failed++; });
+
+    QTest::qWait(150);
+    EXPECT_EQ(1, failed);
+    /* Still running, the next job for the app has to wait for it */
+    EXPECT_EQ(1, queue.pending());
+
+    queue.wait_for_idle();
+    EXPECT_EQ(1, failed);
+    EXPECT_EQ(0, succeeded);
+}
+
+TEST(AppLifecycleQueue, query_reports_whether_the_app_runs)
+{
+    using namespace ::testing;
+
+    int argc = 0;
+    QCoreApplication app{argc, nullptr};
+
+    auto app_manager = QSharedPointer<MockedAppManager>::create();
+    EXPECT_CALL(*app_manager, is_application_started("running-app")).WillRepeatedly(Return(true));
+    EXPECT_CALL(*app_manager, invoke_application(_, _)).Times(0);
+
+    cucd::AppLifecycleQueue queue(app_manager);
+    bool running = false;
+    queue.query("running-app", [&running](bool, bool was_running) { running = was_running; });
+    queue.wait_for_idle();
+
+    EXPECT_TRUE(running);
+}
+
+TEST(AppLifecycleQueue, cancel_drops_launches_not_yet_started)
+{
+    using namespace ::testing;
+
+    int argc = 0;
+    QCoreApplication app{argc, nullptr};
+
+    auto app_manager = QSharedPointer<MockedAppManager>::create();
+    EXPECT_CALL(*app_manager, stop_application("app")).WillOnce(DoAll(InvokeWithoutArgs([]() { usleep(50 * 1000); }), Return(true)));
+    EXPECT_CALL(*app_manager, invoke_application("app", _)).Times(0);
+
+    cucd::AppLifecycleQueue queue(app_manager);
+    QList<bool> results;
+    queue.stop("app");
+    queue.launch("app", QStringList(), [&results](bool ok, bool) { results << ok; });
+
+    EXPECT_EQ(1, queue.cancel("app"));
+    EXPECT_EQ(QList<bool>{false}, results);
+    EXPECT_EQ(0, queue.cancel("app"));
+
+    queue.wait_for_idle();
+    EXPECT_EQ(1, results.size());
+}
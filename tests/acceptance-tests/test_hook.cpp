@@ -24,6 +24,9 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
 #include <QtTest/QTest>
 
 namespace cuc = com::ubuntu::content;
@@ -79,3 +82,128 @@ TEST(Hook, parse_json)
     EXPECT_TRUE(hook->add_peer(f));
     delete mock;
 }
+
+TEST(Hook, incremental_update_with_manifest)
+{
+    using namespace ::testing;
+
+    QTemporaryDir tmp;
+    ASSERT_TRUE(tmp.isValid());
+    QDir peerDir(tmp.path() + "/peers");
+    peerDir.mkpath(peerDir.absolutePath());
+    ASSERT_TRUE(QFile::copy("good.json", peerDir.filePath("good.json")));
+
+    QVector<QDir> contentDirs;
+    contentDirs.append(peerDir);
+    QString manifest = tmp.path() + "/manifest.json";
+
+    auto mock = new NiceMock<MockedRegistry>{};
+    cucd::Hook *hook = new cucd::Hook(mock, contentDirs, manifest);
+
+    /* First run has no manifest and applies everything */
+    EXPECT_CALL(*mock, enumerate_known_peers(_)).Times(Exactly(1));
+    EXPECT_CALL(*mock, install_source_for_type(_,_)).
+    Times(Exactly(2)).
+    WillRepeatedly(Return(true));
+    EXPECT_TRUE(hook->update_peers());
+    EXPECT_TRUE(QFile::exists(manifest));
+    Mock::VerifyAndClearExpectations(mock);
+
+    /* Nothing changed, the registry is left alone */
+    EXPECT_CALL(*mock, enumerate_known_peers(_)).Times(Exactly(0));
+    EXPECT_CALL(*mock, install_source_for_type(_,_)).Times(Exactly(0));
+    EXPECT_CALL(*mock, remove_peer(_)).Times(Exactly(0));
+    EXPECT_TRUE(hook->update_peers());
+    Mock::VerifyAndClearExpectations(mock);
+
+    /* The peer file went away */
+    ASSERT_TRUE(QFile::remove(peerDir.filePath("good.json")));
+    EXPECT_CALL(*mock, remove_peer(cuc::Peer{"good.json"})).Times(Exactly(1));
+    EXPECT_CALL(*mock, install_source_for_type(_,_)).Times(Exactly(0));
+    EXPECT_TRUE(hook->update_peers());
+    Mock::VerifyAndClearExpectations(mock);
+
+    /* An empty manifest is still a manifest, no rescan */
+    EXPECT_CALL(*mock, enumerate_known_peers(_)).Times(Exactly(0));
+    EXPECT_CALL(*mock, remove_peer(_)).Times(Exactly(0));
+    EXPECT_TRUE(hook->update_peers());
+    Mock::VerifyAndClearExpectations(mock);
+
+    delete mock;
+}
+
+TEST(Hook, unparsable_files_are_retried)
+{
+    using namespace ::testing;
+
+    QTemporaryDir tmp;
+    ASSERT_TRUE(tmp.isValid());
+    QDir peerDir(tmp.path() + "/peers");
+    peerDir.mkpath(peerDir.absolutePath());
+    ASSERT_TRUE(QFile::copy("good.json", peerDir.filePath("good.json")));
+    ASSERT_TRUE(QFile::copy("bad.json", peerDir.filePath("later.json")));
+
+    QVector<QDir> contentDirs;
+    contentDirs.append(peerDir);
+    QString manifest = tmp.path() + "/manifest.json";
+
+    auto mock = new NiceMock<MockedRegistry>{};
+    cucd::Hook *hook = new cucd::Hook(mock, contentDirs, manifest);
+
+    EXPECT_CALL(*mock, install_source_for_type(_,_)).
+    Times(Exactly(2)).
+    WillRepeatedly(Return(true));
+    hook->update_peers();
+    Mock::VerifyAndClearExpectations(mock);
+
+    QFile file(manifest);
+    ASSERT_TRUE(file.open(QIODevice::ReadOnly));
+    QJsonObject recorded = QJsonDocument::fromJson(file.readAll()).object().value("files").toObject();
+    file.close();
+    EXPECT_TRUE(recorded.contains(QFileInfo(peerDir.filePath("good.json")).absoluteFilePath()));
+    EXPECT_FALSE(recorded.contains(QFileInfo(peerDir.filePath("later.json")).absoluteFilePath()));
+
+    /* Once it parses it is picked up, without touching the good one */
+    ASSERT_TRUE(QFile::remove(peerDir.filePath("later.json")));
+    ASSERT_TRUE(QFile::copy("good.json", peerDir.filePath("later.json")));
+    EXPECT_CALL(*mock, remove_peer(_)).Times(Exactly(0));
+    EXPECT_CALL(*mock, install_source_for_type(_, cuc::Peer{"later.json"})).
+    Times(Exactly(2)).
+    WillRepeatedly(Return(true));
+    EXPECT_CALL(*mock, install_source_for_type(_, cuc::Peer{"good.json"})).Times(Exactly(0));
+    EXPECT_TRUE(hook->update_peers());
+    Mock::VerifyAndClearExpectations(mock);
+
+    delete mock;
+}
+
+TEST(Hook, parallel_parse_matches_sequential)
+{
+    using namespace ::testing;
+
+    QTemporaryDir tmp;
+    ASSERT_TRUE(tmp.isValid());
+    QDir peerDir(tmp.path() + "/peers");
+    peerDir.mkpath(peerDir.absolutePath());
+    const int peers = 32;
+    for (int i = 0; i < peers; i++)
+        ASSERT_TRUE(QFile::copy("good.json", peerDir.filePath(QString("peer%1").arg(i))));
+    ASSERT_TRUE(QFile::copy("bad.json", peerDir.filePath("bad")));
+
+    cucd::PeerDeclaration parsed = cucd::Hook::parse_peer(QFileInfo(peerDir.filePath("peer0")));
+    EXPECT_TRUE(parsed.valid);
+    EXPECT_EQ(QStringList({"pictures", "music"}), parsed.sources);
+    EXPECT_FALSE(cucd::Hook::parse_peer(QFileInfo(peerDir.filePath("bad"))).valid);
+
+    QVector<QDir> contentDirs;
+    contentDirs.append(peerDir);
+
+    auto mock = new NiceMock<MockedRegistry>{};
+    cucd::Hook *hook = new cucd::Hook(mock, contentDirs, tmp.path() + "/manifest.json");
+    EXPECT_CALL(*mock, install_source_for_type(_,_)).
+    Times(Exactly(peers * 2)).
+    WillRepeatedly(Return(true));
+    EXPECT_TRUE(hook->update_peers());
+
+    delete mock;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "com/ubuntu/content/detail/metrics.h"
+
+#include <com/ubuntu/content/transfer.h>
+
+#include <gtest/gtest.h>
+
+#include <QJsonDocument>
+
+namespace cuc = com::ubuntu::content;
+namespace cucd = com::ubuntu::content::detail;
+
+TEST(Metrics, histogram_buckets_are_log2)
+{
+    using namespace ::testing;
+
+    cucd::Histogram h;
+    EXPECT_EQ(0, h.percentile(0.5));
+
+    h.record(0);
+    h.record(3);
+    h.record(1000);
+    h.record(1000);
+
+    EXPECT_EQ(4, h.count());
+    EXPECT_EQ(2003, h.sum());
+    EXPECT_EQ(1000, h.max());
+    EXPECT_EQ(4, h.percentile(0.5));
+    EXPECT_EQ(1000, h.percentile(0.99));
+}
+
+TEST(Metrics, transfers_peers_and_errors_are_dumped)
+{
+    using namespace ::testing;
+
+    cucd::Metrics metrics;
+    metrics.transfer_created(1, "source-app", "destination-app");
+    metrics.transfer_state_changed(1, cuc::Transfer::initiated);
+    metrics.transfer_state_changed(1, cuc::Transfer::aborted);
+    metrics.application_launched("source-app", 1500, false);
+    metrics.paste_created("source-app", 4096);
+    metrics.paste_served(4096);
+
+    QJsonObject dump = QJsonDocument::fromJson(metrics.Dump().toUtf8()).object();
+    EXPECT_EQ(0, dump["active_transfers"].toInt());
+    EXPECT_EQ(1, dump["state_latency_us"].toObject()["created"].toObject()["count"].toInt());
+    EXPECT_EQ(1, dump["state_latency_us"].toObject()["initiated"].toObject()["count"].toInt());
+
+    QJsonObject source = dump["peers"].toObject()["source-app"].toObject();
+    EXPECT_EQ(1, source["sourced"].toInt());
+    EXPECT_EQ(1, source["aborted"].toInt());
+    EXPECT_EQ(1, source["launch_failures"].toInt());
+    EXPECT_EQ(1, source["pastes"].toInt());
+    EXPECT_EQ(1, dump["errors"].toObject()["launch-failed"].toInt());
+    EXPECT_EQ(4096, dump["bytes"].toObject()["paste_out"].toInt());
+
+    metrics.Reset();
+    dump = QJsonDocument::fromJson(metrics.Dump().toUtf8()).object();
+    EXPECT_TRUE(dump["peers"].toObject().isEmpty());
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "com/ubuntu/content/detail/mime_classifier.h"
+#include "com/ubuntu/content/detail/type_table.h"
+
+#include <gtest/gtest.h>
+
+#include <QFile>
+#include <QTemporaryDir>
+
+namespace cucd = com::ubuntu::content::detail;
+
+namespace
+{
+void write_file(const QString& path, const QByteArray& contents)
+{
+    QFile file(path);
+    ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+    file.write(contents);
+}
+
+struct MimeClassifier : public ::testing::Test
+{
+    void SetUp()
+    {
+        ASSERT_TRUE(dir.isValid());
+        write_file(dir.path() + "/subclasses",
+                   "text/x-csrc text/plain\n"
+                   "text/x-chdr text/x-csrc\n"
+                   "application/x-shellscript text/plain\n"
+                   "application/x-cbz application/zip\n"
+                   "image/x-canon-cr2 image/x-dcraw\n"
+                   "application/xml text/plain\n"
+                   "image/svg+xml application/xml\n"
+                   "application/vnd.oasis.opendocument.text-flat-xml application/xml\n"
+                   "image/x-eps application/postscript\n"
+                   "application/x-vnd.custom-book application/epub+zip\n");
+        write_file(dir.path() + "/aliases",
+                   "text/x-c text/x-csrc\n"
+                   "application/x-pdf application/pdf\n"
+                   "text/directory text/vcard\n");
+    }
+
+    QTemporaryDir dir;
+};
+}
+
+TEST_F(MimeClassifier, exact_types)
+{
+    cucd::MimeClassifier classifier(QStringList() << dir.path());
+
+    EXPECT_EQ(cucd::TextTypeIndex, classifier.classify(QByteArray("text/plain")));
+    EXPECT_EQ(cucd::ContactsTypeIndex, classifier.classify(QByteArray("text/vcard")));
+    EXPECT_EQ(cucd::EventsTypeIndex, classifier.classify(QByteArray("text/calendar")));
+    EXPECT_EQ(cucd::DocumentsTypeIndex, classifier.classify(QByteArray("application/pdf")));
+    EXPECT_EQ(cucd::EbooksTypeIndex, classifier.classify(QByteArray("application/epub+zip")));
+    EXPECT_EQ(cucd::LinksTypeIndex, classifier.classify(QByteArray("x-scheme-handler/https")));
+}
+
+TEST_F(MimeClassifier, subclasses_and_aliases)
+{
+    cucd::MimeClassifier classifier(QStringList() << dir.path());
+
+    EXPECT_EQ(cucd::TextTypeIndex, classifier.classify(QByteArray("text/x-chdr")));
+    EXPECT_EQ(cucd::TextTypeIndex, classifier.classify(QByteArray("text/x-c")));
+    EXPECT_EQ(cucd::TextTypeIndex, classifier.classify(QByteArray("application/x-shellscript")));
+    EXPECT_EQ(cucd::DocumentsTypeIndex, classifier.classify(QByteArray("application/x-pdf")));
+    EXPECT_EQ(cucd::EbooksTypeIndex, classifier.classify(QByteArray("application/x-vnd.custom-book")));
+    EXPECT_EQ(cucd::PicturesTypeIndex, classifier.classify(QByteArray("image/x-canon-cr2")));
+    EXPECT_EQ(cucd::UnknownTypeIndex, classifier.classify(QByteArray("application/x-cbz")));
+}
+
+TEST_F(MimeClassifier, prefixes_and_normalization)
+{
+    cucd::MimeClassifier classifier(QStringList() << dir.path());
+
+    EXPECT_EQ(cucd::PicturesTypeIndex, classifier.classify(QByteArray("image/webp")));
+    EXPECT_EQ(cucd::MusicTypeIndex, classifier.classify(QByteArray("audio/ogg")));
+    EXPECT_EQ(cucd::VideosTypeIndex, classifier.classify(QByteArray("video/mp4")));
+    EXPECT_EQ(cucd::DocumentsTypeIndex,
+              classifier.classify(QByteArray("application/vnd.oasis.opendocument.text")));
+    EXPECT_EQ(cucd::TextTypeIndex, classifier.classify(QString("Text/X-CSrc; charset=utf-8")));
+    EXPECT_EQ(cucd::UnknownTypeIndex, classifier.classify(QByteArray("application/octet-stream")));
+    EXPECT_EQ(cucd::UnknownTypeIndex, classifier.classify(QByteArray()));
+}
+
+TEST_F(MimeClassifier, works_without_database)
+{
+    cucd::MimeClassifier classifier(QStringList() << dir.path() + "/missing");
+
+    EXPECT_EQ(cucd::TextTypeIndex, classifier.classify(QByteArray("text/plain")));
+    EXPECT_EQ(cucd::PicturesTypeIndex, classifier.classify(QByteArray("image/png")));
+    EXPECT_EQ(cucd::UnknownTypeIndex, classifier.classify(QByteArray("text/x-csrc")));
+}
+
+TEST_F(MimeClassifier, prefixes_win_over_parents)
+{
+    cucd::MimeClassifier classifier(QStringList() << dir.path());
+
+    EXPECT_EQ(cucd::TextTypeIndex, classifier.classify(QByteArray("application/xml")));
+    EXPECT_EQ(cucd::PicturesTypeIndex, classifier.classify(QByteArray("image/svg+xml")));
+    EXPECT_EQ(cucd::DocumentsTypeIndex,
+              classifier.classify(QByteArray("application/vnd.oasis.opendocument.text-flat-xml")));
+    EXPECT_EQ(cucd::PicturesTypeIndex, classifier.classify(QByteArray("image/x-eps")));
+}
+
+TEST(MimeClassifierSystem, prefixes_win_over_parents)
+{
+    const cucd::MimeClassifier& classifier = cucd::MimeClassifier::instance();
+
+    EXPECT_EQ(cucd::PicturesTypeIndex, classifier.classify(QByteArray("image/svg+xml")));
+    EXPECT_EQ(cucd::DocumentsTypeIndex,
+              classifier.classify(QByteArray("application/vnd.oasis.opendocument.text-flat-xml")));
+    EXPECT_EQ(cucd::DocumentsTypeIndex,
+              classifier.classify(QByteArray("application/vnd.oasis.opendocument.spreadsheet-flat-xml")));
+    EXPECT_EQ(cucd::PicturesTypeIndex, classifier.classify(QByteArray("image/x-eps")));
+}
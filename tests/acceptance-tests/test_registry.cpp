@@ -0,0 +1,191 @@
+/*
+ * Copyright © 2016 Canonical Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <com/ubuntu/content/peer.h>
+#include <com/ubuntu/content/type.h>
+#include "com/ubuntu/content/service/registry.h"
+
+#include <gtest/gtest.h>
+
+#include <QGSettings/QGSettings>
+
+#include <gio/gio.h>
+
+namespace cuc = com::ubuntu::content;
+
+namespace
+{
+/* Runs against the in-memory GSettings backend, see CMakeLists.txt.
+ * Music and documents have no default source, syncing leaves them alone.
+ */
+struct RegistryTest : public ::testing::Test
+{
+    RegistryTest()
+        : sources("com.ubuntu.content.hub.source", "/com/ubuntu/content/hub/source/")
+    {
+    }
+
+    void SetUp()
+    {
+        sources.reset(cuc::Type::Known::contacts().id());
+        sources.reset(cuc::Type::Known::documents().id());
+        sources.reset(cuc::Type::Known::music().id());
+    }
+
+    QStringList contacts_sources()
+    {
+        return sources.get(cuc::Type::Known::contacts().id()).toStringList();
+    }
+
+    QStringList sources_for(const cuc::Type& type)
+    {
+        return sources.get(type.id()).toStringList();
+    }
+
+    QGSettings sources;
+};
+
+/* Fails the first write of one key, as a read-only key would */
+struct FlakyRegistry : public Registry
+{
+    bool write_key(GSettings* settings, const QString& key, const QStringList& peers)
+    {
+        if (key == failing_key)
+        {
+            failing_key.clear();
+            return false;
+        }
+        return Registry::write_key(settings, key, peers);
+    }
+
+    QString failing_key;
+};
+
+void count_change(GSettings*, const gchar* key, gpointer data)
+{
+    (*static_cast<QMap<QString, int>*>(data))[QString::fromUtf8(key)]++;
+}
+
+void dispatch_pending()
+{
+    while (g_main_context_iteration(nullptr, FALSE));
+}
+}
+
+TEST_F(RegistryTest, default_sources_load_on_first_use)
+{
+    Registry registry;
+    EXPECT_TRUE(contacts_sources().isEmpty());
+
+    EXPECT_EQ(cuc::Peer("address-book-app"), registry.default_source_for_type(cuc::Type::Known::contacts()));
+    EXPECT_EQ(QStringList() << "address-book-app", contacts_sources());
+
+    /* Only the first use syncs */
+    sources.reset(cuc::Type::Known::contacts().id());
+    registry.default_source_for_type(cuc::Type::Known::contacts());
+    EXPECT_TRUE(contacts_sources().isEmpty());
+}
+
+TEST_F(RegistryTest, installing_a_default_source_loads_the_defaults_first)
+{
+    Registry registry;
+    EXPECT_TRUE(contacts_sources().isEmpty());
+
+    EXPECT_FALSE(registry.install_default_source_for_type(cuc::Type::Known::contacts(),
+                                                          cuc::Peer("com.example.contacts")));
+    EXPECT_EQ(QStringList() << "address-book-app", contacts_sources());
+}
+
+TEST_F(RegistryTest, transactions_write_each_key_once_on_commit)
+{
+    Registry registry;
+    registry.default_source_for_type(cuc::Type::Known::contacts());
+
+    GSettings* watched = g_settings_new_with_path("com.ubuntu.content.hub.source",
+                                                  "/com/ubuntu/content/hub/source/");
+    QMap<QString, int> changes;
+    g_signal_connect(watched, "changed", G_CALLBACK(count_change), &changes);
+    /* Reading subscribes the keys for change notifications */
+    g_variant_unref(g_settings_get_value(watched, "documents"));
+    g_variant_unref(g_settings_get_value(watched, "music"));
+    dispatch_pending();
+    changes.clear();
+
+    registry.begin_transaction();
+    registry.install_source_for_type(cuc::Type::Known::documents(), cuc::Peer("com.example.one"));
+    registry.install_source_for_type(cuc::Type::Known::documents(), cuc::Peer("com.example.two"));
+    registry.install_source_for_type(cuc::Type::Known::music(), cuc::Peer("com.example.one"));
+
+    /* Nothing is written before the commit */
+    dispatch_pending();
+    EXPECT_TRUE(sources_for(cuc::Type::Known::documents()).isEmpty());
+    EXPECT_TRUE(changes.isEmpty());
+
+    EXPECT_TRUE(registry.commit_transaction());
+    dispatch_pending();
+    EXPECT_EQ(QStringList() << "com.example.one" << "com.example.two",
+              sources_for(cuc::Type::Known::documents()));
+    EXPECT_EQ(QStringList() << "com.example.one", sources_for(cuc::Type::Known::music()));
+    EXPECT_EQ(1, changes.value("documents"));
+    EXPECT_EQ(1, changes.value("music"));
+
+    g_object_unref(watched);
+}
+
+TEST_F(RegistryTest, failed_keys_stay_pending_until_the_next_commit)
+{
+    FlakyRegistry registry;
+    registry.default_source_for_type(cuc::Type::Known::contacts());
+    registry.failing_key = cuc::Type::Known::documents().id();
+
+    registry.begin_transaction();
+    registry.install_source_for_type(cuc::Type::Known::documents(), cuc::Peer("com.example.one"));
+    registry.install_source_for_type(cuc::Type::Known::music(), cuc::Peer("com.example.one"));
+    EXPECT_FALSE(registry.commit_transaction());
+
+    /* The rest of the change set still went out */
+    EXPECT_TRUE(sources_for(cuc::Type::Known::documents()).isEmpty());
+    EXPECT_EQ(QStringList() << "com.example.one", sources_for(cuc::Type::Known::music()));
+
+    /* The registry still answers with what it failed to write */
+    QStringList known;
+    registry.enumerate_known_sources_for_type(cuc::Type::Known::documents(), [&known](const cuc::Peer& peer)
+    {
+        known << peer.id();
+    });
+    EXPECT_TRUE(known.contains("com.example.one"));
+
+    registry.begin_transaction();
+    EXPECT_TRUE(registry.commit_transaction());
+    EXPECT_EQ(QStringList() << "com.example.one", sources_for(cuc::Type::Known::documents()));
+}
+
+TEST_F(RegistryTest, failed_keys_are_retried_by_the_next_plain_write)
+{
+    FlakyRegistry registry;
+    registry.default_source_for_type(cuc::Type::Known::contacts());
+    registry.failing_key = cuc::Type::Known::documents().id();
+
+    registry.begin_transaction();
+    registry.install_source_for_type(cuc::Type::Known::documents(), cuc::Peer("com.example.one"));
+    EXPECT_FALSE(registry.commit_transaction());
+    EXPECT_TRUE(sources_for(cuc::Type::Known::documents()).isEmpty());
+
+    /* No transaction follows, an unrelated write still flushes the key */
+    EXPECT_TRUE(registry.install_source_for_type(cuc::Type::Known::music(), cuc::Peer("com.example.two")));
+    EXPECT_EQ(QStringList() << "com.example.one", sources_for(cuc::Type::Known::documents()));
+    EXPECT_EQ(QStringList() << "com.example.two", sources_for(cuc::Type::Known::music()));
+}
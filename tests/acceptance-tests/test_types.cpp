@@ -17,10 +17,12 @@
  */
 
 #include <com/ubuntu/content/type.h>
+#include "../../src/com/ubuntu/content/detail/type_table.h"
 
 #include <gtest/gtest.h>
 
 namespace cuc = com::ubuntu::content;
+namespace cucd = com::ubuntu::content::detail;
 
 TEST(Types, id_documents)
 {
@@ -66,3 +68,51 @@ TEST(Types, id_events)
 {
     EXPECT_EQ(cuc::Type::Known::events().id(), "events");
 }
+
+TEST(Types, known_types_have_fixed_indices)
+{
+    EXPECT_EQ(cucd::UnknownTypeIndex, cuc::Type::unknown().index());
+    EXPECT_EQ(cucd::AllTypeIndex, cuc::Type::all().index());
+    EXPECT_EQ(cucd::DocumentsTypeIndex, cuc::Type::Known::documents().index());
+    EXPECT_EQ(cucd::EventsTypeIndex, cuc::Type::Known::events().index());
+
+    for (int i = 0; i < cucd::KnownTypeCount; i++)
+    {
+        EXPECT_EQ(i, cucd::find_type(QString::fromLatin1(cucd::knownTypeNames[i])));
+        EXPECT_EQ(QString::fromLatin1(cucd::knownTypeNames[i]), cucd::type_name(i));
+    }
+}
+
+TEST(Types, interning_is_stable)
+{
+    EXPECT_EQ(-1, cucd::find_type("types-test-custom"));
+
+    int index = cucd::intern_type("types-test-custom");
+    EXPECT_GE(index, int(cucd::KnownTypeCount));
+    EXPECT_EQ(index, cucd::intern_type("types-test-custom"));
+    EXPECT_EQ(index, cucd::find_type("types-test-custom"));
+    EXPECT_EQ(QString("types-test-custom"), cucd::type_name(index));
+
+    EXPECT_FALSE(cucd::is_well_known_type(index));
+    EXPECT_FALSE(cucd::is_installable_type(index));
+    EXPECT_TRUE(cucd::is_installable_type(cucd::AllTypeIndex));
+    EXPECT_FALSE(cucd::is_well_known_type(cucd::AllTypeIndex));
+    EXPECT_TRUE(cucd::is_well_known_type(cucd::TextTypeIndex));
+}
+
+TEST(Types, constructing_does_not_intern)
+{
+    cuc::Type from_bus("types-test-from-bus");
+    EXPECT_EQ(-1, from_bus.index());
+    EXPECT_EQ(-1, cucd::find_type("types-test-from-bus"));
+    EXPECT_FALSE(cucd::is_well_known_type(from_bus.index()));
+
+    EXPECT_TRUE(from_bus == cuc::Type("types-test-from-bus"));
+    EXPECT_TRUE(from_bus != cuc::Type("types-test-other"));
+    EXPECT_TRUE(from_bus != cuc::Type::unknown());
+
+    /* Registered later, both still compare equal */
+    cucd::intern_type("types-test-from-bus");
+    EXPECT_TRUE(from_bus == cuc::Type("types-test-from-bus"));
+    EXPECT_EQ(cucd::PicturesTypeIndex, cuc::Type("pictures").index());
+}
@@ -17,6 +17,10 @@
  */
 
 #include "com/ubuntu/content/utils.cpp"
+#include "com/ubuntu/content/trace.h"
+
+#include <QTemporaryDir>
+#include <QTemporaryFile>
 
 #include <gtest/gtest.h>
 
@@ -50,3 +54,195 @@ TEST(Utils, purge_store_cache)
     EXPECT_FALSE(purge_store_cache(persistent_store.absolutePath()));
     EXPECT_TRUE(persistent_store.exists());
 }
+
+TEST(Trace, records_are_dumped_from_the_ring)
+{
+    using namespace ::testing;
+
+    traceCategoryMask = ~0u;
+    TRACE_EVENT(TraceTransfer, TraceWarning, "id=%d state=%d", 42, 3);
+
+    QTemporaryFile file;
+    ASSERT_TRUE(file.open());
+    trace_dump(file.handle());
+    file.seek(0);
+    QByteArray dump = file.readAll();
+    EXPECT_TRUE(dump.contains("transfer"));
+    EXPECT_TRUE(dump.contains("id=42 state=3"));
+}
+
+TEST(Trace, disabled_categories_skip_formatting)
+{
+    using namespace ::testing;
+
+    int evaluated = 0;
+    traceCategoryMask = ~0u & ~(1u << TracePeer);
+    TRACE_EVENT(TracePeer, TraceWarning, "%d", ++evaluated);
+    EXPECT_EQ(0, evaluated);
+
+    traceCategoryMask = ~0u;
+    TRACE_EVENT(TracePeer, TraceWarning, "%d", ++evaluated);
+    EXPECT_EQ(1, evaluated);
+}
+
+TEST(Utils, sniff_mime_type_reads_the_header)
+{
+    using namespace ::testing;
+
+    QTemporaryFile png(QDir::tempPath() + "/sniffXXXXXX.dat");
+    ASSERT_TRUE(png.open());
+    png.write(QByteArray::fromHex("89504e470d0a1a0a0000000d49484452"));
+    png.write(QByteArray(64 * 1024, '\0'));
+    png.flush();
+    EXPECT_EQ(QString("image/png"), sniff_mime_type(png.fileName()));
+
+    QTemporaryFile text(QDir::tempPath() + "/sniffXXXXXX.txt");
+    ASSERT_TRUE(text.open());
+    text.write("Hello World!\n");
+    text.flush();
+    EXPECT_EQ(QString("text/plain"), sniff_mime_type(text.fileName()));
+
+    EXPECT_FALSE(sniff_mime_type(QDir::tempPath() + "/does-not-exist.png").isEmpty());
+
+    /* Only regular files are read, a FIFO would block */
+    QTemporaryDir dir;
+    const QString fifo = dir.path() + "/fifo.txt";
+    ASSERT_EQ(0, mkfifo(QFile::encodeName(fifo).constData(), 0600));
+    EXPECT_EQ(QString("text/plain"), sniff_mime_type(fifo));
+
+    /* Nor are symlinks followed */
+    const QString link = dir.path() + "/link.dat";
+    ASSERT_TRUE(QFile::link(png.fileName(), link));
+    EXPECT_NE(QString("image/png"), sniff_mime_type(link));
+}
+
+TEST(Utils, deliver_to_store_links_from_transient_stores)
+{
+    using namespace ::testing;
+
+    QDir temp_store(temp_path);
+    temp_store.mkpath(temp_store.absolutePath());
+    QList<QUrl> urls;
+    for (int i = 0; i < 3; i++)
+    {
+        QFile f(temp_store.filePath(QString("photo%1.jpg").arg(i)));
+        ASSERT_TRUE(f.open(QIODevice::WriteOnly));
+        f.write("not really a jpeg");
+        urls << QUrl::fromLocalFile(f.fileName());
+    }
+    urls << QUrl("http://example.com/remote.jpg");
+
+    QTemporaryDir shared;
+    QStringList paths = deliver_to_store(urls, shared.path() + "/shared");
+    ASSERT_EQ(3, paths.size());
+    Q_FOREACH (const QString& path, paths)
+    {
+        struct stat st;
+        ASSERT_EQ(0, stat(QFile::encodeName(path).constData(), &st));
+        EXPECT_EQ(2u, st.st_nlink);
+    }
+
+    /* Delivering again doesn't overwrite what is there */
+    QStringList again = deliver_to_store(urls.mid(0, 1), shared.path() + "/shared");
+    ASSERT_EQ(1, again.size());
+    EXPECT_NE(paths.at(0), again.at(0));
+
+    EXPECT_TRUE(purge_store_cache(temp_store.absolutePath()));
+    Q_FOREACH (const QString& path, paths)
+        EXPECT_TRUE(QFile::exists(path));
+}
+
+namespace
+{
+void touch(const QString& path)
+{
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QFile f(path);
+    f.open(QIODevice::WriteOnly);
+}
+}
+
+TEST(Utils, walk_directory_visits_nested_dirs_in_order)
+{
+    using namespace ::testing;
+
+    QTemporaryDir root;
+    touch(root.path() + "/b");
+    touch(root.path() + "/a");
+    touch(root.path() + "/sub/c");
+    touch(root.path() + "/sub/deeper/d");
+    touch(root.path() + "/too/deep/e");
+    QDir().mkpath(root.path() + "/empty");
+    QFile::link(root.path() + "/sub", root.path() + "/link");
+
+    QStringList found;
+    int count = walk_directory(root.path(), [&found](const QStringList& batch)
+    {
+        found << batch;
+    }, 100, 2);
+
+    QStringList expected;
+    expected << root.path() + "/a" << root.path() + "/b"
+             << root.path() + "/sub/c" << root.path() + "/sub/deeper/d";
+    EXPECT_EQ(expected, found.mid(0, 4));
+    /* too/deep/e is two levels down as well, link isn't followed */
+    EXPECT_EQ(5, count);
+    EXPECT_EQ(5, found.size());
+    EXPECT_FALSE(found.contains(root.path() + "/link/c"));
+
+    found.clear();
+    EXPECT_EQ(3, walk_directory(root.path(), [&found](const QStringList& batch)
+    {
+        found << batch;
+    }, 100, 1));
+}
+
+TEST(Utils, walk_directory_hands_out_batches_up_to_the_cap)
+{
+    using namespace ::testing;
+
+    QTemporaryDir root;
+    for (int i = 0; i < walkBatchSize * 2 + 10; i++)
+        touch(root.path() + QString("/sub%1/file%2").arg(i % 3).arg(i));
+
+    QList<int> sizes;
+    int count = walk_directory(root.path(), [&sizes](const QStringList& batch)
+    {
+        sizes << batch.size();
+    });
+    EXPECT_EQ(walkBatchSize * 2 + 10, count);
+    ASSERT_EQ(3, sizes.size());
+    EXPECT_EQ(walkBatchSize, sizes.at(0));
+    EXPECT_EQ(walkBatchSize, sizes.at(1));
+    EXPECT_EQ(10, sizes.at(2));
+
+    sizes.clear();
+    EXPECT_EQ(walkBatchSize + 1, walk_directory(root.path(), [&sizes](const QStringList& batch)
+    {
+        sizes << batch.size();
+    }, walkBatchSize + 1));
+    EXPECT_EQ(QList<int>() << walkBatchSize << 1, sizes);
+}
+
+TEST(Utils, directory_walker_knows_when_the_cap_cut_it_short)
+{
+    using namespace ::testing;
+
+    QTemporaryDir root;
+    touch(root.path() + "/a");
+    touch(root.path() + "/b");
+    QDir().mkpath(root.path() + "/empty/emptier");
+
+    /* Exactly as many files as allowed, only empty dirs are left */
+    DirectoryWalker exact(root.path(), 2);
+    EXPECT_EQ(2, exact.next().size());
+    EXPECT_TRUE(exact.next().isEmpty());
+    EXPECT_FALSE(exact.more());
+
+    touch(root.path() + "/empty/emptier/c");
+    DirectoryWalker capped(root.path(), 2);
+    EXPECT_EQ(2, capped.next().size());
+    EXPECT_TRUE(capped.next().isEmpty());
+    EXPECT_TRUE(capped.more());
+    EXPECT_EQ(2, capped.count());
+}
@@ -0,0 +1,362 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Load generator for the content hub.
+ *
+ * Starts a private dbus-daemon and a real content-hub-service on it,
+ * then spawns N copies of itself in --worker mode.  Each worker acts as
+ * a peer running a weighted mix of pastes, import transfers and handler
+ * registrations until the deadline and reports one latency sample per
+ * line on stdout.  The coordinator samples the service RSS once a second
+ * and prints throughput and latency percentiles per operation at the end.
+ */
+
+#include <com/ubuntu/content/hub.h>
+#include <com/ubuntu/content/item.h>
+#include <com/ubuntu/content/peer.h>
+#include <com/ubuntu/content/transfer.h>
+#include <com/ubuntu/content/type.h>
+
+#include "common.h"
+#include "debug.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDBusConnectionInterface>
+#include <QDBusInterface>
+#include <QDBusObjectPath>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMap>
+#include <QMimeData>
+#include <QProcess>
+#include <QThread>
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+namespace cuc = com::ubuntu::content;
+
+namespace
+{
+struct Workload
+{
+    QList<int> paste_sizes;
+    QList<int> transfer_items;
+    int paste_weight;
+    int transfer_weight;
+    int handler_weight;
+    int duration;
+};
+
+QList<int> parse_sizes(const QString& spec)
+{
+    QList<int> sizes;
+    Q_FOREACH (QString s, spec.split(",", QString::SkipEmptyParts))
+    {
+        int multiplier = 1;
+        if (s.endsWith("k", Qt::CaseInsensitive))
+            multiplier = 1024;
+        else if (s.endsWith("m", Qt::CaseInsensitive))
+            multiplier = 1024 * 1024;
+        if (multiplier > 1)
+            s.chop(1);
+        sizes << s.toInt() * multiplier;
+    }
+    return sizes;
+}
+
+/* paste=60,transfer=30,handler=10 */
+bool parse_mix(const QString& spec, Workload& workload)
+{
+    workload.paste_weight = workload.transfer_weight = workload.handler_weight = 0;
+    Q_FOREACH (QString entry, spec.split(",", QString::SkipEmptyParts))
+    {
+        QStringList kv = entry.split("=");
+        if (kv.count() != 2)
+            return false;
+        int weight = kv[1].toInt();
+        if (kv[0] == "paste")
+            workload.paste_weight = weight;
+        else if (kv[0] == "transfer")
+            workload.transfer_weight = weight;
+        else if (kv[0] == "handler")
+            workload.handler_weight = weight;
+        else
+            return false;
+    }
+    return workload.paste_weight + workload.transfer_weight + workload.handler_weight > 0;
+}
+
+void report_sample(const char* op, qint64 usecs, bool ok)
+{
+    printf("%s\t%lld\t%d\n", op, (long long) usecs, ok ? 1 : 0);
+}
+
+int run_worker(int id, const Workload& workload)
+{
+    auto hub = cuc::Hub::Client::instance();
+    auto peer = hub->default_source_for_type(cuc::Type::Known::pictures());
+    QDBusInterface service(HUB_SERVICE_NAME, HUB_SERVICE_PATH,
+                           "com.ubuntu.content.dbus.Service", QDBusConnection::sessionBus());
+
+    std::mt19937 random(id);
+    std::discrete_distribution<int> pick_op{double(workload.paste_weight),
+                                            double(workload.transfer_weight),
+                                            double(workload.handler_weight)};
+    QString surface = QString("loadgen-surface-%1").arg(id);
+    int handlers = 0;
+
+    QElapsedTimer deadline;
+    deadline.start();
+    while (deadline.elapsed() < workload.duration * 1000)
+    {
+        QElapsedTimer timer;
+        switch (pick_op(random))
+        {
+        case 0:
+        {
+            int size = workload.paste_sizes.at(random() % workload.paste_sizes.count());
+            QMimeData data;
+            data.setData("application/x-content-hub-loadgen", QByteArray(size, 'p'));
+            timer.start();
+            bool ok = hub->createPasteSync(surface, data);
+            QMimeData* result = hub->latestPaste(surface);
+            report_sample("paste", timer.nsecsElapsed() / 1000, ok && result != nullptr);
+            delete result;
+            break;
+        }
+        case 1:
+        {
+            int count = workload.transfer_items.at(random() % workload.transfer_items.count());
+            QVector<cuc::Item> items;
+            for (int i = 0; i < count; i++)
+            {
+                cuc::Item item;
+                item.setName(QString("item%1").arg(i));
+                item.setText(QString("loadgen %1/%2").arg(id).arg(i));
+                items << item;
+            }
+            timer.start();
+            auto transfer = hub->create_import_from_peer(peer);
+            bool ok = transfer != nullptr && transfer->start() && transfer->charge(items);
+            if (ok)
+                ok = transfer->collect().count() == count;
+            if (transfer != nullptr)
+                transfer->finalize();
+            report_sample("transfer", timer.nsecsElapsed() / 1000, ok);
+            delete transfer;
+            break;
+        }
+        case 2:
+        {
+            QString peer_id = QString("com.example.loadgen%1-%2_app_1.0").arg(id).arg(handlers++);
+            timer.start();
+            QDBusMessage reply = service.call("RegisterImportExportHandler", peer_id,
+                                              QVariant::fromValue(QDBusObjectPath("/loadgen/handler")));
+            report_sample("handler", timer.nsecsElapsed() / 1000, reply.type() != QDBusMessage::ErrorMessage);
+            break;
+        }
+        }
+    }
+    fflush(stdout);
+    return 0;
+}
+
+qint64 rss_kb(qint64 pid)
+{
+    QFile status(QString("/proc/%1/status").arg(pid));
+    if (not status.open(QIODevice::ReadOnly))
+        return -1;
+    Q_FOREACH (QByteArray line, status.readAll().split('\n'))
+    {
+        if (line.startsWith("VmRSS:"))
+            return line.mid(6).trimmed().split(' ').first().toLongLong();
+    }
+    return -1;
+}
+
+qint64 percentile(const QVector<qint64>& sorted, double p)
+{
+    if (sorted.isEmpty())
+        return 0;
+    int index = qMin(sorted.count() - 1, int(p * sorted.count()));
+    return sorted.at(index);
+}
+
+int run_coordinator(const QCommandLineParser& parser, const Workload& workload)
+{
+    int clients = parser.value("clients").toInt();
+
+    QProcess bus;
+    bus.start("dbus-daemon", QStringList() << "--session" << "--nofork" << "--print-address=1");
+    if (not bus.waitForReadyRead(5000))
+    {
+        qWarning() << "Failed to start dbus-daemon";
+        return 1;
+    }
+    QString address = QString::fromUtf8(bus.readLine()).trimmed();
+
+    QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+    env.insert("DBUS_SESSION_BUS_ADDRESS", address);
+    env.insert("CONTENT_HUB_TESTING", "1");
+
+    QProcess service;
+    service.setProcessEnvironment(env);
+    service.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    service.start(parser.value("service"));
+    if (not service.waitForStarted())
+    {
+        qWarning() << "Failed to start" << parser.value("service");
+        bus.kill();
+        return 1;
+    }
+
+    auto connection = QDBusConnection::connectToBus(address, "loadgen");
+    QElapsedTimer wait;
+    wait.start();
+    while (not connection.interface()->isServiceRegistered(HUB_SERVICE_NAME))
+    {
+        if (wait.elapsed() > 10000)
+        {
+            qWarning() << "Service never claimed" << HUB_SERVICE_NAME;
+            service.kill();
+            bus.kill();
+            return 1;
+        }
+        QThread::msleep(10);
+    }
+    printf("service started in %lld ms\n", (long long) wait.elapsed());
+
+    QList<QProcess*> workers;
+    QStringList args = QCoreApplication::arguments().mid(1);
+    for (int i = 0; i < clients; i++)
+    {
+        auto worker = new QProcess();
+        QProcessEnvironment worker_env = env;
+        worker_env.insert("APP_ID", QString("com.example.loadgen%1_app_1.0").arg(i));
+        worker->setProcessEnvironment(worker_env);
+        worker->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+        worker->start(QCoreApplication::applicationFilePath(),
+                      QStringList() << args << "--worker" << QString::number(i));
+        workers << worker;
+    }
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+    printf("%8s %10s\n", "time(s)", "rss(kB)");
+    qint64 peak_rss = 0;
+    bool running = true;
+    while (running)
+    {
+        running = false;
+        Q_FOREACH (QProcess* worker, workers)
+        {
+            /* Drain output so workers never block on a full pipe */
+            worker->waitForReadyRead(0);
+            if (worker->state() != QProcess::NotRunning)
+                running = true;
+        }
+        qint64 rss = rss_kb(service.processId());
+        peak_rss = qMax(peak_rss, rss);
+        printf("%8.1f %10lld\n", elapsed.elapsed() / 1000.0, (long long) rss);
+        fflush(stdout);
+        if (running)
+            QThread::sleep(1);
+    }
+    double seconds = elapsed.elapsed() / 1000.0;
+
+    QMap<QString, QVector<qint64>> samples;
+    QMap<QString, int> failures;
+    Q_FOREACH (QProcess* worker, workers)
+    {
+        worker->waitForFinished();
+        Q_FOREACH (QByteArray line, worker->readAllStandardOutput().split('\n'))
+        {
+            QList<QByteArray> fields = line.split('\t');
+            if (fields.count() != 3)
+                continue;
+            samples[fields[0]] << fields[1].toLongLong();
+            if (fields[2] != "1")
+                failures[fields[0]]++;
+        }
+        delete worker;
+    }
+
+    printf("\n%-10s %8s %8s %10s %10s %10s %10s\n", "op", "count", "failed", "ops/s", "p50(us)", "p95(us)", "p99(us)");
+    Q_FOREACH (QString op, samples.keys())
+    {
+        QVector<qint64> latencies = samples.value(op);
+        std::sort(latencies.begin(), latencies.end());
+        printf("%-10s %8d %8d %10.1f %10lld %10lld %10lld\n", qPrintable(op),
+               latencies.count(), failures.value(op), latencies.count() / seconds,
+               (long long) percentile(latencies, 0.50),
+               (long long) percentile(latencies, 0.95),
+               (long long) percentile(latencies, 0.99));
+    }
+    printf("\npeak service rss: %lld kB\n", (long long) peak_rss);
+
+    service.terminate();
+    service.waitForFinished(5000);
+    bus.terminate();
+    bus.waitForFinished(5000);
+    return 0;
+}
+}
+
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv);
+
+    /* read environment variables */
+    QProcessEnvironment environment = QProcessEnvironment::systemEnvironment();
+    if (environment.contains(QLatin1String("CONTENT_HUB_LOGGING_LEVEL"))) {
+        bool isOk;
+        int value = environment.value(
+            QLatin1String("CONTENT_HUB_LOGGING_LEVEL")).toInt(&isOk);
+        if (isOk)
+            setLoggingLevel(value);
+    }
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Generates concurrent load against a private content hub service");
+    parser.addHelpOption();
+    parser.addOption({"clients", "Number of simulated peers.", "n", "16"});
+    parser.addOption({"duration", "Seconds each peer runs for.", "seconds", "30"});
+    parser.addOption({"mix", "Weighted operation mix.", "mix", "paste=60,transfer=30,handler=10"});
+    parser.addOption({"paste-sizes", "Paste sizes to pick from.", "sizes", "256,4k,64k,1m"});
+    parser.addOption({"transfer-items", "Item counts per transfer to pick from.", "counts", "1,8,64"});
+    parser.addOption({"service", "Service executable.", "path", "content-hub-service"});
+    parser.addOption({"worker", "Internal, run as simulated peer number n.", "n"});
+    parser.process(app);
+
+    Workload workload;
+    workload.paste_sizes = parse_sizes(parser.value("paste-sizes"));
+    workload.transfer_items = parse_sizes(parser.value("transfer-items"));
+    workload.duration = parser.value("duration").toInt();
+    if (not parse_mix(parser.value("mix"), workload)
+        || workload.paste_sizes.isEmpty()
+        || workload.transfer_items.isEmpty())
+    {
+        qWarning() << "Invalid workload";
+        return 1;
+    }
+
+    if (parser.isSet("worker"))
+        return run_worker(parser.value("worker").toInt(), workload);
+    return run_coordinator(parser, workload);
+}